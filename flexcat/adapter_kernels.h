@@ -0,0 +1,824 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+/*
+- SIMD kernels of the ungapped AlignAlgorithms Menkuec, MenkuecBounded, MenkuecBatch, MenkuecQ and MateOverlap
+- no include guard, adapter_trimming.h includes this file once per instruction set, each time into its own namespace
+  and with its own target options, so that one binary contains all variants
+- ADAPTER_KERNEL_WIDTH is the widest register that may be used: 16 (SSE4.2), 32 (AVX2) or 64 (AVX-512BW)
+- wide constants are created inside the functions, a global initializer would run on CPUs without the instruction set
+*/
+
+template <typename TEncoding>
+struct EncodingOps;
+
+template <>
+struct EncodingOps<AsciiEncoding>
+{
+    static inline bool isN(const unsigned char value) noexcept
+    {
+        return value == 'N';
+    }
+    static inline __m128i n128() noexcept
+    {
+        return N_128;
+    }
+    static inline __m128i base(const __m128i value) noexcept
+    {
+        return value;
+    }
+#if ADAPTER_KERNEL_WIDTH >= 32
+    static inline __m256i n256() noexcept
+    {
+        return _mm256_set1_epi8('N');
+    }
+    static inline __m256i base(const __m256i value) noexcept
+    {
+        return value;
+    }
+#endif
+#if ADAPTER_KERNEL_WIDTH >= 64
+    static inline __m512i n512() noexcept
+    {
+        return _mm512_set1_epi8('N');
+    }
+    static inline __m512i base(const __m512i value) noexcept
+    {
+        return value;
+    }
+#endif
+};
+
+template <>
+struct EncodingOps<Dna5QEncoding>
+{
+    static inline bool isN(const unsigned char value) noexcept
+    {
+        return value == DNA5Q_N;
+    }
+    static inline __m128i n128() noexcept
+    {
+        return DNA5Q_N_128;
+    }
+    static inline __m128i base(const __m128i value) noexcept
+    {
+        return _mm_and_si128(value, DNA5Q_BASE_MASK_128);
+    }
+#if ADAPTER_KERNEL_WIDTH >= 32
+    static inline __m256i n256() noexcept
+    {
+        return _mm256_set1_epi8(static_cast<char>(DNA5Q_N));
+    }
+    static inline __m256i base(const __m256i value) noexcept
+    {
+        return _mm256_and_si256(value, _mm256_set1_epi8(0x03));
+    }
+#endif
+#if ADAPTER_KERNEL_WIDTH >= 64
+    static inline __m512i n512() noexcept
+    {
+        return _mm512_set1_epi8(static_cast<char>(DNA5Q_N));
+    }
+    static inline __m512i base(const __m512i value) noexcept
+    {
+        return _mm512_and_si512(value, _mm512_set1_epi8(0x03));
+    }
+#endif
+};
+
+inline size_t popcnt64(__m128i value) noexcept
+{
+    //value = _mm_sad_epu8(ZERO_128, value);
+    //return _mm_extract_epi16(value, 0);
+#ifdef VECTOR_ACCESS
+    return _mm_popcnt_u64(value.m128i_u64[0]);
+#else
+    return _mm_popcnt_u64(_mm_extract_epi64(value,0));
+#endif
+}
+
+inline size_t popcnt128(__m128i value) noexcept
+{
+//    value = _mm_sad_epu8(ZERO_128, value);
+//    return _mm_extract_epi16(value, 0) + _mm_extract_epi16(value, 4);
+#ifdef VECTOR_ACCESS
+    return _mm_popcnt_u64(value.m128i_u64[0]) + _mm_popcnt_u64(value.m128i_u64[1]);
+#else
+    return _mm_popcnt_u64(_mm_extract_epi64(value, 0)) + _mm_popcnt_u64(_mm_extract_epi64(value, 1));
+#endif
+}
+
+#if ADAPTER_KERNEL_WIDTH >= 32
+inline size_t popcnt256(__m256i value) noexcept
+{
+#ifdef VECTOR_ACCESS
+    return _mm_popcnt_u64(value.m256i_u64[0]) +
+        _mm_popcnt_u64(value.m256i_u64[1]) +
+        _mm_popcnt_u64(value.m256i_u64[2]) +
+        _mm_popcnt_u64(value.m256i_u64[3]);
+#else
+    return _mm_popcnt_u64(_mm256_extract_epi64(value, 0)) +
+        _mm_popcnt_u64(_mm256_extract_epi64(value, 1)) +
+        _mm_popcnt_u64(_mm256_extract_epi64(value, 2)) +
+        _mm_popcnt_u64(_mm256_extract_epi64(value, 3));
+#endif
+}
+#endif
+
+template <unsigned int N, typename TEncoding>
+struct compareAdapter
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        // SSE2 code
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_8));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_8));
+        
+        // SSE4.2 code 
+        //ambiguous += _mm_popcnt_u32(_mm_extract_epi8(_mm_and_si128(NMask, ONE_128), 0));
+        //matches += _mm_popcnt_u32(_mm_extract_epi8(_mm_and_si128(matchesMask, ONE_128), 0));
+
+        ++adapterIterator;
+        ++readIterator;
+        compareAdapter<N-1, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<0, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        (void)readIterator;
+        (void)adapterIterator;
+        (void)matches;
+        (void)ambiguous;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<2, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_16));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_16));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 2;
+        adapterIterator += 2;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<3, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_24));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_24));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 3;
+        adapterIterator += 3;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<4, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_32));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_32));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 4;
+        adapterIterator += 4;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<5, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_40));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_40));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 5;
+        adapterIterator += 5;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<6, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_48));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_48));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 6;
+        adapterIterator += 6;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<7, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_56));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_56));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 7;
+        adapterIterator += 7;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<8, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_128));
+        matches += popcnt64(_mm_and_si128(matchesMask, ONE_128));
+        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
+        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
+        readIterator += 8;
+        adapterIterator += 8;
+    }
+};
+
+template <typename TEncoding>
+struct compareAdapter<16, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
+        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
+
+        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128()),_mm_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n128())));
+        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt128(_mm_and_si128(NMask, ONE_128));
+        matches += popcnt128(_mm_and_si128(matchesMask, ONE_128));
+        readIterator += 16;
+        adapterIterator += 16;
+    }
+};
+
+#if ADAPTER_KERNEL_WIDTH >= 32
+template <typename TEncoding>
+struct compareAdapter<32, TEncoding>
+{
+    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
+    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    {
+        const __m256i ZERO_256 = _mm256_setzero_si256();
+        const __m256i ONE_256 = _mm256_set1_epi8(1);
+        const __m256i read = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&(*readIterator)));
+        const __m256i adapter = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&(*adapterIterator)));
+
+        const __m256i NMask = _mm256_sub_epi8(ZERO_256, _mm256_or_si256(_mm256_cmpeq_epi8(read, EncodingOps<TEncoding>::n256()), _mm256_cmpeq_epi8(adapter, EncodingOps<TEncoding>::n256())));
+        const __m256i matchesMask = _mm256_sub_epi8(ZERO_256, _mm256_or_si256(_mm256_cmpeq_epi8(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)), NMask));
+
+        ambiguous += popcnt256(_mm256_and_si256(NMask, ONE_256));
+        matches += popcnt256(_mm256_and_si256(matchesMask, ONE_256));
+        readIterator += 32;
+        adapterIterator += 32;
+    }
+};
+#endif
+
+#if ADAPTER_KERNEL_WIDTH >= 64
+/*
+- compares up to 64 bases, the masked loads do not touch memory behind the last base
+- compare results are bit masks, so they can be counted directly
+*/
+template <typename TEncoding, typename TCounter>
+inline void compareAdapter64(const unsigned char*& readIterator, const unsigned char*& adapterIterator, const unsigned int numBases,
+    TCounter& matches, TCounter& ambiguous) noexcept
+{
+    const __mmask64 validMask = numBases >= 64 ? ~__mmask64(0) : (__mmask64(1) << numBases) - 1;
+    const __m512i read = _mm512_maskz_loadu_epi8(validMask, readIterator);
+    const __m512i adapter = _mm512_maskz_loadu_epi8(validMask, adapterIterator);
+
+    const __mmask64 NMask = validMask & (_mm512_cmpeq_epi8_mask(read, EncodingOps<TEncoding>::n512()) |
+        _mm512_cmpeq_epi8_mask(adapter, EncodingOps<TEncoding>::n512()));
+    const __mmask64 matchesMask = validMask & (_mm512_cmpeq_epi8_mask(EncodingOps<TEncoding>::base(read), EncodingOps<TEncoding>::base(adapter)) | NMask);
+
+    ambiguous += _mm_popcnt_u64(NMask);
+    matches += _mm_popcnt_u64(matchesMask);
+    readIterator += numBases;
+    adapterIterator += numBases;
+}
+#endif
+
+/*
+- counts matches and ambiguous bases of the overlap of read and adapter at one shift position
+- stops after a block of 16 or more bases once more than maxMismatches bases mismatch,
+  the mismatches are counted as processed bases - matches, which is a lower bound only if neither read nor adapter contain N
+*/
+template <typename TEncoding>
+inline void compareOverlap(const unsigned char* readIterator, const unsigned char* adapterIterator, const unsigned int overlap,
+    unsigned int& matches, unsigned int& ambiguous, const unsigned int maxMismatches) noexcept
+{
+    unsigned int remaining = overlap;
+
+#if ADAPTER_KERNEL_WIDTH >= 64
+    while (remaining > 0)
+    {
+        const unsigned int numBases = std::min<unsigned int>(remaining, 64);
+        compareAdapter64<TEncoding>(readIterator, adapterIterator, numBases, matches, ambiguous);
+        remaining -= numBases;
+        if (overlap - remaining - matches > maxMismatches)
+            return;
+    }
+#else
+#if ADAPTER_KERNEL_WIDTH >= 32
+    while (remaining >= 32)
+    {
+        compareAdapter<32, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        remaining -= 32;
+        if (overlap - remaining - matches > maxMismatches)
+            return;
+    }
+    if (remaining >= 16)
+#else
+    while (remaining >= 16)
+#endif
+    {
+        compareAdapter<16, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        remaining -= 16;
+        if (overlap - remaining - matches > maxMismatches)
+            return;
+    }
+    if (remaining >= 8)
+    {
+        compareAdapter<8, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        remaining -= 8;
+    }
+    switch (remaining)
+    {
+    case 0:
+        break;
+    case 1:
+        compareAdapter<1, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    case 2:
+        compareAdapter<2, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    case 3:
+        compareAdapter<3, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    case 4:
+        compareAdapter<4, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    case 5:
+        compareAdapter<5, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    case 6:
+        compareAdapter<6, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    case 7:
+        compareAdapter<7, TEncoding>::apply(readIterator, adapterIterator, matches, ambiguous);
+        break;
+    }
+#endif
+}
+
+/*
+- Menkuec alignment of read and adapter in the same encoding, see alignPair()
+- read and adapter are passed as bytes, so that the kernel does not depend on the sequence type
+*/
+template <typename TEncoding, typename TAlignResult>
+void alignPairKernel(TAlignResult& ret, const unsigned char* readBeginIterator, const unsigned int lenRead,
+    const unsigned char* adapterBeginIterator, const unsigned int lenAdapter,
+    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::Menkuec&) noexcept
+{
+    const int shiftStartPos = -leftOverhang;
+    const int shiftEndPos = lenRead - lenAdapter + rightOverhang;
+    int shiftPos = shiftStartPos;
+
+    ret = TAlignResult();
+    const unsigned char* readIterator = readBeginIterator;
+    const unsigned char* adapterIterator = adapterBeginIterator;
+
+    while (shiftPos <= shiftEndPos)
+    {
+        const unsigned int overlapNegativeShift = std::min<unsigned int>(shiftPos + lenAdapter, lenRead);
+        const unsigned int overlapPositiveShift = std::min<unsigned int>(lenRead - shiftPos, lenAdapter);
+        const unsigned int overlap = std::min<unsigned int>(overlapNegativeShift, overlapPositiveShift);
+        const unsigned int overlapStart = std::max<int>(shiftPos, 0);
+        unsigned int matches = 0;
+        unsigned int ambiguous = 0;
+        readIterator = readBeginIterator + overlapStart;
+        adapterIterator = adapterBeginIterator + std::min(0, shiftPos)*(-1);
+        compareOverlap<TEncoding>(readIterator, adapterIterator, overlap, matches, ambiguous, std::numeric_limits<unsigned int>::max());
+        const float errorRate = static_cast<float>(overlap - matches - ambiguous) / static_cast<float>(overlap);
+        if (errorRate < ret.errorRate || (errorRate == ret.errorRate && overlap > ret.overlap))
+        {
+            ret.matches = matches;
+            ret.ambiguous = ambiguous;
+            ret.errorRate = errorRate;
+            ret.shiftPos = shiftPos;
+            ret.overlap = overlap;
+        }
+        ++shiftPos;
+    }
+    if (ret.matches != 0)
+    {
+        ret.mismatches = ret.overlap - ret.matches - ret.ambiguous;
+        ret.score = 2 * ret.matches - ret.overlap + ret.ambiguous;
+    }
+}
+
+/*
+- AlignAlgorithm::MenkuecBounded, see alignPair()
+- shifts are visited in order of decreasing overlap, equal overlaps at the 3' end first, so the search can stop
+  as soon as the remaining overlaps can neither beat the best error rate nor pass isMatch
+- error rates are compared as fractions, equal error rates and overlaps are resolved by the lower shift position like in the sweep
+- only valid if neither read nor adapter contain N, an N counts as match and as ambiguous and could lower the error rate below 0
+*/
+template <typename TEncoding, typename TAlignResult, typename TIsMatch>
+void alignPairKernel(TAlignResult& ret, const unsigned char* readBeginIterator, const unsigned int lenRead,
+    const unsigned char* adapterBeginIterator, const unsigned int lenAdapter,
+    const int leftOverhang, const int rightOverhang, const TIsMatch& isMatch, const AlignAlgorithm::MenkuecBounded&) noexcept
+{
+    ret = TAlignResult();
+    if (lenRead == 0 || lenAdapter == 0)
+        return;
+    bool found = false;
+    unsigned int bestMismatches = 0;
+    unsigned int bestOverlap = 0;
+    int bestShiftPos = 0;
+    bool bestIsMatch = false;
+
+    // returns false if no shift with this or a smaller overlap can change the result
+    auto tryShift = [&](const int shiftPos, const unsigned int overlap) -> bool
+    {
+        if (found)
+        {
+            if (bestMismatches == 0 && overlap < bestOverlap)
+                return false;
+            if (!bestIsMatch && !isMatch(overlap, 0))
+                return false;
+            if (bestMismatches == 0 && (overlap < bestOverlap || (overlap == bestOverlap && shiftPos > bestShiftPos)))
+                return true;
+        }
+        // with more mismatches than this, the error rate is higher than the best one
+        const unsigned int maxMismatches = found ? (bestMismatches * overlap) / bestOverlap : overlap;
+        unsigned int matches = 0;
+        unsigned int ambiguous = 0;
+        compareOverlap<TEncoding>(readBeginIterator + std::max(shiftPos, 0), adapterBeginIterator + std::max(-shiftPos, 0), overlap,
+            matches, ambiguous, maxMismatches);
+        const unsigned int mismatches = overlap - matches;
+        if (mismatches > maxMismatches)
+            return true;
+        const unsigned long long lhs = static_cast<unsigned long long>(mismatches) * bestOverlap;
+        const unsigned long long rhs = static_cast<unsigned long long>(bestMismatches) * overlap;
+        if (!found || lhs < rhs || (lhs == rhs && (overlap > bestOverlap || (overlap == bestOverlap && shiftPos < bestShiftPos))))
+        {
+            found = true;
+            bestMismatches = mismatches;
+            bestOverlap = overlap;
+            bestShiftPos = shiftPos;
+            bestIsMatch = isMatch(overlap, mismatches);
+            ret.matches = matches;
+            ret.ambiguous = ambiguous;
+            ret.shiftPos = shiftPos;
+            ret.overlap = overlap;
+        }
+        return true;
+    };
+
+    visitShiftsByOverlap(lenRead, lenAdapter, -leftOverhang, lenRead - lenAdapter + rightOverhang, tryShift);
+
+    if (found)
+    {
+        ret.errorRate = static_cast<float>(ret.overlap - ret.matches - ret.ambiguous) / static_cast<float>(ret.overlap);
+        if (ret.matches != 0)
+        {
+            ret.mismatches = ret.overlap - ret.matches - ret.ambiguous;
+            ret.score = 2 * ret.matches - ret.overlap + ret.ambiguous;
+        }
+    }
+}
+
+/*
+- AlignAlgorithm::MateOverlap, see alignPair()
+- the score is matches - mismatches, N scores 0, shifts are visited in order of decreasing overlap,
+  so the search stops once the overlap is not larger than the best score
+*/
+template <typename TEncoding, typename TAlignResult>
+void alignPairKernel(TAlignResult& ret, const unsigned char* readBeginIterator, const unsigned int lenRead,
+    const unsigned char* mateBeginIterator, const unsigned int lenMate, const AlignAlgorithm::MateOverlap&) noexcept
+{
+    ret = TAlignResult();
+    if (lenRead == 0 || lenMate == 0)
+        return;
+    bool found = false;
+    int bestScore = 0;
+
+    auto tryShift = [&](const int shiftPos, const unsigned int overlap) -> bool
+    {
+        if (found && static_cast<int>(overlap) <= bestScore)
+            return false;
+        // with more mismatches than this, the score is not higher than the best one
+        const unsigned int maxMismatches = found ? (static_cast<int>(overlap) - bestScore - 1) / 2 : overlap;
+        unsigned int matches = 0;
+        unsigned int ambiguous = 0;
+        compareOverlap<TEncoding>(readBeginIterator + std::max(shiftPos, 0), mateBeginIterator + std::max(-shiftPos, 0), overlap,
+            matches, ambiguous, maxMismatches);
+        const unsigned int mismatches = overlap - matches;
+        if (mismatches > maxMismatches)
+            return true;
+        const int score = static_cast<int>(matches - ambiguous) - static_cast<int>(mismatches);
+        if (!found || score > bestScore)
+        {
+            found = true;
+            bestScore = score;
+            ret.matches = matches;
+            ret.ambiguous = ambiguous;
+            ret.shiftPos = shiftPos;
+            ret.overlap = overlap;
+        }
+        return true;
+    };
+
+    visitShiftsByOverlap(lenRead, lenMate, 1 - static_cast<int>(lenMate), lenRead - 1, tryShift);
+
+    ret.mismatches = ret.overlap - ret.matches;
+    ret.score = bestScore;
+    ret.errorRate = static_cast<float>(ret.mismatches) / static_cast<float>(ret.overlap);
+}
+
+// number of reads that AlignAlgorithm::MenkuecBatch compares at once, one read per byte lane
+const unsigned int BATCH_SIZE = ADAPTER_KERNEL_WIDTH;
+
+/*
+- counts the matches and ambiguous bases of all reads of a batch at one shift position, see alignPair()
+- row k of reads holds base k of all reads, every row is compared with the same adapter base
+- the counters are 8 bit, which is enough because an adapter has at most 255 bases
+*/
+template <typename TEncoding>
+inline void compareBatch(const unsigned char* rowIterator, const unsigned char* adapterIterator, const unsigned int overlap,
+    unsigned char* matchesLanes, unsigned char* ambiguousLanes) noexcept
+{
+#if ADAPTER_KERNEL_WIDTH >= 64
+    __m512i matches = _mm512_setzero_si512();
+    __m512i ambiguous = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi8(1);
+    for (unsigned int i = 0; i < overlap; ++i, rowIterator += BATCH_SIZE, ++adapterIterator)
+    {
+        const __m512i read = _mm512_loadu_si512(rowIterator);
+        const __mmask64 NMask = EncodingOps<TEncoding>::isN(*adapterIterator) ? ~__mmask64(0) : _mm512_cmpeq_epi8_mask(read, EncodingOps<TEncoding>::n512());
+        const __mmask64 matchesMask = NMask | _mm512_cmpeq_epi8_mask(EncodingOps<TEncoding>::base(read),
+            EncodingOps<TEncoding>::base(_mm512_set1_epi8(static_cast<char>(*adapterIterator))));
+        ambiguous = _mm512_mask_add_epi8(ambiguous, NMask, ambiguous, one);
+        matches = _mm512_mask_add_epi8(matches, matchesMask, matches, one);
+    }
+    _mm512_store_si512(matchesLanes, matches);
+    _mm512_store_si512(ambiguousLanes, ambiguous);
+#elif ADAPTER_KERNEL_WIDTH >= 32
+    __m256i matches = _mm256_setzero_si256();
+    __m256i ambiguous = _mm256_setzero_si256();
+    for (unsigned int i = 0; i < overlap; ++i, rowIterator += BATCH_SIZE, ++adapterIterator)
+    {
+        const __m256i read = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowIterator));
+        const __m256i NMask = EncodingOps<TEncoding>::isN(*adapterIterator) ? _mm256_set1_epi8(-1) : _mm256_cmpeq_epi8(read, EncodingOps<TEncoding>::n256());
+        const __m256i matchesMask = _mm256_or_si256(NMask, _mm256_cmpeq_epi8(EncodingOps<TEncoding>::base(read),
+            EncodingOps<TEncoding>::base(_mm256_set1_epi8(static_cast<char>(*adapterIterator)))));
+        // the masks are -1 in every lane that counts
+        ambiguous = _mm256_sub_epi8(ambiguous, NMask);
+        matches = _mm256_sub_epi8(matches, matchesMask);
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i*>(matchesLanes), matches);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ambiguousLanes), ambiguous);
+#else
+    __m128i matches = _mm_setzero_si128();
+    __m128i ambiguous = _mm_setzero_si128();
+    for (unsigned int i = 0; i < overlap; ++i, rowIterator += BATCH_SIZE, ++adapterIterator)
+    {
+        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowIterator));
+        const __m128i NMask = EncodingOps<TEncoding>::isN(*adapterIterator) ? _mm_set1_epi8(-1) : _mm_cmpeq_epi8(read, EncodingOps<TEncoding>::n128());
+        const __m128i matchesMask = _mm_or_si128(NMask, _mm_cmpeq_epi8(EncodingOps<TEncoding>::base(read),
+            EncodingOps<TEncoding>::base(_mm_set1_epi8(static_cast<char>(*adapterIterator)))));
+        // the masks are -1 in every lane that counts
+        ambiguous = _mm_sub_epi8(ambiguous, NMask);
+        matches = _mm_sub_epi8(matches, matchesMask);
+    }
+    _mm_store_si128(reinterpret_cast<__m128i*>(matchesLanes), matches);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ambiguousLanes), ambiguous);
+#endif
+}
+
+/*
+- AlignAlgorithm::MenkuecBatch, see alignPair()
+- the Menkuec alignment of numReads reads of length lenRead, which are stored transposed in reads (BATCH_SIZE bytes per base)
+- every shift position is compared for all reads at once, the best alignment of each read is selected like in the sweep
+- error rates are compared as fractions, for overlaps below 256 this orders them like the float error rates of the sweep
+*/
+template <typename TEncoding, typename TAlignResult>
+void alignPairKernel(TAlignResult* ret, const unsigned int numReads, const unsigned char* reads, const unsigned int lenRead,
+    const unsigned char* adapterBeginIterator, const unsigned int lenAdapter,
+    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::MenkuecBatch&) noexcept
+{
+    const int shiftStartPos = -leftOverhang;
+    const int shiftEndPos = lenRead - lenAdapter + rightOverhang;
+    alignas(64) unsigned char matchesLanes[BATCH_SIZE];
+    alignas(64) unsigned char ambiguousLanes[BATCH_SIZE];
+    // error rate of the best alignment as fraction, 1/1 before the first one like the initial error rate of the sweep
+    unsigned int bestMismatches[BATCH_SIZE];
+    unsigned int bestOverlap[BATCH_SIZE];
+
+    for (unsigned int r = 0; r < numReads; ++r)
+    {
+        ret[r] = TAlignResult();
+        bestMismatches[r] = 1;
+        bestOverlap[r] = 1;
+    }
+    for (int shiftPos = shiftStartPos; shiftPos <= shiftEndPos; ++shiftPos)
+    {
+        const unsigned int overlapNegativeShift = std::min<unsigned int>(shiftPos + lenAdapter, lenRead);
+        const unsigned int overlapPositiveShift = std::min<unsigned int>(lenRead - shiftPos, lenAdapter);
+        const unsigned int overlap = std::min<unsigned int>(overlapNegativeShift, overlapPositiveShift);
+        // the sweep never selects an empty overlap, its error rate is NaN
+        if (overlap == 0)
+            continue;
+        compareBatch<TEncoding>(reads + std::max(shiftPos, 0) * BATCH_SIZE, adapterBeginIterator + std::max(-shiftPos, 0), overlap,
+            matchesLanes, ambiguousLanes);
+        for (unsigned int r = 0; r < numReads; ++r)
+        {
+            // wraps around like in the sweep if N bases make matches + ambiguous larger than the overlap, such a shift is never selected
+            const unsigned int mismatches = overlap - matchesLanes[r] - ambiguousLanes[r];
+            const unsigned long long lhs = static_cast<unsigned long long>(mismatches) * bestOverlap[r];
+            const unsigned long long rhs = static_cast<unsigned long long>(bestMismatches[r]) * overlap;
+            if (lhs < rhs || (lhs == rhs && overlap > ret[r].overlap))
+            {
+                bestMismatches[r] = mismatches;
+                bestOverlap[r] = overlap;
+                ret[r].matches = matchesLanes[r];
+                ret[r].ambiguous = ambiguousLanes[r];
+                ret[r].shiftPos = shiftPos;
+                ret[r].overlap = overlap;
+            }
+        }
+    }
+    for (unsigned int r = 0; r < numReads; ++r)
+    {
+        if (ret[r].overlap != 0)
+            ret[r].errorRate = static_cast<float>(ret[r].overlap - ret[r].matches - ret[r].ambiguous) / static_cast<float>(ret[r].overlap);
+        if (ret[r].matches != 0)
+        {
+            ret[r].mismatches = ret[r].overlap - ret[r].matches - ret[r].ambiguous;
+            ret[r].score = 2 * ret[r].matches - ret[r].overlap + ret[r].ambiguous;
+        }
+    }
+}
+
+/*
+- compares up to 16 bases of read and adapter, both in Dna5Q bytes
+- N only counts as ambiguous, the error weights of mismatching bases are added to weightSum
+*/
+inline void compareAdapterQ(const unsigned char* readIterator, const unsigned char* adapterIterator, const uint16_t* weightIterator,
+    const unsigned int numBases, unsigned int& matches, unsigned int& ambiguous, __m128i& weightSum) noexcept
+{
+    const __m128i validMask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(TAIL_MASK + 16 - numBases));
+    const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(readIterator));
+    const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(adapterIterator));
+
+    const __m128i NMask = _mm_and_si128(validMask, _mm_or_si128(_mm_cmpeq_epi8(read, EncodingOps<Dna5QEncoding>::n128()), _mm_cmpeq_epi8(adapter, EncodingOps<Dna5QEncoding>::n128())));
+    const __m128i equalMask = _mm_and_si128(validMask, _mm_cmpeq_epi8(EncodingOps<Dna5QEncoding>::base(read), EncodingOps<Dna5QEncoding>::base(adapter)));
+    const __m128i matchesMask = _mm_andnot_si128(NMask, equalMask);
+    const __m128i mismatchesMask = _mm_andnot_si128(_mm_or_si128(NMask, equalMask), validMask);
+
+    ambiguous += popcnt128(_mm_and_si128(NMask, ONE_128));
+    matches += popcnt128(_mm_and_si128(matchesMask, ONE_128));
+
+    // widen the byte mask to 16 bit, select the weights of the mismatches and add them pairwise into 32 bit lanes
+    const __m128i weightsLow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weightIterator));
+    const __m128i weightsHigh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weightIterator + 8));
+    weightSum = _mm_add_epi32(weightSum, _mm_madd_epi16(_mm_and_si128(weightsLow, _mm_unpacklo_epi8(mismatchesMask, mismatchesMask)), ONE_EPI16_128));
+    weightSum = _mm_add_epi32(weightSum, _mm_madd_epi16(_mm_and_si128(weightsHigh, _mm_unpackhi_epi8(mismatchesMask, mismatchesMask)), ONE_EPI16_128));
+}
+
+// MenkuecQ alignment of a read in Dna5Q bytes, see alignPair()
+template <typename TAlignResult>
+void alignPairKernel(TAlignResult& ret, const unsigned char* readBeginIterator, const unsigned int lenRead, const uint16_t* weightBeginIterator,
+    const unsigned char* adapterBeginIterator, const unsigned int lenAdapter,
+    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::MenkuecQ&) noexcept
+{
+    const int shiftStartPos = -leftOverhang;
+    const int shiftEndPos = lenRead - lenAdapter + rightOverhang;
+    int shiftPos = shiftStartPos;
+
+    ret = TAlignResult();
+
+    while (shiftPos <= shiftEndPos)
+    {
+        const unsigned int overlapNegativeShift = std::min<unsigned int>(shiftPos + lenAdapter, lenRead);
+        const unsigned int overlapPositiveShift = std::min<unsigned int>(lenRead - shiftPos, lenAdapter);
+        const unsigned int overlap = std::min<unsigned int>(overlapNegativeShift, overlapPositiveShift);
+        const unsigned int overlapStart = std::max<int>(shiftPos, 0);
+        unsigned int matches = 0;
+        unsigned int ambiguous = 0;
+        unsigned int remaining = overlap;
+        __m128i weightSum = ZERO_128;
+        const unsigned char* readIterator = readBeginIterator + overlapStart;
+        const uint16_t* weightIterator = weightBeginIterator + overlapStart;
+        const unsigned char* adapterIterator = adapterBeginIterator + std::min(0, shiftPos)*(-1);
+
+        while (remaining > 0)
+        {
+            const unsigned int numBases = std::min<unsigned int>(remaining, 16);
+            compareAdapterQ(readIterator, adapterIterator, weightIterator, numBases, matches, ambiguous, weightSum);
+            readIterator += 16;
+            adapterIterator += 16;
+            weightIterator += 16;
+            remaining -= numBases;
+        }
+        const unsigned int qExtra = _mm_extract_epi32(weightSum, 0) + _mm_extract_epi32(weightSum, 1) +
+            _mm_extract_epi32(weightSum, 2) + _mm_extract_epi32(weightSum, 3);
+        ambiguous += qExtra / QUALITY_WEIGHT_SCALE;
+        const float errorRate = static_cast<float>(overlap - matches - ambiguous) / static_cast<float>(overlap);
+        if (errorRate < ret.errorRate || (errorRate == ret.errorRate && overlap > ret.overlap))
+        {
+            ret.matches = matches;
+            ret.ambiguous = ambiguous;
+            ret.errorRate = errorRate;
+            ret.shiftPos = shiftPos;
+            ret.overlap = overlap;
+        }
+        ++shiftPos;
+    }
+    if (ret.matches != 0)
+    {
+        ret.mismatches = ret.overlap - ret.matches - ret.ambiguous;
+        ret.score = 2 * ret.matches - ret.overlap + ret.ambiguous;
+    }
+}
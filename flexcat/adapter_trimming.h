@@ -35,26 +35,15 @@
 
 #pragma once
 
+#include <numeric>
 #include <seqan/align.h>
 #include "helper_functions.h"
 #include "general_stats.h"
+#include "cpu_features.h"
+#include "myers.h"
 #include <xmmintrin.h>
 #include <nmmintrin.h>
-
-// ============================================================================
-// Metafunctions
-// ============================================================================
-
-
-//brief A metafunction which constructs a ModifiedString type for an Alphabet.
-template <class TValue>
-struct STRING_REVERSE_COMPLEMENT
-{
-    typedef seqan::ModifiedString<
-        seqan::ModifiedString<	seqan::String<TValue>, seqan::ModView<seqan::FunctorComplement<TValue> > >,
-        seqan::ModReverse>	Type;
-};
-
+#include <immintrin.h>
 
 // ============================================================================
 // Tags, Classes, Enums
@@ -100,15 +89,61 @@ auto initQualityErrorProbabilities()
 
 static const std::array<float,41> qualityErrorProbabilies = initQualityErrorProbabilities();
 
+// error probabilities scaled to integers, so that they can be summed up in SSE registers
+const unsigned int QUALITY_WEIGHT_SCALE = 1 << 14;
+
+auto initQualityErrorWeights()
+{
+    std::array<uint16_t, 64> weights;
+    for (unsigned int i = 0; i < weights.size(); ++i)
+    {
+        const float probability = qualityErrorProbabilies[std::min<size_t>(i, qualityErrorProbabilies.size() - 1)];
+        weights[i] = static_cast<uint16_t>(std::lround(probability * QUALITY_WEIGHT_SCALE));
+    }
+    return weights;
+}
+
+static const std::array<uint16_t, 64> qualityErrorWeights = initQualityErrorWeights();
+
 struct AdapterItem;
 typedef std::vector< AdapterItem > AdapterSet;
 
-std::string ReverseComplement(std::string str)
+// reverse complement of an adapter, all unknown characters become N
+inline std::string ReverseComplement(std::string str)
 {
-    // TODO implement function
+    std::reverse(str.begin(), str.end());
+    for (auto& c : str)
+    {
+        switch (c)
+        {
+        case 'A': case 'a':
+            c = 'T';
+            break;
+        case 'C': case 'c':
+            c = 'G';
+            break;
+        case 'G': case 'g':
+            c = 'C';
+            break;
+        case 'T': case 't':
+            c = 'A';
+            break;
+        default:
+            c = 'N';
+        }
+    }
     return str;
 }
 
+// converts the adapter into seqan::Dna5Q bytes with quality 0, all unknown characters become N
+inline std::string encodeAdapter(const TAdapterSequence& adapter)
+{
+    std::string encoded(adapter.size(), 0);
+    for (size_t n = 0; n < adapter.size(); ++n)
+        encoded[n] = static_cast<char>(seqan::Dna5Q(adapter[n]).value);
+    return encoded;
+}
+
 struct AdapterItem
 {
     enum AdapterEnd
@@ -123,31 +158,37 @@ struct AdapterItem
     bool reverse;
 
     AdapterItem() : adapterEnd(end3), overhang(0), id(0), anchored(false), reverse(false), len(0) {};
-    AdapterItem(const TAdapterSequence &adapter) : adapterEnd(end3), overhang(0), id(0), anchored(false), reverse(false), seq(adapter), len(length(adapter)) {};
+    AdapterItem(const TAdapterSequence &adapter) : adapterEnd(end3), overhang(0), id(0), anchored(false), reverse(false), seq(adapter), encodedSeq(encodeAdapter(adapter)), len(length(adapter)) {};
     AdapterItem(const TAdapterSequence &adapter, const AdapterEnd adapterEnd, const unsigned overhang, const unsigned id, const bool anchored, const bool reverse)
-        : adapterEnd(adapterEnd), overhang(overhang), id(id), anchored(anchored), reverse(reverse), seq(adapter), len(length(adapter)) {};
+        : adapterEnd(adapterEnd), overhang(overhang), id(id), anchored(anchored), reverse(reverse), seq(adapter), encodedSeq(encodeAdapter(adapter)), len(length(adapter)) {};
 
-    void setSeq(TAdapterSequence newSeq) noexcept
+    void setSeq(TAdapterSequence newSeq)
     { 
         seq = newSeq; 
+        encodedSeq = encodeAdapter(seq);
         len = length(seq); 
     };
     const TAdapterSequence& getSeq() const noexcept
     {
         return seq;
     };
+    // adapter in the byte representation of seqan::Dna5Q, can be compared directly to the bytes of a Dna5QString
+    const std::string& getEncodedSeq() const noexcept
+    {
+        return encodedSeq;
+    };
     unsigned char getLen() const noexcept
     {
         return len;
     };
     
-    AdapterItem getReverseComplement() const noexcept
+    AdapterItem getReverseComplement() const
     {
-        auto seqCopy = seq;
-        return AdapterItem(ReverseComplement(seqCopy), adapterEnd, overhang, id, anchored, reverse);
+        return AdapterItem(ReverseComplement(seq), adapterEnd, overhang, id, anchored, reverse);
     }
 private:
     TAdapterSequence seq;
+    std::string encodedSeq;
     unsigned char len;
 };
 
@@ -168,16 +209,117 @@ struct AdapterMatchSettings
 };
 
 
+/*
+- k-mer index over all adapters, built once after the adapters are loaded
+- rejects adapters for which no shift position can pass isMatch, before alignPair() runs
+- an ungapped overlap of o bases with at most e mismatches shares at least o - k + 1 - e * k k-mers
+  with the read on its diagonal (q-gram lemma), one scan over the read k-mers counts the hits of all diagonals
+- shift positions for which this bound is not positive are compared base by base
+- adapters that contain N are never rejected, reads that contain N are not filtered
+- the adapters that are not rejected are aligned over all shift positions as before, so the trimming result does not change
+*/
+class AdapterIndex
+{
+public:
+    // k-mer hits of the current read for each adapter and diagonal
+    struct ReadHits
+    {
+        ReadHits() : lenRead(0), stride(0), filtered(false) {};
+        std::vector<uint16_t> counts;
+        std::vector<unsigned int> touched;
+        unsigned int lenRead;
+        unsigned int stride;
+        bool filtered;
+    };
+
+private:
+    struct Entry
+    {
+        uint16_t adapter;
+        unsigned char pos;
+    };
+    static const unsigned int minK = 4;
+    static const unsigned int maxK = 8;
+
+    unsigned int _k;    // 0 if the index is disabled
+    unsigned int _maxLenAdapter;
+    std::vector<unsigned int> _bucketBegin;     // entries of k-mer code c are [_bucketBegin[c], _bucketBegin[c + 1])
+    std::vector<Entry> _entries;
+    std::vector<bool> _indexed;
+    std::array<int, 256> _allowedMismatches;    // -1 if an overlap can not match
+
+    int minHits(const unsigned int overlap) const noexcept
+    {
+        return static_cast<int>(overlap) - static_cast<int>(_k) + 1 - _allowedMismatches[overlap] * static_cast<int>(_k);
+    }
+
+public:
+    AdapterIndex() : _k(0), _maxLenAdapter(0) {};
+
+    bool enabled() const noexcept
+    {
+        return _k != 0;
+    }
+    unsigned int getK() const noexcept
+    {
+        return _k;
+    }
+
+    template <typename TErrorRateMode>
+    void build(const AdapterSet& adapters, const AdapterMatchSettings& mode, const TErrorRateMode&);
+
+    template <typename TSeq>
+    void scan(ReadHits& hits, const TSeq& read) const;
+
+    template <typename TSeq>
+    bool mayMatch(const ReadHits& hits, const TSeq& read, const unsigned int adapterNumber, const AdapterItem& adapterItem,
+        const int leftOverhang, const int rightOverhang) const noexcept;
+};
+
+enum adapterDirection : bool
+{
+    reverse,
+    forward
+};
+
+/*
+- numbers of the adapters that stripAdapter() searches in each direction, built once after the adapters are loaded
+- adapters marked reverse are searched in the reverse read only, all others in the forward read only
+- the adapters keep the orientation of the adapter file, which already is the one of the read they are searched in
+*/
+class OrientedAdapters
+{
+    std::array<std::vector<unsigned int>, 2> _adapterNumbers;     // indexed by adapterDirection
+
+public:
+    void build(const AdapterSet& adapters)
+    {
+        for (auto& adapterNumbers : _adapterNumbers)
+            adapterNumbers.clear();
+        for (unsigned int adapterNumber = 0; adapterNumber < adapters.size(); ++adapterNumber)
+            _adapterNumbers[adapters[adapterNumber].reverse ? adapterDirection::reverse : adapterDirection::forward].push_back(adapterNumber);
+    }
+
+    const std::vector<unsigned int>& get(const bool direction) const noexcept
+    {
+        return _adapterNumbers[direction];
+    }
+};
+
 struct AdapterTrimmingParams
 {
     bool pairedNoAdapterFile;
     bool run;
     AdapterSet adapters;
+    OrientedAdapters orientedAdapters;
     AdapterMatchSettings mode;
     bool tag;
     bool best;
     bool nler;
-    AdapterTrimmingParams() : pairedNoAdapterFile(false), run(false), tag(false), best(false) {};
+    bool gapped;
+    bool batch;
+    AdapterIndex adapterIndex;
+    AdapterTrimmingParams() : pairedNoAdapterFile(false), run(false), tag(false), best(false), nler(false), gapped(false), batch(false) {};
 };
 
 // ============================================================================
@@ -205,7 +347,7 @@ struct AlignResult
 {
     static const typename std::make_signed<_TReadLen>::type noMatch = std::numeric_limits<typename std::make_signed<_TReadLen>::type>::min();
 
-    AlignResult() : shiftPos(0), score(std::numeric_limits<typename std::make_signed<_TReadLen>::type>::min()), matches(0), ambiguous(0), overlap(0), errorRate(1) {};
+    AlignResult() : shiftPos(0), score(std::numeric_limits<typename std::make_signed<_TReadLen>::type>::min()), matches(0), mismatches(0), ambiguous(0), overlap(0), errorRate(1), indels(0) {};
     typename std::make_signed<_TReadLen>::type shiftPos;
     typename std::make_signed<_TReadLen>::type score;
     typename std::make_unsigned<_TReadLen>::type matches;
@@ -213,6 +355,7 @@ struct AlignResult
     typename std::make_unsigned<_TReadLen>::type ambiguous;
     typename std::make_unsigned<_TReadLen>::type overlap;
     float errorRate;
+    typename std::make_signed<_TReadLen>::type indels;     // aligned read bases - aligned adapter bases, only gapped alignments set it
 };
 
 template <typename TAlign>
@@ -237,6 +380,11 @@ namespace AlignAlgorithm
 {
     struct NeedlemanWunsch {};
     struct Menkuec {};
+    struct MenkuecQ {};     // Menkuec with mismatches weighted by the base quality
+    struct MenkuecBounded {};   // Menkuec that skips the shifts which can not change the trimming result
+    struct MenkuecBatch {}; // Menkuec for a batch of reads of equal length, one read per SIMD byte lane
+    struct Myers {};        // gapped, bit-parallel edit distance
+    struct MateOverlap {};  // ungapped overlap of a read with the reverse complement of its mate, for stripPair()
 }
 
 
@@ -283,441 +431,523 @@ const __m128i ZERO_128 = _mm_set1_epi8(0);
 //const __m128i N_128 = _mm_set1_epi8(0x04);
 const __m128i N_128 = _mm_set1_epi8('N');
 
-#ifdef __AVX2__
-const __m256i ONE_256 = _mm256_set1_epi8(1);
-const __m256i N_256 = _mm256_set1_epi8('N');
-const __m256i ZERO_256 = _mm256_set1_epi8(0);
-#endif
+// raw seqan::Dna5Q bytes, see DNA5Q_N
+const __m128i DNA5Q_BASE_MASK_128 = _mm_set1_epi8(0x03);
+const __m128i DNA5Q_N_128 = _mm_set1_epi8(static_cast<char>(DNA5Q_N));
+
+// the first n bytes of TAIL_MASK + 16 - n are set
+alignas(16) static const unsigned char TAIL_MASK[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+const __m128i ONE_EPI16_128 = _mm_set1_epi16(1);
+
+/*
+- byte encodings the compareAdapter kernels can work on
+- read and adapter have to use the same encoding
+- AsciiEncoding compares characters of std::string
+- Dna5QEncoding compares the packed bytes of seqan::Dna5QString directly, the quality bits are masked out
+*/
+struct AsciiEncoding {};
+struct Dna5QEncoding {};
+
+template <typename TSeq>
+struct AdapterEncoding;
+
+template <>
+struct AdapterEncoding<std::string>
+{
+    using Type = AsciiEncoding;
+};
+
+template <>
+struct AdapterEncoding<seqan::Dna5QString>
+{
+    using Type = Dna5QEncoding;
+};
+
+inline const unsigned char* getBytes(const std::string& seq) noexcept
+{
+    return reinterpret_cast<const unsigned char*>(seq.data());
+}
+
+inline const unsigned char* getBytes(const seqan::Dna5QString& seq) noexcept
+{
+    return reinterpret_cast<const unsigned char*>(seqan::begin(seq, seqan::Standard()));
+}
+
+/*
+- calls visit(shiftPos, overlap) for the shifts from shiftStartPos to shiftEndPos in order of decreasing overlap
+- the shifts with full overlap are visited from right to left, then the shifts at the 3' and 5' end of the read are merged,
+  equal overlaps at the 3' end first
+- stops as soon as visit returns false
+*/
+template <typename TVisit>
+inline void visitShiftsByOverlap(const int lenRead, const int lenAdapter, const int shiftStartPos, const int shiftEndPos, TVisit&& visit)
+{
+    const int fullOverlapStart = std::max(shiftStartPos, std::min(0, lenRead - lenAdapter));
+    const int fullOverlapEnd = std::min(shiftEndPos, std::max(0, lenRead - lenAdapter));
+    const int fullOverlap = std::min(lenRead, lenAdapter);
+    for (int shiftPos = fullOverlapEnd; shiftPos >= fullOverlapStart; --shiftPos)
+        if (!visit(shiftPos, fullOverlap))
+            return;
+
+    int rightShiftPos = std::max(shiftStartPos, std::max(0, lenRead - lenAdapter) + 1);
+    int leftShiftPos = std::min(shiftEndPos, std::min(0, lenRead - lenAdapter) - 1);
+    while (true)
+    {
+        const int rightOverlap = rightShiftPos <= shiftEndPos ? lenRead - rightShiftPos : 0;
+        const int leftOverlap = leftShiftPos >= shiftStartPos ? leftShiftPos + lenAdapter : 0;
+        if (rightOverlap <= 0 && leftOverlap <= 0)
+            return;
+        if (rightOverlap >= leftOverlap ? !visit(rightShiftPos++, rightOverlap) : !visit(leftShiftPos--, leftOverlap))
+            return;
+    }
+}
 
 // vector access to SSE registers is a microsoft specialty
 #ifdef _MSC_VER
     #define VECTOR_ACCESS
 #endif
 
-inline size_t popcnt64(__m128i value) noexcept
+// the kernels are compiled for every instruction set, alignPair() selects one at runtime with getSimdLevel()
+namespace sse42
 {
-    //value = _mm_sad_epu8(ZERO_128, value);
-    //return _mm_extract_epi16(value, 0);
-#ifdef VECTOR_ACCESS
-    return _mm_popcnt_u64(value.m128i_u64[0]);
-#else
-    return _mm_popcnt_u64(_mm_extract_epi64(value,0));
-#endif
+#define ADAPTER_KERNEL_WIDTH 16
+#include "adapter_kernels.h"
+#undef ADAPTER_KERNEL_WIDTH
 }
 
-inline size_t popcnt128(__m128i value) noexcept
-{
-//    value = _mm_sad_epu8(ZERO_128, value);
-//    return _mm_extract_epi16(value, 0) + _mm_extract_epi16(value, 4);
-#ifdef VECTOR_ACCESS
-    return _mm_popcnt_u64(value.m128i_u64[0]) + _mm_popcnt_u64(value.m128i_u64[1]);
-#else
-    return _mm_popcnt_u64(_mm_extract_epi64(value, 0)) + _mm_popcnt_u64(_mm_extract_epi64(value, 1));
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,popcnt"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt")
 #endif
+namespace avx2
+{
+#define ADAPTER_KERNEL_WIDTH 32
+#include "adapter_kernels.h"
+#undef ADAPTER_KERNEL_WIDTH
 }
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
 
-inline size_t popcnt256(__m256i value) noexcept
-{
-#ifdef VECTOR_ACCESS
-    return _mm_popcnt_u64(value.m256i_u64[0]) +
-        _mm_popcnt_u64(value.m256i_u64[1]) +
-        _mm_popcnt_u64(value.m256i_u64[2]) +
-        _mm_popcnt_u64(value.m256i_u64[3]);
-#else
-    return _mm_popcnt_u64(_mm256_extract_epi64(value, 0)) +
-        _mm_popcnt_u64(_mm256_extract_epi64(value, 1)) +
-        _mm_popcnt_u64(_mm256_extract_epi64(value, 2)) +
-        _mm_popcnt_u64(_mm256_extract_epi64(value, 3));
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx512bw,avx2,popcnt"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx2,popcnt")
 #endif
+namespace avx512bw
+{
+#define ADAPTER_KERNEL_WIDTH 64
+#include "adapter_kernels.h"
+#undef ADAPTER_KERNEL_WIDTH
 }
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
 
-template <unsigned int N>
-struct compareAdapter
+/*
+- shifts adapterTemplate against sequence
+- calculate score for each shift position
+- +1 for same base, -1 for mismatch, +0 for N
+- return score of the shift position, where the errorRate was minimal
+- read and adapter have to be in the same encoding (see AdapterEncoding), for Dna5QString use AdapterItem::getEncodedSeq()
+*/
+template <typename TSeq, typename TAdapter, typename TAlignResult>
+void alignPair(TAlignResult& ret, const TSeq& read, const TAdapter& adapter,
+    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::Menkuec& alignAlgorithm) noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    const unsigned int lenRead = length(read);
+    const unsigned int lenAdapter = length(adapter);
+    switch (getSimdLevel())
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        // SSE2 code
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_8));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_8));
-        
-        // SSE4.2 code 
-        //ambiguous += _mm_popcnt_u32(_mm_extract_epi8(_mm_and_si128(NMask, ONE_128), 0));
-        //matches += _mm_popcnt_u32(_mm_extract_epi8(_mm_and_si128(matchesMask, ONE_128), 0));
-
-        ++adapterIterator;
-        ++readIterator;
-        compareAdapter<N-1>::apply(readIterator, adapterIterator, matches, ambiguous);
+    case SimdLevel::avx512bw:
+        avx512bw::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, alignAlgorithm);
+        break;
+    case SimdLevel::avx2:
+        avx2::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, alignAlgorithm);
+        break;
+    default:
+        sse42::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, alignAlgorithm);
+        break;
     }
-};
+}
 
-template <>
-struct compareAdapter<0>
+inline bool containsN(const unsigned char* bytes, const unsigned int len, const AsciiEncoding&) noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
-    {
-        (void)readIterator;
-        (void)adapterIterator;
-        (void)matches;
-        (void)ambiguous;
-    }
-};
+    return std::find(bytes, bytes + len, 'N') != bytes + len;
+}
 
-template <>
-struct compareAdapter<2>
+inline bool containsN(const unsigned char* bytes, const unsigned int len, const Dna5QEncoding&) noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
-    {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_16));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_16));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 2;
-        adapterIterator += 2;
-    }
-};
+    return std::find(bytes, bytes + len, DNA5Q_N) != bytes + len;
+}
 
-template <>
-struct compareAdapter<3>
+// complement of 16 bases, N and unknown characters become N
+inline __m128i complement128(const __m128i value, const AsciiEncoding&) noexcept
+{
+    // indexed by the low nibble of the character, upper and lower case share it
+    const __m128i complementTable = _mm_setr_epi8('N', 'T', 'N', 'G', 'A', 'N', 'N', 'C', 'N', 'N', 'N', 'N', 'N', 'N', 'N', 'N');
+    return _mm_shuffle_epi8(complementTable, _mm_and_si128(value, _mm_set1_epi8(0x0f)));
+}
+
+// complement of 16 bases, the quality bits are kept, N stays N
+inline __m128i complement128(const __m128i value, const Dna5QEncoding&) noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    return _mm_xor_si128(value, _mm_andnot_si128(_mm_cmpeq_epi8(value, DNA5Q_N_128), DNA5Q_BASE_MASK_128));
+}
+
+/*
+- reverse complement of len bytes, reversed and complemented 16 bases at a time in SSE registers
+- out is padded, so that the kernels can load full registers behind the last base
+*/
+template <typename TEncoding>
+inline void getReverseComplement(std::vector<unsigned char>& out, const unsigned char* bytes, const unsigned int len, const TEncoding&)
+{
+    const __m128i reverseIndex = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    out.resize(len + 64);
+    unsigned int pos = 0;
+    for (; pos + 16 <= len; pos += 16)
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_24));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_24));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 3;
-        adapterIterator += 3;
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + len - pos - 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&out[pos]), complement128(_mm_shuffle_epi8(value, reverseIndex), TEncoding()));
     }
-};
+    if (pos < len)
+    {
+        // the remaining bases are at the start of bytes, the last register also overwrites the padding
+        alignas(16) unsigned char tail[16] = {};
+        std::copy(bytes, bytes + len - pos, tail + 16 - (len - pos));
+        const __m128i value = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&out[pos]), complement128(_mm_shuffle_epi8(value, reverseIndex), TEncoding()));
+    }
+}
 
-template <>
-struct compareAdapter<4>
+/*
+- same as AlignAlgorithm::Menkuec, but stops the search once no remaining shift can change whether and where the adapter is trimmed
+- isMatch(overlap, mismatches) has to be the isMatch() of the caller, if the returned alignment does not pass it,
+  the fields can differ from the Menkuec result, otherwise they are identical
+- falls back to the full sweep if read or adapter contain N
+- not used by stripAdapter(), the per shift bookkeeping costs more than the skipped shifts save,
+  even for 1000 bp reads against 10 adapters
+*/
+template <typename TSeq, typename TAdapter, typename TAlignResult, typename TIsMatch>
+void alignPair(TAlignResult& ret, const TSeq& read, const TAdapter& adapter,
+    const int leftOverhang, const int rightOverhang, const TIsMatch& isMatch, const AlignAlgorithm::MenkuecBounded& alignAlgorithm) noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    const unsigned int lenRead = length(read);
+    const unsigned int lenAdapter = length(adapter);
+    if (containsN(getBytes(read), lenRead, TEncoding()) || containsN(getBytes(adapter), lenAdapter, TEncoding()))
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_32));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_32));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 4;
-        adapterIterator += 4;
+        alignPair(ret, read, adapter, leftOverhang, rightOverhang, AlignAlgorithm::Menkuec());
+        return;
     }
-};
+    switch (getSimdLevel())
+    {
+    case SimdLevel::avx512bw:
+        avx512bw::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, isMatch, alignAlgorithm);
+        break;
+    case SimdLevel::avx2:
+        avx2::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, isMatch, alignAlgorithm);
+        break;
+    default:
+        sse42::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, isMatch, alignAlgorithm);
+        break;
+    }
+}
 
-template <>
-struct compareAdapter<5>
+// number of reads that AlignAlgorithm::MenkuecBatch aligns at once on this CPU
+inline unsigned int getBatchSize() noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    switch (getSimdLevel())
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_40));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_40));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 5;
-        adapterIterator += 5;
+    case SimdLevel::avx512bw:
+        return avx512bw::BATCH_SIZE;
+    case SimdLevel::avx2:
+        return avx2::BATCH_SIZE;
+    default:
+        return sse42::BATCH_SIZE;
     }
-};
+}
 
-template <>
-struct compareAdapter<6>
+/*
+- up to getBatchSize() reads of equal length for AlignAlgorithm::MenkuecBatch
+- the reads are transposed, base k of read r is stored at k * getBatchSize() + r, unused lanes are 0
+*/
+class TransposedReadBatch
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    std::vector<unsigned char> _bytes;
+    unsigned int _batchSize;
+    unsigned int _lenRead;
+    unsigned int _numReads;
+
+public:
+    TransposedReadBatch() : _batchSize(0), _lenRead(0), _numReads(0) {};
+
+    void clear(const unsigned int lenRead)
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_48));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_48));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 6;
-        adapterIterator += 6;
+        _batchSize = getBatchSize();
+        _lenRead = lenRead;
+        _numReads = 0;
+        _bytes.assign(_batchSize * lenRead, 0);
     }
-};
 
-template <>
-struct compareAdapter<7>
-{
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    // read must have the length given to clear()
+    template <typename TSeq>
+    void add(const TSeq& read) noexcept
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_56));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_56));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 7;
-        adapterIterator += 7;
+        const unsigned char* bytes = ::getBytes(read);
+        for (unsigned int k = 0; k < _lenRead; ++k)
+            _bytes[k * _batchSize + _numReads] = bytes[k];
+        ++_numReads;
     }
-};
 
-template <>
-struct compareAdapter<8>
-{
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    const unsigned char* getBytes() const noexcept
+    {
+        return _bytes.data();
+    }
+    unsigned int getLenRead() const noexcept
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128), _mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt64(_mm_and_si128(NMask, ONE_128));
-        matches += popcnt64(_mm_and_si128(matchesMask, ONE_128));
-        //ambiguous += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(NMask, ONE_128),0));
-        //matches += _mm_popcnt_u64(_mm_extract_epi64(_mm_and_si128(matchesMask, ONE_128), 0));
-        readIterator += 8;
-        adapterIterator += 8;
+        return _lenRead;
+    }
+    unsigned int getNumReads() const noexcept
+    {
+        return _numReads;
+    }
+    bool full() const noexcept
+    {
+        return _numReads == _batchSize;
     }
 };
 
-template <>
-struct compareAdapter<16>
+/*
+- Menkuec alignment of every read of the batch, ret has to hold batch.getNumReads() results
+- the reads have to be in TEncoding, the same encoding as the adapter
+- the results are identical to AlignAlgorithm::Menkuec for each read
+*/
+template <typename TEncoding, typename TAdapter, typename TAlignResult>
+void alignPair(TAlignResult* ret, const TransposedReadBatch& batch, const TAdapter& adapter, const int leftOverhang, const int rightOverhang,
+    const TEncoding&, const AlignAlgorithm::MenkuecBatch& alignAlgorithm) noexcept
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    switch (getSimdLevel())
     {
-        const __m128i read = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*readIterator)));
-        const __m128i adapter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&(*adapterIterator)));
-
-        const __m128i NMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, N_128),_mm_cmpeq_epi8(adapter, N_128)));
-        const __m128i matchesMask = _mm_sub_epi8(ZERO_128, _mm_or_si128(_mm_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt128(_mm_and_si128(NMask, ONE_128));
-        matches += popcnt128(_mm_and_si128(matchesMask, ONE_128));
-        readIterator += 16;
-        adapterIterator += 16;
+    case SimdLevel::avx512bw:
+        avx512bw::alignPairKernel<TEncoding>(ret, batch.getNumReads(), batch.getBytes(), batch.getLenRead(), getBytes(adapter), length(adapter), leftOverhang, rightOverhang, alignAlgorithm);
+        break;
+    case SimdLevel::avx2:
+        avx2::alignPairKernel<TEncoding>(ret, batch.getNumReads(), batch.getBytes(), batch.getLenRead(), getBytes(adapter), length(adapter), leftOverhang, rightOverhang, alignAlgorithm);
+        break;
+    default:
+        sse42::alignPairKernel<TEncoding>(ret, batch.getNumReads(), batch.getBytes(), batch.getLenRead(), getBytes(adapter), length(adapter), leftOverhang, rightOverhang, alignAlgorithm);
+        break;
     }
-};
+}
 
-#ifdef __AVX2__
-template <>
-struct compareAdapter<32>
+/*
+- ungapped overlap of read with the reverse complement of mate, the best overlap has the highest score (matches - mismatches)
+- shiftPos is the position of the first base of the reverse complement relative to the read, the insert size is shiftPos + length(mate)
+- the reverse complement is written to mateReverseComplement
+*/
+template <typename TSeq, typename TAlignResult>
+void alignPair(TAlignResult& ret, const TSeq& read, const TSeq& mate, std::vector<unsigned char>& mateReverseComplement,
+    const AlignAlgorithm::MateOverlap& alignAlgorithm)
 {
-    template <typename TReadIterator, typename TAdapterIterator, typename TCounter>
-    inline static void apply(TReadIterator& readIterator, TAdapterIterator& adapterIterator, TCounter& matches, TCounter& ambiguous) noexcept
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    const unsigned int lenRead = length(read);
+    const unsigned int lenMate = length(mate);
+    getReverseComplement(mateReverseComplement, getBytes(mate), lenMate, TEncoding());
+    switch (getSimdLevel())
     {
-        const __m256i read = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&(*readIterator)));
-        const __m256i adapter = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&(*adapterIterator)));
-
-        const __m256i NMask = _mm256_sub_epi8(ZERO_256, _mm256_or_si256(_mm256_cmpeq_epi8(read, N_256), _mm256_cmpeq_epi8(adapter, N_256)));
-        const __m256i matchesMask = _mm256_sub_epi8(ZERO_256, _mm256_or_si256(_mm256_cmpeq_epi8(read, adapter), NMask));
-
-        ambiguous += popcnt256(_mm256_and_si256(NMask, ONE_256));
-        matches += popcnt256(_mm256_and_si256(matchesMask, ONE_256));
-        readIterator += 32;
-        adapterIterator += 32;
+    case SimdLevel::avx512bw:
+        avx512bw::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, mateReverseComplement.data(), lenMate, alignAlgorithm);
+        break;
+    case SimdLevel::avx2:
+        avx2::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, mateReverseComplement.data(), lenMate, alignAlgorithm);
+        break;
+    default:
+        sse42::alignPairKernel<TEncoding>(ret, getBytes(read), lenRead, mateReverseComplement.data(), lenMate, alignAlgorithm);
+        break;
     }
-};
-#endif
+}
+
+// weights of the read bases for AlignAlgorithm::MenkuecQ, padded with zeros so that the kernel can always load full registers
+inline void getQualityErrorWeights(std::vector<uint16_t>& weights, const seqan::Dna5QString& read)
+{
+    const auto len = length(read);
+    weights.assign(len + 16, 0);
+    for (size_t n = 0; n < len; ++n)
+        weights[n] = qualityErrorWeights[seqan::getQualityValue(read[n])];
+}
 
 /*
 - shifts adapterTemplate against sequence
 - calculate score for each shift position
 - +1 for same base, -1 for mismatch, +0 for N
+- the error probabilities of mismatching bases are summed up and counted as ambiguous
 - return score of the shift position, where the errorRate was minimal
+- weights have to come from getQualityErrorWeights(), adapter has to be AdapterItem::getEncodedSeq()
 */
-template <typename TSeq, typename TAdapter, typename TAlignResult>
-void alignPair(TAlignResult& ret, const TSeq& read, const TAdapter& adapter,
-    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::Menkuec&) noexcept
+template <typename TWeights, typename TAdapter, typename TAlignResult>
+void alignPair(TAlignResult& ret, const seqan::Dna5QString& read, const TWeights& weights, const TAdapter& adapter,
+    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::MenkuecQ& alignAlgorithm) noexcept
 {
-    const auto lenRead = length(read);
-    const auto lenAdapter = length(adapter);
-    const int shiftStartPos = -leftOverhang;
-    const int shiftEndPos = lenRead - lenAdapter + rightOverhang;
-    int shiftPos = shiftStartPos;
-
-    ret = TAlignResult();
-    const std::string::const_iterator readBeginIterator = read.begin();
-    const std::string::const_iterator adapterBeginIterator = adapter.begin();
-    std::string::const_iterator readIterator = readBeginIterator;
-    std::string::const_iterator adapterIterator = adapterBeginIterator;
-
-    while (shiftPos <= shiftEndPos)
+    const unsigned int lenRead = length(read);
+    const unsigned int lenAdapter = length(adapter);
+    switch (getSimdLevel())
     {
-        const unsigned int overlapNegativeShift = std::min<unsigned int>(shiftPos + lenAdapter, lenRead);
-        const unsigned int overlapPositiveShift = std::min<unsigned int>(lenRead - shiftPos, lenAdapter);
-        const unsigned int overlap = std::min<unsigned int>(overlapNegativeShift, overlapPositiveShift);
-        const unsigned int overlapStart = std::max<int>(shiftPos, 0);
-        unsigned int matches = 0;
-        unsigned int ambiguous = 0;
-        unsigned int remaining = overlap;
-        readIterator = readBeginIterator + overlapStart;
-        adapterIterator = adapterBeginIterator + std::min(0, shiftPos)*(-1);
-
-        while (remaining >= 32)
-        {
-            compareAdapter<32>::apply(readIterator, adapterIterator, matches, ambiguous);
-            remaining -= 32;
-        }
-        if (remaining >= 16)
-        {
-            compareAdapter<16>::apply(readIterator, adapterIterator, matches, ambiguous);
-            remaining -= 16;
-        }
-        if (remaining >= 8)
-        {
-            compareAdapter<8>::apply(readIterator, adapterIterator, matches, ambiguous);
-            remaining -= 8;
-        }
-        switch (remaining)
-        {
-        case 0:
-            break;
-        case 1:
-            compareAdapter<1>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        case 2:
-            compareAdapter<2>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        case 3:
-            compareAdapter<3>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        case 4:
-            compareAdapter<4>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        case 5:
-            compareAdapter<5>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        case 6:
-            compareAdapter<6>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        case 7:
-            compareAdapter<7>::apply(readIterator, adapterIterator, matches, ambiguous);
-            break;
-        }
-        const float errorRate = static_cast<float>(overlap - matches - ambiguous) / static_cast<float>(overlap);
-        if (errorRate < ret.errorRate || (errorRate == ret.errorRate && overlap > ret.overlap))
-        {
-            ret.matches = matches;
-            ret.ambiguous = ambiguous;
-            ret.errorRate = errorRate;
-            ret.shiftPos = shiftPos;
-            ret.overlap = overlap;
-        }
-        ++shiftPos;
+    case SimdLevel::avx512bw:
+        avx512bw::alignPairKernel(ret, getBytes(read), lenRead, weights.data(), getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, alignAlgorithm);
+        break;
+    case SimdLevel::avx2:
+        avx2::alignPairKernel(ret, getBytes(read), lenRead, weights.data(), getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, alignAlgorithm);
+        break;
+    default:
+        sse42::alignPairKernel(ret, getBytes(read), lenRead, weights.data(), getBytes(adapter), lenAdapter, leftOverhang, rightOverhang, alignAlgorithm);
+        break;
     }
-    if (ret.matches != 0)
+}
+
+
+// ordinal values for myers.h, 4 is N
+inline unsigned int getOrdValue(const unsigned char value, const AsciiEncoding&) noexcept
+{
+    switch (value & 0xdf)   // upper case
     {
-        ret.mismatches = ret.overlap - ret.matches - ret.ambiguous;
-        ret.score = 2 * ret.matches - ret.overlap + ret.ambiguous;
+    case 'A':
+        return 0;
+    case 'C':
+        return 1;
+    case 'G':
+        return 2;
+    case 'T':
+        return 3;
+    default:
+        return 4;
     }
 }
 
+inline unsigned int getOrdValue(const unsigned char value, const Dna5QEncoding&) noexcept
+{
+    return value == DNA5Q_N ? 4 : value & 0x03;
+}
+
 /*
-- shifts adapterTemplate against sequence
-- calculate score for each shift position
-- +1 for same base, -1 for mismatch, +0 for N
-- return score of the shift position, where the errorRate was minimal
+- gapped alternative to AlignAlgorithm::Menkuec, uses Myers' bit-vector edit distance (see myers.h)
+- mismatches, insertions and deletions cost 1 each and are reported as mismatches, N matches every base
+- the shift range and the selection of the alignment with minimal errorRate are the same as for the ungapped alignment
+- overlap is the number of aligned adapter bases, shiftPos the read position of the first adapter base
+- indels is the number of aligned read bases minus overlap, the adapter ends at shiftPos + lenAdapter + indels
+- one search over the read finds the full matches and the partial matches at the read end, partial matches at the read start
+  are found by a second search over the reversed read, the other end of the best alignment is found by a short search back from its end
+- read and adapter have to be in the same encoding (see AdapterEncoding), adapters longer than myers::maxLength never match
 */
-template <typename TSeq, typename TQual, typename TAdapter, typename TAlignResult>
-void alignPair(TAlignResult& ret, const TSeq& read, const TQual& qual, const TAdapter& adapter,
-    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::Menkuec&) noexcept
+template <typename TSeq, typename TAdapter, typename TAlignResult>
+void alignPair(TAlignResult& ret, const TSeq& read, const TAdapter& adapter,
+    const int leftOverhang, const int rightOverhang, const AlignAlgorithm::Myers&) noexcept
 {
-    const auto lenRead = length(read);
-    const auto lenAdapter = length(adapter);
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    const unsigned char* readBytes = getBytes(read);
+    const unsigned char* adapterBytes = getBytes(adapter);
+    const int lenRead = length(read);
+    const int lenAdapter = length(adapter);
     const int shiftStartPos = -leftOverhang;
     const int shiftEndPos = lenRead - lenAdapter + rightOverhang;
-    int shiftPos = shiftStartPos;
 
     ret = TAlignResult();
-    const std::string::const_iterator readBeginIterator = read.begin();
-    const std::string::const_iterator adapterBeginIterator = adapter.begin();
-    const std::string::const_iterator qualityBeginIterator = qual.begin();
-    std::string::const_iterator readIterator = readBeginIterator;
-    std::string::const_iterator adapterIterator = adapterBeginIterator;
-    std::string::const_iterator qualityIterator = qualityBeginIterator;
-
-    while (shiftPos <= shiftEndPos)
+    if (lenRead == 0 || lenAdapter == 0 || lenAdapter > static_cast<int>(myers::maxLength) || shiftEndPos < shiftStartPos)
+        return;
+
+    enum class Candidate { none, readStart, full, readEnd };
+    Candidate best = Candidate::none;
+    int bestOverlap = 0;
+    int bestDistance = 0;
+    int bestEnd = 0;        // last aligned read position of a full match
+    float bestErrorRate = 1;
+    auto select = [&](const Candidate candidate, const int overlap, const int distance, const int end)
     {
-        const unsigned int overlapNegativeShift = std::min<unsigned int>(shiftPos + lenAdapter, lenRead);
-        const unsigned int overlapPositiveShift = std::min<unsigned int>(lenRead - shiftPos, lenAdapter);
-        const unsigned int overlap = std::min<unsigned int>(overlapNegativeShift, overlapPositiveShift);
-        const unsigned int overlapStart = std::max<int>(shiftPos, 0);
-        unsigned int matches = 0;
-        unsigned int ambiguous = 0;
-        unsigned int remaining = overlap;
-        float qExtra = 0;
-        readIterator = readBeginIterator + overlapStart;
-        qualityIterator = qualityBeginIterator + overlapStart;
-        adapterIterator = adapterBeginIterator + std::min(0, shiftPos)*(-1);
-
-        while (remaining > 0)
-        {
-            if (*readIterator == 'N' || *adapterIterator == 'N')
-                ++ambiguous;
-            else if (*readIterator == *adapterIterator)
-                ++matches;
-            else
-                qExtra += qualityErrorProbabilies[*qualityIterator];
-            ++readIterator;
-            ++qualityIterator;
-            ++adapterIterator;
-            --remaining;
-        }
-        ambiguous += (unsigned char)qExtra;
-        const float errorRate = static_cast<float>(overlap - matches - ambiguous) / static_cast<float>(overlap);
-        if (errorRate < ret.errorRate || (errorRate == ret.errorRate && overlap > ret.overlap))
+        const float errorRate = static_cast<float>(distance) / static_cast<float>(overlap);
+        if (errorRate < bestErrorRate || (errorRate == bestErrorRate && overlap > bestOverlap))
         {
-            ret.matches = matches;
-            ret.ambiguous = ambiguous;
-            ret.errorRate = errorRate;
-            ret.shiftPos = shiftPos;
-            ret.overlap = overlap;
+            best = candidate;
+            bestOverlap = overlap;
+            bestDistance = distance;
+            bestEnd = end;
+            bestErrorRate = errorRate;
         }
-        ++shiftPos;
+    };
+
+    myers::Pattern pattern;
+    myers::State state;
+    std::array<int, myers::maxLength + 1> prefixScores;
+
+    // adapter suffixes that start before the read, an alignment of overlap bases never spans more than 2 * overlap read bases
+    const int minStartOverlap = std::max(1, lenAdapter + shiftStartPos);
+    const int maxStartOverlap = std::min(std::min(lenAdapter - 1, lenRead), lenAdapter + shiftEndPos);
+    if (minStartOverlap <= maxStartOverlap)
+    {
+        myers::buildPattern(pattern, lenAdapter, [&](const unsigned int i) {return getOrdValue(adapterBytes[lenAdapter - 1 - i], TEncoding()); });
+        myers::initState(state, pattern);
+        for (int j = std::min(lenRead, 2 * maxStartOverlap); j-- > 0;)
+            myers::advance(state, pattern, getOrdValue(readBytes[j], TEncoding()), false);
+        myers::getPrefixScores(prefixScores, state, pattern);
+        for (int overlap = maxStartOverlap; overlap >= minStartOverlap; --overlap)
+            select(Candidate::readStart, overlap, prefixScores[overlap], 0);
     }
-    if (ret.matches != 0)
+
+    // full matches ending at read position j, then adapter prefixes that end with the read
+    myers::buildPattern(pattern, lenAdapter, [&](const unsigned int i) {return getOrdValue(adapterBytes[i], TEncoding()); });
+    myers::initState(state, pattern);
+    for (int j = 0; j < lenRead; ++j)
+    {
+        myers::advance(state, pattern, getOrdValue(readBytes[j], TEncoding()), false);
+        const int shiftPos = j + 1 - lenAdapter;
+        if (shiftPos >= 0 && shiftPos >= shiftStartPos && shiftPos <= shiftEndPos)
+            select(Candidate::full, lenAdapter, state.score, j);
+    }
+    const int minEndOverlap = std::max(1, lenRead - shiftEndPos);
+    const int maxEndOverlap = std::min(std::min(lenAdapter - 1, lenRead), lenRead - shiftStartPos);
+    if (minEndOverlap <= maxEndOverlap)
+    {
+        myers::getPrefixScores(prefixScores, state, pattern);
+        for (int overlap = maxEndOverlap; overlap >= minEndOverlap; --overlap)
+            select(Candidate::readEnd, overlap, prefixScores[overlap], lenRead - 1);
+    }
+
+    if (best == Candidate::none)
+        return;
+
+    // the searches only know one end of the best alignment, search its other end
+    int alignedReadBases;
+    if (best == Candidate::readStart)
     {
-        ret.mismatches = ret.overlap - ret.matches - ret.ambiguous;
-        ret.score = 2 * ret.matches - ret.overlap + ret.ambiguous;
+        myers::buildPattern(pattern, bestOverlap, [&](const unsigned int i) {return getOrdValue(adapterBytes[lenAdapter - bestOverlap + i], TEncoding()); });
+        alignedReadBases = myers::findAlignedLength(pattern, std::min(lenRead, 2 * bestOverlap),
+            [&](const unsigned int k) {return getOrdValue(readBytes[k], TEncoding()); }, bestDistance);
+        ret.shiftPos = bestOverlap - lenAdapter;
     }
+    else
+    {
+        myers::buildPattern(pattern, bestOverlap, [&](const unsigned int i) {return getOrdValue(adapterBytes[bestOverlap - 1 - i], TEncoding()); });
+        alignedReadBases = myers::findAlignedLength(pattern, std::min(bestEnd + 1, 2 * bestOverlap),
+            [&](const unsigned int k) {return getOrdValue(readBytes[bestEnd - k], TEncoding()); }, bestDistance);
+        ret.shiftPos = bestEnd + 1 - alignedReadBases;
+    }
+    ret.indels = alignedReadBases - bestOverlap;
+    ret.overlap = bestOverlap;
+    ret.matches = bestOverlap - bestDistance;
+    ret.mismatches = bestDistance;
+    ret.ambiguous = 0;
+    ret.errorRate = bestErrorRate;
+    if (ret.matches != 0)
+        ret.score = 2 * ret.matches - ret.overlap;
 }
 
 
@@ -743,15 +973,12 @@ void alignPair(TAlignResult &res, const TSeq& seq1, const TAdapter& seq2, const
 }
 
 template <typename TSeq>
-unsigned stripPair(TSeq& seq1, TSeq& seq2) noexcept
+unsigned stripPair(TSeq& seq1, TSeq& seq2, std::vector<unsigned char>& mateReverseComplement)
 {
     // When aligning the two sequences, the complementary sequence is reversed and
     // complemented, so we have an overlap alignment with complementary bases being the same.
-    using TAlphabet = typename seqan::Value<TSeq>::Type;
-    using TReverseComplement = typename STRING_REVERSE_COMPLEMENT<TAlphabet>::Type;
-    TReverseComplement mod(seq2);
     AlignResult<unsigned int> ret;
-    alignPair(ret, seq1, mod, AlignAlgorithm::NeedlemanWunsch());
+    alignPair(ret, seq1, seq2, mateReverseComplement, AlignAlgorithm::MateOverlap());
     const auto& score = ret.score;
     // Use the overlap of the two sequences to determine the end position.
     const unsigned overlap = ret.overlap;
@@ -762,8 +989,8 @@ unsigned stripPair(TSeq& seq1, TSeq& seq2) noexcept
     {
         return 0;
     }
-    // Get actual size of the insert (possible to determine from overlap etc.).
-    const unsigned insert = length(seq1) + length(seq1) - overlap;   // TODO: check gaps in getInsertSize(align);
+    // The reverse complement of seq2 ends with the insert, reads longer than the insert continue into the adapter.
+    const unsigned insert = ret.shiftPos + length(seq2);
     // Now cut both sequences to insert size (no cuts happen if they are smaller)
     if (length(seq1) > insert)
     {
@@ -776,29 +1003,32 @@ unsigned stripPair(TSeq& seq1, TSeq& seq2) noexcept
     return insert;
 }
 
+// convenience wrapper
+template <typename TSeq>
+unsigned stripPair(TSeq& seq1, TSeq& seq2)
+{
+    std::vector<unsigned char> mateReverseComplement;
+    return stripPair(seq1, seq2, mateReverseComplement);
+}
+
 namespace ErrorRateMode
 {
     struct linear {};
     struct nonLinear {};
 }
 
-inline bool isMatch(const unsigned int overlap, const unsigned int mismatches, const AdapterMatchSettings &adatperMatchSettings,
+inline unsigned int getAllowedMismatches(const unsigned int overlap, const AdapterMatchSettings &adatperMatchSettings,
     const ErrorRateMode::linear&) noexcept
 {
-    if (overlap == 0)
-        return false;
     unsigned int allowedMismatches = static_cast<unsigned int>(adatperMatchSettings.errorRate * static_cast<float>(overlap));
     if (adatperMatchSettings.errorRate == 0)
         allowedMismatches = adatperMatchSettings.errors;
-
-    return overlap >= adatperMatchSettings.min_length && mismatches <= allowedMismatches;
+    return allowedMismatches;
 }
 
-inline bool isMatch(const unsigned int overlap, const unsigned int mismatches, const AdapterMatchSettings &adatperMatchSettings,
+inline unsigned int getAllowedMismatches(const unsigned int overlap, const AdapterMatchSettings &adatperMatchSettings,
     const ErrorRateMode::nonLinear&) noexcept
 {
-    if (overlap == 0)
-        return false;
     unsigned int allowedMismatches = static_cast<unsigned int>(adatperMatchSettings.errorRate * static_cast<float>(overlap));
     if (adatperMatchSettings.errorRate > 0)
     {
@@ -809,8 +1039,16 @@ inline bool isMatch(const unsigned int overlap, const unsigned int mismatches, c
     }
     else
         allowedMismatches = adatperMatchSettings.errors;
+    return allowedMismatches;
+}
 
-    return overlap >= adatperMatchSettings.min_length && mismatches <= allowedMismatches;
+template <typename TErrorRateMode>
+inline bool isMatch(const unsigned int overlap, const unsigned int mismatches, const AdapterMatchSettings &adatperMatchSettings,
+    const TErrorRateMode& errorRateMode) noexcept
+{
+    if (overlap == 0)
+        return false;
+    return overlap >= adatperMatchSettings.min_length && mismatches <= getAllowedMismatches(overlap, adatperMatchSettings, errorRateMode);
 }
 
 // convenience wrapper
@@ -819,81 +1057,166 @@ inline bool isMatch(const unsigned int overlap, const unsigned int mismatches, c
     return isMatch(overlap, mismatches, AdapterMatchSettings(), ErrorRateMode::linear());
 }
 
-
-enum adapterDirection : bool
+template <typename TErrorRateMode>
+void AdapterIndex::build(const AdapterSet& adapters, const AdapterMatchSettings& mode, const TErrorRateMode& errorRateMode)
 {
-    reverse,
-    forward
-};
+    _k = 0;
+    _maxLenAdapter = 0;
+    _entries.clear();
+    _allowedMismatches[0] = -1;
+    for (unsigned int overlap = 1; overlap < _allowedMismatches.size(); ++overlap)
+        _allowedMismatches[overlap] = overlap < mode.min_length ? -1 : static_cast<int>(getAllowedMismatches(overlap, mode, errorRateMode));
+
+    // a full overlap of the adapter has to be filterable, longer k-mers give less random hits
+    auto isFilterable = [this](const AdapterItem& adapterItem)
+    {
+        const auto& encodedSeq = adapterItem.getEncodedSeq();
+        return encodedSeq.size() >= _k && _allowedMismatches[encodedSeq.size()] >= 0 && minHits(encodedSeq.size()) > 0 &&
+            encodedSeq.find(static_cast<char>(DNA5Q_N)) == std::string::npos;
+    };
+    unsigned int k = 0;
+    size_t maxFilterable = 0;
+    for (_k = maxK; _k >= minK; --_k)
+    {
+        const size_t filterable = std::count_if(adapters.begin(), adapters.end(), isFilterable);
+        if (filterable > maxFilterable)
+        {
+            maxFilterable = filterable;
+            k = _k;
+        }
+    }
+    _k = k;
+    if (k == 0)
+        return;
 
-template<bool _val>
-struct TagAdapter
-{
-    static const bool value = _val;
-};
+    _indexed.assign(adapters.size(), false);
+    std::vector<unsigned int> bucketSize(1u << (2 * k), 0);
+    for (unsigned int adapterNumber = 0; adapterNumber < adapters.size(); ++adapterNumber)
+    {
+        const auto& encodedSeq = adapters[adapterNumber].getEncodedSeq();
+        _maxLenAdapter = std::max<unsigned int>(_maxLenAdapter, encodedSeq.size());
+        if (!isFilterable(adapters[adapterNumber]))
+            continue;
+        _indexed[adapterNumber] = true;
+        unsigned int code = 0;
+        for (unsigned int pos = 0; pos < encodedSeq.size(); ++pos)
+        {
+            code = ((code << 2) | getOrdValue(encodedSeq[pos], Dna5QEncoding())) & (bucketSize.size() - 1);
+            if (pos + 1 >= k)
+            {
+                ++bucketSize[code];
+                _entries.push_back(Entry{ static_cast<uint16_t>(adapterNumber), static_cast<unsigned char>(pos + 1 - k) });
+            }
+        }
+    }
+    _bucketBegin.assign(bucketSize.size() + 1, 0);
+    for (unsigned int code = 0; code < bucketSize.size(); ++code)
+        _bucketBegin[code + 1] = _bucketBegin[code] + bucketSize[code];
+
+    // sort the entries into their buckets
+    std::vector<Entry> entries(_entries.size());
+    std::vector<unsigned int> next(_bucketBegin.begin(), _bucketBegin.end() - 1);
+    for (const auto& entry : _entries)
+    {
+        const auto& encodedSeq = adapters[entry.adapter].getEncodedSeq();
+        unsigned int code = 0;
+        for (unsigned int pos = entry.pos; pos < entry.pos + k; ++pos)
+            code = (code << 2) | getOrdValue(encodedSeq[pos], Dna5QEncoding());
+        entries[next[code]++] = entry;
+    }
+    _entries = std::move(entries);
+}
 
-template<bool _direction>
-struct StripAdapterDirection
+template <typename TSeq>
+void AdapterIndex::scan(ReadHits& hits, const TSeq& read) const
 {
-    static const bool value = _direction;
-};
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    for (const auto index : hits.touched)
+        hits.counts[index] = 0;
+    hits.touched.clear();
+    hits.filtered = false;
+    hits.lenRead = length(read);
+    if (!enabled())
+        return;
 
-void Dna5ToStdString(std::string& dest, const seqan::Dna5QString &source) noexcept
-{
-    auto len = length(source);
-    dest.resize(len);
-    for(size_t n = 0; n < len; n++)
+    // diagonal d of adapter a is counted in counts[a * stride + d + _maxLenAdapter]
+    hits.stride = hits.lenRead + _maxLenAdapter;
+    if (hits.counts.size() < _indexed.size() * hits.stride)
+        hits.counts.resize(_indexed.size() * hits.stride, 0);
+
+    const unsigned char* readBytes = getBytes(read);
+    const unsigned int mask = (1u << (2 * _k)) - 1;
+    unsigned int code = 0;
+    for (unsigned int pos = 0; pos < hits.lenRead; ++pos)
     {
-        switch (((unsigned char)source[n]) & 0x07)
+        const unsigned int ordValue = getOrdValue(readBytes[pos], TEncoding());
+        if (ordValue == 4)
+            return;
+        code = ((code << 2) | ordValue) & mask;
+        if (pos + 1 < _k)
+            continue;
+        const unsigned int kmerBegin = pos + 1 - _k;
+        for (unsigned int e = _bucketBegin[code]; e < _bucketBegin[code + 1]; ++e)
         {
-        case 0:
-            dest[n] = 'A';
-            break;
-        case 1:
-            dest[n] = 'C';
-            break;
-        case 2:
-            dest[n] = 'G';
-            break;
-        case 3:
-            dest[n] = 'T';
-            break;
-        case 4:
-            dest[n] = 'N';
-            break;
+            const unsigned int index = _entries[e].adapter * hits.stride + kmerBegin + _maxLenAdapter - _entries[e].pos;
+            if (hits.counts[index]++ == 0)
+                hits.touched.push_back(index);
         }
     }
+    hits.filtered = true;
 }
 
-void Dna5QToStdString(std::string& dest, std::string& destQ, const seqan::Dna5QString &source) noexcept
+template <typename TSeq>
+bool AdapterIndex::mayMatch(const ReadHits& hits, const TSeq& read, const unsigned int adapterNumber, const AdapterItem& adapterItem,
+    const int leftOverhang, const int rightOverhang) const noexcept
 {
-    auto len = length(source);
-    dest.resize(len);
-    destQ.resize(len);
-    for (size_t n = 0; n < len; n++)
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    if (!hits.filtered || adapterNumber >= _indexed.size() || !_indexed[adapterNumber])
+        return true;
+
+    const unsigned char* readBytes = getBytes(read);
+    const unsigned char* adapterBytes = reinterpret_cast<const unsigned char*>(adapterItem.getEncodedSeq().data());
+    const int lenRead = hits.lenRead;
+    const int lenAdapter = adapterItem.getLen();
+    const int shiftStartPos = std::max(-leftOverhang, 1 - lenAdapter);
+    const int shiftEndPos = std::min(lenRead - lenAdapter + rightOverhang, lenRead - 1);
+    const uint16_t* counts = hits.counts.data() + adapterNumber * hits.stride + _maxLenAdapter;
+    for (int shiftPos = shiftStartPos; shiftPos <= shiftEndPos; ++shiftPos)
     {
-        destQ[n] = seqan::getQualityValue(source[n]);
-        switch (((unsigned char)source[n]) & 0x07)
+        const int overlapBegin = std::max(shiftPos, 0);
+        const int overlap = std::min(shiftPos + lenAdapter, lenRead) - overlapBegin;
+        const int allowedMismatches = _allowedMismatches[overlap];
+        if (allowedMismatches < 0)
+            continue;
+        const int requiredHits = minHits(overlap);
+        if (requiredHits > 0)
         {
-        case 0:
-            dest[n] = 'A';
-            break;
-        case 1:
-            dest[n] = 'C';
-            break;
-        case 2:
-            dest[n] = 'G';
-            break;
-        case 3:
-            dest[n] = 'T';
-            break;
-        case 4:
-            dest[n] = 'N';
-            break;
+            if (counts[shiftPos] >= requiredHits)
+                return true;
+            continue;
         }
+        int mismatches = 0;
+        for (int pos = overlapBegin; pos < overlapBegin + overlap && mismatches <= allowedMismatches; ++pos)
+            mismatches += getOrdValue(readBytes[pos], TEncoding()) != getOrdValue(adapterBytes[pos - shiftPos], Dna5QEncoding());
+        if (mismatches <= allowedMismatches)
+            return true;
     }
+    return false;
 }
 
+
+template<bool _val>
+struct TagAdapter
+{
+    static const bool value = _val;
+};
+
+template<bool _direction>
+struct StripAdapterDirection
+{
+    static const bool value = _direction;
+};
+
 template <typename TStats>
 struct TlsBlockAdapterTrimming
 {
@@ -901,8 +1224,11 @@ struct TlsBlockAdapterTrimming
 
     TStats& stats;
     const AdapterTrimmingParams& params; // can use ref here, bcs read only does not cause false sharing
-    std::string tlsString;
-    std::string tlsString2;
+    std::vector<uint16_t> qualityErrorWeights;  // of the current read, only used by AdapterSelectionMethod::BestQ
+    AdapterIndex::ReadHits adapterIndexHits;    // of the current read
+    std::vector<unsigned char> mateReverseComplement;   // of the current read pair, only used by stripPair()
+    TransposedReadBatch readBatch;              // only used by stripAdapterBatchBest()
+    std::vector<unsigned int> readOrder;        // only used by stripAdapterBatchBest()
 };
 
 namespace AdapterSelectionMethod
@@ -912,6 +1238,51 @@ namespace AdapterSelectionMethod
     struct BestQ {};
 }
 
+// removes the aligned adapter from seq and counts it in the statistics, returns the number of removed bases
+template <typename TSeq, typename TlsBlock, typename TAlignResult>
+unsigned int removeAdapter(TSeq& seq, TlsBlock& tlsBlock, const TAlignResult& alignResult, const AdapterItem& adapterItem)
+{
+    using TReadLen = decltype(tlsBlock.stats.overlapSum);
+    const TReadLen lenSeq = length(seq);
+    const auto lenAdapter = adapterItem.getLen();
+
+    TReadLen eraseStart = 0;
+    TReadLen eraseEnd = 0;
+    if (adapterItem.adapterEnd == AdapterItem::end3)
+    {
+        eraseStart = alignResult.shiftPos;
+        eraseEnd = lenSeq;
+    }
+    else
+    {
+        eraseStart = 0;
+        eraseEnd = std::min<TReadLen>(lenSeq, alignResult.shiftPos + lenAdapter + alignResult.indels);
+    }
+
+    seqan::erase(seq, eraseStart, eraseEnd);
+    const TReadLen removed = eraseEnd - eraseStart;
+
+    // update statistics        
+    const auto statisticLen = removed;
+    if (tlsBlock.stats.removedLength.size() < statisticLen)
+        tlsBlock.stats.removedLength.resize(statisticLen);
+    if (tlsBlock.stats.removedLength[statisticLen - 1].size() < static_cast<size_t>(alignResult.mismatches + 1))
+        tlsBlock.stats.removedLength[statisticLen - 1].resize(alignResult.mismatches + 1);
+    ++tlsBlock.stats.removedLength[statisticLen - 1][alignResult.mismatches];
+
+    if (tlsBlock.stats.numRemoved.size() < static_cast<size_t>(adapterItem.id + 1))
+    {
+        std::cout << "error: numRemoved too small!" << std::endl;
+        throw(std::runtime_error("error: numRemoved too small!"));
+    }
+    ++tlsBlock.stats.numRemoved[adapterItem.id];
+
+    tlsBlock.stats.overlapSum += alignResult.overlap;
+    tlsBlock.stats.maxOverlap = std::max(tlsBlock.stats.maxOverlap, alignResult.overlap);
+    tlsBlock.stats.minOverlap = std::min(tlsBlock.stats.minOverlap, alignResult.overlap);
+    return removed;
+}
+
 // convenience wrapper
 template <typename TSeq, typename TAdapters, typename TReadLen, typename TStripAdapterDirection>
 unsigned stripAdapter(TSeq& seq, AdapterTrimmingStats<TReadLen>& stats, TAdapters const& adapters, AdapterMatchSettings const& spec,
@@ -919,7 +1290,9 @@ unsigned stripAdapter(TSeq& seq, AdapterTrimmingStats<TReadLen>& stats, TAdapter
 {
     AdapterTrimmingParams params;
     params.adapters = adapters;
+    params.orientedAdapters.build(params.adapters);
     params.mode = spec;
+    params.adapterIndex.build(params.adapters, params.mode, ErrorRateMode::linear());
     TlsBlockAdapterTrimming<AdapterTrimmingStats<TReadLen>> tlsBlock(stats, params);
     return stripAdapter(seq, tlsBlock, stripDirection, AdapterSelectionMethod::Best(), ErrorRateMode::linear());
 }
@@ -927,91 +1300,54 @@ unsigned stripAdapter(TSeq& seq, AdapterTrimmingStats<TReadLen>& stats, TAdapter
 template <typename TSeq, typename TStripAdapterDirection, typename TlsBlock, typename TErrorRateMode>
 unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirection&, const AdapterSelectionMethod::BestQ&, const TErrorRateMode&)
 {
-    AlignAlgorithm::Menkuec alignAlgorithm;
+    AlignAlgorithm::MenkuecQ alignAlgorithm;
 
     using TReadLen = decltype(tlsBlock.stats.overlapSum);
     unsigned removedTotal{ 0 };
     AlignResult<TReadLen> alignResult;  // small object, created on stack
     AlignResult<TReadLen> bestAlignResult;  // small object, created on stack
-    typename decltype(tlsBlock.params.adapters)::value_type bestAdapter;
+    unsigned int bestAdapterNumber = 0;
     unsigned removedTotalOld = 0;
     TReadLen lenSeq = length(seq);
 
-    Dna5QToStdString(tlsBlock.tlsString, tlsBlock.tlsString2, seq);
+    getQualityErrorWeights(tlsBlock.qualityErrorWeights, seq);
 
     for (unsigned int n = 0;n < tlsBlock.params.mode.times; ++n)
     {
         bestAlignResult.score = AlignResult<TReadLen>::noMatch;
-        for (auto const& adapterItem : tlsBlock.params.adapters)
+        for (const unsigned int adapterNumber : tlsBlock.params.orientedAdapters.get(TStripAdapterDirection::value))
         {
+            const auto& adapterItem = tlsBlock.params.adapters[adapterNumber];
             //if (static_cast<unsigned>(length(adapterItem.seq)) < spec.min_length)
             //  continue;
-            if ((TStripAdapterDirection::value == adapterDirection::reverse && adapterItem.reverse == false) ||
-                (TStripAdapterDirection::value == adapterDirection::forward && adapterItem.reverse == true))
-                continue;
-
-            const auto& adapterSequence = adapterItem.getSeq();
+            const auto& adapterSequence = adapterItem.getEncodedSeq();
             const auto lenAdapter = adapterItem.getLen();
 
             const int oppositeEndOverhang = adapterItem.anchored == true ? lenAdapter - lenSeq : adapterItem.overhang;
             const int sameEndOverhang = adapterItem.anchored == true ? 0 : lenAdapter - tlsBlock.params.mode.min_length;
             if (adapterItem.adapterEnd == AdapterItem::end3)
-                alignPair(alignResult, tlsBlock.tlsString, tlsBlock.tlsString2, adapterSequence, oppositeEndOverhang, sameEndOverhang, alignAlgorithm);
+                alignPair(alignResult, seq, tlsBlock.qualityErrorWeights, adapterSequence, oppositeEndOverhang, sameEndOverhang, alignAlgorithm);
             else
-                alignPair(alignResult, tlsBlock.tlsString, tlsBlock.tlsString2, adapterSequence, sameEndOverhang, oppositeEndOverhang, alignAlgorithm);
+                alignPair(alignResult, seq, tlsBlock.qualityErrorWeights, adapterSequence, sameEndOverhang, oppositeEndOverhang, alignAlgorithm);
 
             if (isMatch(alignResult.overlap, alignResult.mismatches, tlsBlock.params.mode, TErrorRateMode()))
             {
                 if (alignResult.score > bestAlignResult.score)
                 {
                     bestAlignResult = alignResult;
-                    bestAdapter = adapterItem;
+                    bestAdapterNumber = adapterNumber;
                 }
             }
         }
         if (bestAlignResult.score != AlignResult<TReadLen>::noMatch)
         {
-            const auto& alignResult = bestAlignResult;
-            const auto& adapterItem = bestAdapter;
-            const auto lenAdapter = adapterItem.getLen();
-
-            TReadLen eraseStart = 0;
-            TReadLen eraseEnd = 0;
-            if (adapterItem.adapterEnd == AdapterItem::end3)
-            {
-                eraseStart = alignResult.shiftPos;
-                eraseEnd = lenSeq;
-            }
-            else
-            {
-                eraseStart = 0;
-                eraseEnd = std::min<TReadLen>(lenSeq, alignResult.shiftPos + lenAdapter);
-            }
-
-            seqan::erase(seq, eraseStart, eraseEnd);
-            tlsBlock.tlsString.erase(eraseStart, eraseEnd);
-            TReadLen removed = eraseEnd - eraseStart;
+            const auto& adapterItem = tlsBlock.params.adapters[bestAdapterNumber];
+            const TReadLen removed = removeAdapter(seq, tlsBlock, bestAlignResult, adapterItem);
+            // the weights have to follow the read, a 3' adapter is removed from the end, a 5' adapter from the start
+            const TReadLen eraseStart = adapterItem.adapterEnd == AdapterItem::end3 ? lenSeq - removed : 0;
+            tlsBlock.qualityErrorWeights.erase(tlsBlock.qualityErrorWeights.begin() + eraseStart, tlsBlock.qualityErrorWeights.begin() + eraseStart + removed);
             removedTotal += removed;
             lenSeq -= removed;
-
-            // update statistics        
-            const auto statisticLen = removed;
-            if (tlsBlock.stats.removedLength.size() < statisticLen)
-                tlsBlock.stats.removedLength.resize(statisticLen);
-            if (tlsBlock.stats.removedLength[statisticLen - 1].size() < static_cast<size_t>(alignResult.mismatches + 1))
-                tlsBlock.stats.removedLength[statisticLen - 1].resize(alignResult.mismatches + 1);
-            ++tlsBlock.stats.removedLength[statisticLen - 1][alignResult.mismatches];
-
-            if (tlsBlock.stats.numRemoved.size() < static_cast<size_t>(adapterItem.id + 1))
-            {
-                std::cout << "error: numRemoved too small!" << std::endl;
-                throw(std::runtime_error("error: numRemoved too small!"));
-            }
-            ++tlsBlock.stats.numRemoved[adapterItem.id];
-
-            tlsBlock.stats.overlapSum += alignResult.overlap;
-            tlsBlock.stats.maxOverlap = std::max(tlsBlock.stats.maxOverlap, alignResult.overlap);
-            tlsBlock.stats.minOverlap = std::min(tlsBlock.stats.minOverlap, alignResult.overlap);
         }
 
         if (removedTotal == removedTotalOld)
@@ -1026,7 +1362,8 @@ unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirectio
 }
 
 template <typename TSeq, typename TStripAdapterDirection, typename TlsBlock, typename TErrorRateMode>
-unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirection&, const AdapterSelectionMethod::Best&, const TErrorRateMode&)
+unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirection&, const AdapterSelectionMethod::Best&, const TErrorRateMode&,
+    const unsigned int firstRound = 0)
 {
     AlignAlgorithm::Menkuec alignAlgorithm;
 
@@ -1034,85 +1371,51 @@ unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirectio
     unsigned removedTotal{ 0 };
     AlignResult<TReadLen> alignResult;  // small object, created on stack
     AlignResult<TReadLen> bestAlignResult;  // small object, created on stack
-    typename decltype(tlsBlock.params.adapters)::value_type bestAdapter;
+    unsigned int bestAdapterNumber = 0;
     unsigned removedTotalOld = 0;
     TReadLen lenSeq = length(seq);
 
-    Dna5ToStdString(tlsBlock.tlsString, seq);
+    const auto& adapterIndex = tlsBlock.params.adapterIndex;
+    const bool useAdapterIndex = adapterIndex.enabled() && !tlsBlock.params.gapped;
 
-    for (unsigned int n = 0;n < tlsBlock.params.mode.times; ++n)
+    for (unsigned int n = firstRound;n < tlsBlock.params.mode.times; ++n)
     {
         bestAlignResult.score = AlignResult<TReadLen>::noMatch;
-        for (auto const& adapterItem : tlsBlock.params.adapters)
+        if (useAdapterIndex)
+            adapterIndex.scan(tlsBlock.adapterIndexHits, seq);
+        for (const unsigned int adapterNumber : tlsBlock.params.orientedAdapters.get(TStripAdapterDirection::value))
         {
+            const auto& adapterItem = tlsBlock.params.adapters[adapterNumber];
             //if (static_cast<unsigned>(length(adapterItem.seq)) < spec.min_length)
             //  continue;
-            if ((TStripAdapterDirection::value == adapterDirection::reverse && adapterItem.reverse == false) ||
-                (TStripAdapterDirection::value == adapterDirection::forward && adapterItem.reverse == true))
-                continue;
-
-            const auto& adapterSequence = adapterItem.getSeq();
+            const auto& adapterSequence = adapterItem.getEncodedSeq();
             const auto lenAdapter = adapterItem.getLen();
 
             const int oppositeEndOverhang = adapterItem.anchored == true ? lenAdapter - lenSeq : adapterItem.overhang;
             const int sameEndOverhang = adapterItem.anchored == true ? 0 : lenAdapter - tlsBlock.params.mode.min_length;
-            if (adapterItem.adapterEnd == AdapterItem::end3)
-                alignPair(alignResult, tlsBlock.tlsString, adapterSequence, oppositeEndOverhang, sameEndOverhang, alignAlgorithm);
+            const int leftOverhang = adapterItem.adapterEnd == AdapterItem::end3 ? oppositeEndOverhang : sameEndOverhang;
+            const int rightOverhang = adapterItem.adapterEnd == AdapterItem::end3 ? sameEndOverhang : oppositeEndOverhang;
+            if (useAdapterIndex && !adapterIndex.mayMatch(tlsBlock.adapterIndexHits, seq, adapterNumber, adapterItem, leftOverhang, rightOverhang))
+                continue;
+            if (tlsBlock.params.gapped)
+                alignPair(alignResult, seq, adapterSequence, leftOverhang, rightOverhang, AlignAlgorithm::Myers());
             else
-                alignPair(alignResult, tlsBlock.tlsString, adapterSequence, sameEndOverhang, oppositeEndOverhang, alignAlgorithm);
+                alignPair(alignResult, seq, adapterSequence, leftOverhang, rightOverhang, alignAlgorithm);
 
             if (isMatch(alignResult.overlap, alignResult.mismatches, tlsBlock.params.mode, TErrorRateMode()))
             {
                 if (alignResult.score > bestAlignResult.score)
                 {
                     bestAlignResult = alignResult;
-                    bestAdapter = adapterItem;
+                    bestAdapterNumber = adapterNumber;
                 }
             }
         }
         if (bestAlignResult.score != AlignResult<TReadLen>::noMatch)
         {
-            const auto& alignResult = bestAlignResult;
-            const auto& adapterItem = bestAdapter;
-            const auto lenAdapter = adapterItem.getLen();
-
-            TReadLen eraseStart = 0;
-            TReadLen eraseEnd = 0;
-            if (adapterItem.adapterEnd == AdapterItem::end3)
-            {
-                eraseStart = alignResult.shiftPos;
-                eraseEnd = lenSeq;
-            }
-            else
-            {
-                eraseStart = 0;
-                eraseEnd = std::min<TReadLen>(lenSeq, alignResult.shiftPos + lenAdapter);
-            }
-
-            seqan::erase(seq, eraseStart, eraseEnd);
-            tlsBlock.tlsString.erase(eraseStart, eraseEnd);
-            TReadLen removed = eraseEnd - eraseStart;
+            const TReadLen removed = removeAdapter(seq, tlsBlock, bestAlignResult, tlsBlock.params.adapters[bestAdapterNumber]);
             removedTotal += removed;
             lenSeq -= removed;
-
-            // update statistics        
-            const auto statisticLen = removed;
-            if (tlsBlock.stats.removedLength.size() < statisticLen)
-                tlsBlock.stats.removedLength.resize(statisticLen);
-            if (tlsBlock.stats.removedLength[statisticLen - 1].size() < static_cast<size_t>(alignResult.mismatches + 1))
-                tlsBlock.stats.removedLength[statisticLen - 1].resize(alignResult.mismatches + 1);
-            ++tlsBlock.stats.removedLength[statisticLen - 1][alignResult.mismatches];
-
-            if (tlsBlock.stats.numRemoved.size() < static_cast<size_t>(adapterItem.id + 1))
-            {
-                std::cout << "error: numRemoved too small!" << std::endl;
-                throw(std::runtime_error("error: numRemoved too small!"));
-            }
-            ++tlsBlock.stats.numRemoved[adapterItem.id];
-
-            tlsBlock.stats.overlapSum += alignResult.overlap;
-            tlsBlock.stats.maxOverlap = std::max(tlsBlock.stats.maxOverlap, alignResult.overlap);
-            tlsBlock.stats.minOverlap = std::min(tlsBlock.stats.minOverlap, alignResult.overlap);
         }
 
         if (removedTotal == removedTotalOld)
@@ -1138,68 +1441,40 @@ unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirectio
     unsigned removedTotalOld = 0;
     TReadLen lenSeq = length(seq);
 
-    Dna5ToStdString(tlsBlock.tlsString, seq);
+    const auto& adapterIndex = tlsBlock.params.adapterIndex;
+    const bool useAdapterIndex = adapterIndex.enabled() && !tlsBlock.params.gapped;
 
     for (unsigned int n = 0;n < tlsBlock.params.mode.times; ++n)
     {
         alignResult.score = AlignResult<TReadLen>::noMatch;
-        for (auto const& adapterItem : tlsBlock.params.adapters)
+        if (useAdapterIndex)
+            adapterIndex.scan(tlsBlock.adapterIndexHits, seq);
+        for (const unsigned int adapterNumber : tlsBlock.params.orientedAdapters.get(TStripAdapterDirection::value))
         {
+            const auto& adapterItem = tlsBlock.params.adapters[adapterNumber];
             //if (static_cast<unsigned>(length(adapterItem.seq)) < spec.min_length)
               //  continue;
-            if ((TStripAdapterDirection::value == adapterDirection::reverse && adapterItem.reverse == false) ||
-                (TStripAdapterDirection::value == adapterDirection::forward && adapterItem.reverse == true))
-                continue;
-
-            const auto& adapterSequence = adapterItem.getSeq();
+            const auto& adapterSequence = adapterItem.getEncodedSeq();
             const auto lenAdapter = adapterItem.getLen();
 
             const int oppositeEndOverhang = adapterItem.anchored == true ? lenAdapter - lenSeq : adapterItem.overhang;
             const int sameEndOverhang = adapterItem.anchored == true ? 0 : lenAdapter - tlsBlock.params.mode.min_length;
-            if (adapterItem.adapterEnd == AdapterItem::end3)
-                alignPair(alignResult, tlsBlock.tlsString, adapterSequence, oppositeEndOverhang, sameEndOverhang, alignAlgorithm);
+            const int leftOverhang = adapterItem.adapterEnd == AdapterItem::end3 ? oppositeEndOverhang : sameEndOverhang;
+            const int rightOverhang = adapterItem.adapterEnd == AdapterItem::end3 ? sameEndOverhang : oppositeEndOverhang;
+            if (useAdapterIndex && !adapterIndex.mayMatch(tlsBlock.adapterIndexHits, seq, adapterNumber, adapterItem, leftOverhang, rightOverhang))
+                continue;
+            if (tlsBlock.params.gapped)
+                alignPair(alignResult, seq, adapterSequence, leftOverhang, rightOverhang, AlignAlgorithm::Myers());
             else
-                alignPair(alignResult, tlsBlock.tlsString, adapterSequence, sameEndOverhang, oppositeEndOverhang, alignAlgorithm);
+                alignPair(alignResult, seq, adapterSequence, leftOverhang, rightOverhang, alignAlgorithm);
 
             if (isMatch(alignResult.overlap, alignResult.mismatches, tlsBlock.params.mode, TErrorRateMode()))
             {
-                TReadLen eraseStart = 0;
-                TReadLen eraseEnd = 0;
-                if (adapterItem.adapterEnd == AdapterItem::end3)
-                {
-                    eraseStart = alignResult.shiftPos;
-                    eraseEnd = lenSeq;
-                }
-                else
-                {
-                    eraseStart = 0;
-                    eraseEnd = std::min<TReadLen>(lenSeq, alignResult.shiftPos + lenAdapter);
-                }
-
-                seqan::erase(seq, eraseStart, eraseEnd);
-                tlsBlock.tlsString.erase(eraseStart, eraseEnd);
-                TReadLen removed = eraseEnd - eraseStart;
+                const TReadLen removed = removeAdapter(seq, tlsBlock, alignResult, adapterItem);
                 removedTotal += removed;
                 lenSeq -= removed;
-
-                // update statistics        
-                const auto statisticLen = removed;
-                if (tlsBlock.stats.removedLength.size() < statisticLen)
-                    tlsBlock.stats.removedLength.resize(statisticLen);
-                if (tlsBlock.stats.removedLength[statisticLen - 1].size() < static_cast<size_t>(alignResult.mismatches + 1))
-                    tlsBlock.stats.removedLength[statisticLen - 1].resize(alignResult.mismatches + 1);
-                ++tlsBlock.stats.removedLength[statisticLen - 1][alignResult.mismatches];
-
-                if (tlsBlock.stats.numRemoved.size() < static_cast<size_t>(adapterItem.id + 1))
-                {
-                    std::cout << "error: numRemoved too small!" << std::endl;
-                    throw(std::runtime_error("error: numRemoved too small!"));
-                }
-                ++tlsBlock.stats.numRemoved[adapterItem.id];
-
-                tlsBlock.stats.overlapSum += alignResult.overlap;
-                tlsBlock.stats.maxOverlap = std::max(tlsBlock.stats.maxOverlap, alignResult.overlap);
-                tlsBlock.stats.minOverlap = std::min(tlsBlock.stats.minOverlap, alignResult.overlap);
+                if (useAdapterIndex)
+                    adapterIndex.scan(tlsBlock.adapterIndexHits, seq);
             }
         }
         if (removedTotal == removedTotalOld)
@@ -1213,46 +1488,142 @@ unsigned stripAdapter(TSeq& seq, TlsBlock& tlsBlock, const TStripAdapterDirectio
     return removedTotal;
 }
 
-template < template <typename> class TRead, typename TSeq, typename TlsBlock, typename TTagAdapter, 
-    typename TAdapterSelectionMethod, typename TErrorRateMode,
-    typename = std::enable_if_t<std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value> >
-    void stripAdapterBatch(std::vector<TRead<TSeq>>& reads, TlsBlock& tlsBlock, TTagAdapter, TAdapterSelectionMethod, TErrorRateMode, bool = false) noexcept(!TTagAdapter::value)
+/*
+- AdapterSelectionMethod::Best for single end reads with AlignAlgorithm::MenkuecBatch
+- the reads are sorted by length and the first round is aligned in batches of equal length,
+  short reads like the ones of ChIP-nexus fill the SIMD registers this way
+- reads from which an adapter was removed continue with stripAdapter(), like reads that have no partner of the same length
+- the trimming result is the same as with stripAdapter()
+*/
+template <typename TReads, typename TlsBlock, typename TTagAdapter, typename TErrorRateMode>
+void stripAdapterBatchBest(TReads& reads, TlsBlock& tlsBlock, TTagAdapter, TErrorRateMode)
 {
-    for (auto& read : reads)
+    using TSeq = std::decay_t<decltype(reads[0].seq)>;
+    using TEncoding = typename AdapterEncoding<TSeq>::Type;
+    using TReadLen = decltype(tlsBlock.stats.overlapSum);
+    std::array<AlignResult<TReadLen>, 64> alignResults;
+    std::array<AlignResult<TReadLen>, 64> bestAlignResults;
+    std::array<unsigned int, 64> bestAdapterNumbers;
+    auto& readOrder = tlsBlock.readOrder;
+    auto& batch = tlsBlock.readBatch;
+
+    readOrder.resize(reads.size());
+    std::iota(readOrder.begin(), readOrder.end(), 0);
+    std::stable_sort(readOrder.begin(), readOrder.end(), [&reads](const unsigned int a, const unsigned int b)
     {
-        if (seqan::empty(read.seq))
-            continue;
-        const unsigned over = stripAdapter(read.seq, tlsBlock, StripAdapterDirection<adapterDirection::forward>(), TAdapterSelectionMethod(), TErrorRateMode());
-        if (TTagAdapter::value && over != 0)
+        return length(reads[a].seq) < length(reads[b].seq);
+    });
+
+    auto tagRead = [](auto& read, const unsigned int removed)
+    {
+        if (TTagAdapter::value && removed != 0)
             insertAfterFirstToken(read.id, ":AdapterRemoved");
+    };
+
+    size_t batchEnd = 0;
+    for (size_t batchStart = 0; batchStart < readOrder.size(); batchStart = batchEnd)
+    {
+        const unsigned int lenSeq = length(reads[readOrder[batchStart]].seq);
+        batch.clear(lenSeq);
+        for (batchEnd = batchStart; batchEnd < readOrder.size() && !batch.full() && length(reads[readOrder[batchEnd]].seq) == lenSeq; ++batchEnd)
+            batch.add(reads[readOrder[batchEnd]].seq);
+        if (lenSeq == 0)
+            continue;
+        if (batch.getNumReads() == 1)
+        {
+            auto& read = reads[readOrder[batchStart]];
+            tagRead(read, stripAdapter(read.seq, tlsBlock, StripAdapterDirection<adapterDirection::forward>(), AdapterSelectionMethod::Best(), TErrorRateMode()));
+            continue;
+        }
+
+        for (unsigned int r = 0; r < batch.getNumReads(); ++r)
+            bestAlignResults[r].score = AlignResult<TReadLen>::noMatch;
+        for (const unsigned int adapterNumber : tlsBlock.params.orientedAdapters.get(adapterDirection::forward))
+        {
+            const auto& adapterItem = tlsBlock.params.adapters[adapterNumber];
+            const auto lenAdapter = adapterItem.getLen();
+            const int oppositeEndOverhang = adapterItem.anchored == true ? lenAdapter - lenSeq : adapterItem.overhang;
+            const int sameEndOverhang = adapterItem.anchored == true ? 0 : lenAdapter - tlsBlock.params.mode.min_length;
+            const int leftOverhang = adapterItem.adapterEnd == AdapterItem::end3 ? oppositeEndOverhang : sameEndOverhang;
+            const int rightOverhang = adapterItem.adapterEnd == AdapterItem::end3 ? sameEndOverhang : oppositeEndOverhang;
+            alignPair(alignResults.data(), batch, adapterItem.getEncodedSeq(), leftOverhang, rightOverhang, TEncoding(), AlignAlgorithm::MenkuecBatch());
+
+            for (unsigned int r = 0; r < batch.getNumReads(); ++r)
+            {
+                const auto& alignResult = alignResults[r];
+                if (isMatch(alignResult.overlap, alignResult.mismatches, tlsBlock.params.mode, TErrorRateMode()) && alignResult.score > bestAlignResults[r].score)
+                {
+                    bestAlignResults[r] = alignResult;
+                    bestAdapterNumbers[r] = adapterNumber;
+                }
+            }
+        }
+
+        for (unsigned int r = 0; r < batch.getNumReads(); ++r)
+        {
+            auto& read = reads[readOrder[batchStart + r]];
+            if (bestAlignResults[r].score == AlignResult<TReadLen>::noMatch)
+                continue;
+            unsigned int removed = removeAdapter(read.seq, tlsBlock, bestAlignResults[r], tlsBlock.params.adapters[bestAdapterNumbers[r]]);
+            if (tlsBlock.params.mode.times > 1 && removed != 0 && static_cast<TReadLen>(length(read.seq)) >= tlsBlock.params.mode.min_length)
+                removed += stripAdapter(read.seq, tlsBlock, StripAdapterDirection<adapterDirection::forward>(), AdapterSelectionMethod::Best(), TErrorRateMode(), 1);
+            tagRead(read, removed);
+        }
     }
-    return;
+}
+
+template < template <typename> class TRead, typename TSeq, typename TlsBlock, typename TTagAdapter,
+    typename TAdapterSelectionMethod, typename TErrorRateMode,
+    typename = std::enable_if_t<std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value> >
+    void stripAdapterRead(TRead<TSeq>& read, TlsBlock& tlsBlock, TTagAdapter, TAdapterSelectionMethod, TErrorRateMode, bool = false) noexcept(!TTagAdapter::value)
+{
+    if (seqan::empty(read.seq))
+        return;
+    const unsigned over = stripAdapter(read.seq, tlsBlock, StripAdapterDirection<adapterDirection::forward>(), TAdapterSelectionMethod(), TErrorRateMode());
+    if (TTagAdapter::value && over != 0)
+        insertAfterFirstToken(read.id, ":AdapterRemoved");
 }
 
 // pairedEnd adapters will be trimmed in single mode, each seperately
-template < template <typename> class TRead, typename TSeq, typename TlsBlock, typename TTagAdapter, 
+template < template <typename> class TRead, typename TSeq, typename TlsBlock, typename TTagAdapter,
     typename TAdapterSelectionMethod, typename TErrorRateMode,
     typename = std::enable_if_t<std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value> >
-    void stripAdapterBatch(std::vector<TRead<TSeq>>& reads, TlsBlock& tlsBlock, TTagAdapter, TAdapterSelectionMethod, TErrorRateMode) noexcept(!TTagAdapter::value)
+    void stripAdapterRead(TRead<TSeq>& read, TlsBlock& tlsBlock, TTagAdapter, TAdapterSelectionMethod, TErrorRateMode) noexcept(!TTagAdapter::value)
 {
-    for (auto& read : reads)
+    if (seqan::empty(read.seq))
+        return;
+    unsigned over = 0;
+    if (tlsBlock.params.pairedNoAdapterFile)
     {
-        if (seqan::empty(read.seq))
-            continue;
-        unsigned over = 0;
-        if (tlsBlock.params.pairedNoAdapterFile)
-        {
-            stripPair(read.seq, read.seqRev);
-        }
-        else
-        {
-            over = stripAdapter(read.seq, tlsBlock, StripAdapterDirection<adapterDirection::forward>(), TAdapterSelectionMethod(), TErrorRateMode());
-            if (!seqan::empty(read.seqRev))
-                over += stripAdapter(read.seqRev, tlsBlock, StripAdapterDirection<adapterDirection::reverse>(), TAdapterSelectionMethod(), TErrorRateMode());
-        }
-        if (TTagAdapter::value && over != 0)
-            insertAfterFirstToken(read.id, ":AdapterRemoved");
+        stripPair(read.seq, read.seqRev, tlsBlock.mateReverseComplement);
+    }
+    else
+    {
+        over = stripAdapter(read.seq, tlsBlock, StripAdapterDirection<adapterDirection::forward>(), TAdapterSelectionMethod(), TErrorRateMode());
+        if (!seqan::empty(read.seqRev))
+            over += stripAdapter(read.seqRev, tlsBlock, StripAdapterDirection<adapterDirection::reverse>(), TAdapterSelectionMethod(), TErrorRateMode());
+    }
+    if (TTagAdapter::value && over != 0)
+        insertAfterFirstToken(read.id, ":AdapterRemoved");
+}
+
+// true if stripAdapterBatch() aligns reads of equal length together, the reads can not be trimmed one by one then
+template <typename TRead, typename TlsBlock, typename TAdapterSelectionMethod>
+bool isBatchAdapterTrimming(const TlsBlock& tlsBlock, TAdapterSelectionMethod) noexcept
+{
+    return !IsPairedEndRead<TRead>::value && std::is_same<TAdapterSelectionMethod, AdapterSelectionMethod::Best>::value
+        && tlsBlock.params.batch && !tlsBlock.params.gapped;
+}
+
+template <typename TRead, typename TAlloc, typename TlsBlock, typename TTagAdapter, typename TAdapterSelectionMethod, typename TErrorRateMode>
+void stripAdapterBatch(std::vector<TRead, TAlloc>& reads, TlsBlock& tlsBlock, TTagAdapter, TAdapterSelectionMethod, TErrorRateMode) noexcept(!TTagAdapter::value)
+{
+    if (isBatchAdapterTrimming<TRead>(tlsBlock, TAdapterSelectionMethod()))
+    {
+        stripAdapterBatchBest(reads, tlsBlock, TTagAdapter(), TErrorRateMode());
+        return;
     }
-    return;
+    for (auto& read : reads)
+        stripAdapterRead(read, tlsBlock, TTagAdapter(), TAdapterSelectionMethod(), TErrorRateMode());
 }
 
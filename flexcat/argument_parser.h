@@ -32,6 +32,8 @@
 #pragma once
 
 #include <string>
+#include <algorithm>
+#include <initializer_list>
 
 #include <seqan/sequence.h>
 #include <seqan/seq_io.h>
@@ -174,6 +176,10 @@ int loadQualityTrimmingParams(seqan::ArgumentParser const & parser, QualityTrimm
 
 int openStream(seqan::CharString const & file, seqan::SeqFileIn & inFile);
 
+bool hasExtension(seqan::CharString const & file, std::initializer_list<const char*> extensions);
+
+int openFastqReader(seqan::CharString const & file, std::unique_ptr<FastqBatchReader>& reader, unsigned int numThreads);
+
 int loadProgramParams(seqan::ArgumentParser const & parser, ProgramParams& params, InputFileStreams& vars);
 
 int checkParams(ProgramParams const & programParams, InputFileStreams const& inputFileStreams, ProcessingParams const & processingParams,
@@ -329,6 +335,13 @@ void ArgumentParserBuilder::addDemultiplexingOptions(seqan::ArgumentParser & par
     addOption(parser, seqan::ArgParseOption(
         "app", "approximate", "Select approximate barcode demultiplexing, allowing one mismatch."));
 
+    seqan::ArgParseOption distanceOpt = seqan::ArgParseOption(
+        "dist", "distance", "Number of mismatches allowed for approximate barcode demultiplexing. Implies approximate.",
+        seqan::ArgParseOption::INTEGER, "VALUE");
+    setDefaultValue(distanceOpt, 1);
+    setMinValue(distanceOpt, "1");
+    addOption(parser, distanceOpt);
+
     addOption(parser, seqan::ArgParseOption(
         "hc", "hardClip", "Select hardClip option, clipping the first length(barcode) bases in any case."));
 
@@ -398,6 +411,14 @@ void ArgumentParserBuilder::addAdapterTrimmingOptions(seqan::ArgumentParser & pa
         "topdown", "topdown", "Trim adapters in the order they are specified, first match will be taken.");
     addOption(parser, topdownOpt);
 
+    seqan::ArgParseOption gappedOpt = seqan::ArgParseOption(
+        "gapped", "gapped", "Allow insertions and deletions in adapter matches, they count as errors like mismatches.");
+    addOption(parser, gappedOpt);
+
+    seqan::ArgParseOption batchOpt = seqan::ArgParseOption(
+        "batch", "batch", "Align reads of equal length together against each adapter, one read per SIMD lane. Faster for short single end reads, not used with --topdown or --gapped.");
+    addOption(parser, batchOpt);
+
 
     if (flexiProgram != FlexiProgram::ALL_STEPS)
     {
@@ -627,17 +648,14 @@ int loadBarcodes(char const * path, DemultiplexingParams& params)
         params.barcodeIds.emplace_back(id);
         params.barcodes.emplace_back(barcode);
     }
-    if (params.approximate)                            //modifies the barcodes for approximate matching
-    {
-        buildAllVariations(params.barcodes);
-    }
     return 0;
 }
 
 int loadDemultiplexingParams(seqan::ArgumentParser const& parser, DemultiplexingParams& params)
 {
     // APPROXIMATE/EXACT MATCHING---------------------    
-    params.approximate = seqan::isSet(parser, "app");
+    params.approximate = seqan::isSet(parser, "app") || seqan::isSet(parser, "dist");
+    getOptionValue(params.maxDistance, parser, "dist");
     // HARD CLIP MODE --------------------------------
     params.hardClip = seqan::isSet(parser, "hc") && !(isSet(parser, "ex"));
     // EXCLUDE UNIDENTIFIED --------------------------
@@ -654,6 +672,11 @@ int loadDemultiplexingParams(seqan::ArgumentParser const& parser, Demultiplexing
         getOptionValue(params.barcodeFile, parser, "b");
         if (loadBarcodes(seqan::toCString(params.barcodeFile), params) != 0)
             return 1;
+        if (params.approximate && params.maxDistance > 1 && !params.barcodes.empty() && params.barcodes[0].size() > HammingBarcodeMatcher::maxLength)
+        {
+            std::cerr << "ERROR: Barcodes longer than " << HammingBarcodeMatcher::maxLength << " bases can only be matched with a distance of 1.\n";
+            return 1;
+        }
     }
     return 0;
 }
@@ -679,6 +702,8 @@ int loadAdapterTrimmingParams(seqan::ArgumentParser const& parser, AdapterTrimmi
     getOptionValue(oh, parser, "oh");
     getOptionValue(times, parser, "times");
     getOptionValue(params.nler, parser, "nler");
+    getOptionValue(params.gapped, parser, "gapped");
+    getOptionValue(params.batch, parser, "batch");
     if (!isSet(parser, "topdown"))
         params.best = true;
     params.mode = AdapterMatchSettings(o, e, er, oh, times);
@@ -719,6 +744,11 @@ int loadAdapterTrimmingParams(seqan::ArgumentParser const& parser, AdapterTrimmi
             adapterItem.setSeq(tempSeq);
             seqan::appendValue(params.adapters, adapterItem);
         }
+        params.orientedAdapters.build(params.adapters);
+        if (params.nler)
+            params.adapterIndex.build(params.adapters, params.mode, ErrorRateMode::nonLinear());
+        else
+            params.adapterIndex.build(params.adapters, params.mode, ErrorRateMode::linear());
     }
     // If they are not given, but we would need them (single-end trimming), output error.
     else if ((isSet(parser, "pa") && fileCount == 1))
@@ -774,6 +804,46 @@ int openStream(seqan::CharString const & file, seqan::SeqFileIn & inFile)
     return 0;
 }
 
+bool hasExtension(seqan::CharString const & file, std::initializer_list<const char*> extensions)
+{
+    std::string fileName = seqan::toCString(file);
+    std::transform(fileName.begin(), fileName.end(), fileName.begin(), ::tolower);
+    for (const std::string extension : extensions)
+        if (fileName.size() >= extension.size() && fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0)
+            return true;
+    return false;
+}
+
+/*
+- uncompressed FASTQ is parsed straight from a memory mapping
+- gzip compressed FASTQ is inflated on ptc::sharedThreadPool(numThreads) (BGZF) or one pipelined thread (plain gzip)
+- reader stays empty for all other formats, these are read with SeqFileIn
+*/
+int openFastqReader(seqan::CharString const & file, std::unique_ptr<FastqBatchReader>& reader, unsigned int numThreads)
+{
+    if (hasExtension(file, { ".fq", ".fastq" }))
+    {
+        auto mappedReader = std::make_unique<MappedFastqReader>();
+        if (!mappedReader->open(seqan::toCString(file)))
+        {
+            std::cerr << "Error while mapping input file '" << file << "'.\n";
+            return 1;
+        }
+        reader = std::move(mappedReader);
+    }
+    else if (hasExtension(file, { ".fq.gz", ".fastq.gz" }))
+    {
+        auto inflatingReader = std::make_unique<InflatingFastqReader>();
+        if (!inflatingReader->open(seqan::toCString(file), ptc::sharedThreadPool(numThreads)))
+        {
+            std::cerr << "Error while opening input file '" << file << "'.\n";
+            return 1;
+        }
+        reader = std::move(inflatingReader);
+    }
+    return 0;
+}
+
 int loadProgramParams(seqan::ArgumentParser const & parser, ProgramParams& params, InputFileStreams& vars)
 {
     params.fileCount = getArgumentValueCount(parser, 0);
@@ -807,6 +877,14 @@ int loadProgramParams(seqan::ArgumentParser const & parser, ProgramParams& param
     getOptionValue(params.num_threads, parser, "tnum");
     omp_set_num_threads(params.num_threads);
 
+    // both files of a pair have the same format, so either both or none get a FASTQ reader
+    if (openFastqReader(fileName1, vars.fastqReader1, params.num_threads) != 0)
+        return 1;
+    if (params.fileCount == 2 && openFastqReader(fileName2, vars.fastqReader2, params.num_threads) != 0)
+        return 1;
+    if (params.fileCount == 2 && !vars.fastqReader2)
+        vars.fastqReader1.reset();
+
     getOptionValue(params.records, parser, "r");
     getOptionValue(params.ordered, parser, "od");
     return 0;
@@ -0,0 +1,219 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Compares the containers of ptc:
+// - raw insert/retrieve throughput with several producers and consumers
+// - a complete PTC_unit with a recycling source, a small transformer and a sink
+// - the PTC_unit with its transformer running on the shared thread pool
+// - the same work split into a pipeline of three stages
+// usage: benchmark_ptc [numThreads] [numItems]
+// ==========================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ptc.h"
+#include "pipeline.h"
+
+using Item = std::vector<unsigned int>;
+const unsigned int batchSize = 64;    // values per item of the PTC_unit benchmark
+
+template <typename TContainer>
+double containerThroughput(const unsigned int numThreads, const unsigned int numItems, const std::string& name)
+{
+    // the items are only borrowed by the container, they are released again by the consumers
+    std::vector<unsigned int> items(numItems);
+    std::iota(items.begin(), items.end(), 0);
+    TContainer container(numThreads * 2);
+    std::atomic<unsigned int> nextItem(0);
+    std::atomic<unsigned int> retrieved(0);
+    std::atomic<unsigned long long> sum(0);
+
+    const auto t1 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&]() {
+            unsigned int i;
+            while ((i = nextItem.fetch_add(1, std::memory_order_relaxed)) < numItems)
+            {
+                std::unique_ptr<unsigned int> item(&items[i]);
+                while (!container.try_insert(item))
+                    std::this_thread::yield();
+            }
+        });
+        threads.emplace_back([&]() {
+            std::unique_ptr<unsigned int> item;
+            unsigned long long localSum = 0;
+            while (retrieved.load(std::memory_order_relaxed) < numItems)
+            {
+                if (container.try_retrieve(item))
+                {
+                    localSum += *item;
+                    item.release();
+                    retrieved.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                    std::this_thread::yield();
+            }
+            sum += localSum;
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+    const bool correct = sum.load() == static_cast<unsigned long long>(numItems) * (numItems - 1) / 2;
+    std::cout << "  " << name << ": " << static_cast<unsigned int>(numItems / seconds) << " items/s" << (correct ? "" : "  WRONG RESULT") << std::endl;
+    return seconds;
+}
+
+template <typename TPtcFactory>
+void ptcThroughput(const unsigned int numThreads, const unsigned int numItems, const std::string& name, TPtcFactory factory)
+{
+    unsigned int produced = 0;
+    auto source = [&produced, numItems](std::unique_ptr<Item>&& usedItem) {
+        auto item = std::move(usedItem);
+        if (produced >= numItems)
+            return std::unique_ptr<Item>();
+        if (item == nullptr)
+            item = std::make_unique<Item>(batchSize);
+        for (auto& value : *item)
+            value = produced++;
+        return item;
+    };
+    auto transformer = [](std::unique_ptr<Item> item) {
+        for (auto& value : *item)
+            value = value * 2 + 1;
+        return item;
+    };
+    struct Sink
+    {
+        unsigned long long sum = 0;
+        unsigned int lastFirst = 0;
+        bool ordered = true;
+        std::unique_ptr<Item> operator()(std::unique_ptr<Item> item)
+        {
+            if (item->front() < lastFirst)
+                ordered = false;
+            lastFirst = item->front();
+            for (const auto value : *item)
+                sum += value;
+            return item;
+        }
+        bool get_result() const noexcept
+        {
+            return ordered;
+        }
+    } sink;
+
+    const auto t1 = std::chrono::steady_clock::now();
+    auto ptc_unit = factory(source, transformer, sink, numThreads);
+    ptc_unit->start();
+    auto f = ptc_unit->get_future();
+    const bool ordered = f.get();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+    const unsigned long long n = (numItems + batchSize - 1) / batchSize * batchSize;
+    const bool correct = sink.sum == n * n;
+    std::cout << "  " << name << ": " << static_cast<unsigned int>(n / batchSize / seconds) << " batches/s"
+        << (ordered ? "  (ordered)" : "") << (correct ? "" : "  WRONG RESULT") << std::endl;
+}
+
+void pipelineThroughput(const unsigned int numThreads, const unsigned int numItems, const std::string& name, const ptc::StageOrder order)
+{
+    unsigned int produced = 0;
+    unsigned long long sum = 0;
+    unsigned int lastFirst = 0;
+    bool ordered = true;
+    const auto t1 = std::chrono::steady_clock::now();
+    ptc::make_pipeline([&produced, numItems]() {
+            if (produced >= numItems)
+                return std::unique_ptr<Item>();
+            auto item = std::make_unique<Item>(batchSize);
+            for (auto& value : *item)
+                value = produced++;
+            return item;
+        })
+        .then(ptc::parallel(numThreads, order), [](std::unique_ptr<Item> item) {
+            for (auto& value : *item)
+                value = value * 2;
+            return item;
+        })
+        .then(ptc::parallel(numThreads, order), [](std::unique_ptr<Item> item) {
+            for (auto& value : *item)
+                value = value + 1;
+            return item;
+        })
+        .then(ptc::serial(), [&](std::unique_ptr<Item> item) {
+            if (item->front() < lastFirst)
+                ordered = false;
+            lastFirst = item->front();
+            for (const auto value : *item)
+                sum += value;
+        })
+        .run();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+    const unsigned long long n = (numItems + batchSize - 1) / batchSize * batchSize;
+    const bool correct = sum == n * n;
+    std::cout << "  " << name << ": " << static_cast<unsigned int>(n / batchSize / seconds) << " batches/s"
+        << (ordered ? "  (ordered)" : "") << (correct ? "" : "  WRONG RESULT") << std::endl;
+}
+
+int main(int argc, char const ** argv)
+{
+    const unsigned int numThreads = argc > 1 ? std::stoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    const unsigned int numItems = argc > 2 ? std::stoi(argv[2]) : 4000000;
+
+    using namespace ptc;
+    std::cout << "container throughput, " << numThreads << " producers and " << numThreads << " consumers" << std::endl;
+    containerThroughput<Slots<unsigned int, InputPolicy::multi, OutputPolicy::multi, WaitPolicy::Spin, BlockingInsert::no, BlockingRetrieve::no>>(numThreads, numItems, "Slots        ");
+    containerThroughput<LockfreeQueue<unsigned int, WaitPolicy::Spin, BlockingInsert::no, BlockingRetrieve::no>>(numThreads, numItems, "LockfreeQueue");
+    containerThroughput<RingBuffer<unsigned int, InputPolicy::multi, OutputPolicy::multi, WaitPolicy::Spin, BlockingInsert::no, BlockingRetrieve::no>>(numThreads, numItems, "RingBuffer   ");
+
+    std::cout << "PTC_unit throughput, " << numThreads << " transformer threads" << std::endl;
+    const auto make = [](auto orderPolicy, auto containerPolicy, auto waitPolicy) {
+        return [](auto& source, const auto& transformer, auto& sink, const unsigned int n) {
+            using TSource = std::remove_reference_t<decltype(source)>&;
+            using TTransformer = std::remove_cv_t<std::remove_reference_t<decltype(transformer)>>;
+            using TSink = std::remove_reference_t<decltype(sink)>&;
+            return std::make_unique<PTC_unit<TSource, TTransformer, TSink, decltype(orderPolicy), decltype(waitPolicy), decltype(containerPolicy)>>
+                (source, transformer, sink, n);
+        };
+    };
+    ptcThroughput(numThreads, numItems, "unordered, Slots        ", make(OrderPolicy::Unordered(), ContainerPolicy::Default(), WaitPolicy::Semaphore()));
+    ptcThroughput(numThreads, numItems, "unordered, LockfreeQueue", make(OrderPolicy::Unordered_use_queue(), ContainerPolicy::Default(), WaitPolicy::Semaphore()));
+    ptcThroughput(numThreads, numItems, "unordered, RingBuffer   ", make(OrderPolicy::Unordered(), ContainerPolicy::RingBuffer(), WaitPolicy::Semaphore()));
+    ptcThroughput(numThreads, numItems, "ordered, LockfreeQueue  ", make(OrderPolicy::Ordered(), ContainerPolicy::Default(), WaitPolicy::Semaphore()));
+    ptcThroughput(numThreads, numItems, "ordered, RingBuffer     ", make(OrderPolicy::Ordered(), ContainerPolicy::RingBuffer(), WaitPolicy::Semaphore()));
+
+    std::cout << "PTC_unit throughput with WaitPolicy::Futex, " << numThreads << " transformer threads" << std::endl;
+    ptcThroughput(numThreads, numItems, "unordered, Slots        ", make(OrderPolicy::Unordered(), ContainerPolicy::Default(), WaitPolicy::Futex()));
+    ptcThroughput(numThreads, numItems, "unordered, RingBuffer   ", make(OrderPolicy::Unordered(), ContainerPolicy::RingBuffer(), WaitPolicy::Futex()));
+    ptcThroughput(numThreads, numItems, "ordered, LockfreeQueue  ", make(OrderPolicy::Ordered(), ContainerPolicy::Default(), WaitPolicy::Futex()));
+    ptcThroughput(numThreads, numItems, "ordered, RingBuffer     ", make(OrderPolicy::Ordered(), ContainerPolicy::RingBuffer(), WaitPolicy::Futex()));
+
+    std::cout << "PTC_unit throughput on a shared pool of " << numThreads << " threads" << std::endl;
+    const auto makePooled = [](auto orderPolicy) {
+        return [](auto& source, const auto& transformer, auto& sink, const unsigned int n) {
+            using TSource = std::remove_reference_t<decltype(source)>&;
+            using TTransformer = std::remove_cv_t<std::remove_reference_t<decltype(transformer)>>;
+            using TSink = std::remove_reference_t<decltype(sink)>&;
+            return std::make_unique<PTC_unit<TSource, TTransformer, TSink, decltype(orderPolicy), DefaultWaitPolicy>>
+                (source, transformer, sink, sharedThreadPool(n));
+        };
+    };
+    ptcThroughput(numThreads, numItems, "unordered, Slots        ", makePooled(OrderPolicy::Unordered()));
+    ptcThroughput(numThreads, numItems, "ordered, ReorderRing    ", makePooled(OrderPolicy::Ordered()));
+
+    std::cout << "pipeline throughput, 2 stages with " << numThreads << " threads each" << std::endl;
+    pipelineThroughput(numThreads, numItems, "unordered               ", StageOrder::unordered);
+    pipelineThroughput(numThreads, numItems, "ordered                 ", StageOrder::ordered);
+    const WaitStats waits = waitStats();
+    std::cout << "  waits: " << waits.spinWaits << " ended spinning (" << waits.spinIterations << " spin iterations), "
+        << waits.sleepWaits << " slept for " << waits.sleepTime << " seconds" << std::endl;
+    return 0;
+}
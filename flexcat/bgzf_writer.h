@@ -0,0 +1,263 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ptc.h"
+
+class BgzfWriter;
+
+/*
+- deflates BGZF blocks for any number of BgzfWriters, every job is a task of a ptc::ThreadPool
+- shared by all output files, so the number of threads does not grow with the number of barcodes
+- submit() blocks while too many jobs are in flight, this bounds the memory usage, while it waits the caller runs pool tasks
+- the deflate streams are kept for the next jobs, there are at most as many as jobs run at the same time
+*/
+class BgzfCompressionPool
+{
+public:
+    struct Job
+    {
+        BgzfWriter* writer;
+        unsigned int id;
+        std::vector<char> data;
+    };
+
+private:
+    ptc::ThreadPool& _pool;
+    std::mutex _mutex;
+    std::condition_variable _spaceAvailable;
+    unsigned int _inFlight;
+    const unsigned int _maxInFlight;
+    std::vector<std::unique_ptr<z_stream>> _streams;    // idle
+
+    BgzfCompressionPool(const BgzfCompressionPool&) = delete;
+    BgzfCompressionPool& operator=(const BgzfCompressionPool&) = delete;
+
+    inline void compressJob(Job& job);
+
+public:
+    BgzfCompressionPool(ptc::ThreadPool& pool) : _pool(pool), _inFlight(0), _maxInFlight(4 * pool.size()) {};
+
+    // the tasks use the compression pool until they return
+    ~BgzfCompressionPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _spaceAvailable.wait(lock, [this]() {return _inFlight == 0; });
+        }
+        for (auto& stream : _streams)
+            deflateEnd(stream.get());
+    }
+
+    void submit(Job&& job)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_inFlight >= _maxInFlight)
+            {
+                lock.unlock();
+                const bool ranTask = _pool.tryRunTask();
+                lock.lock();
+                if (!ranTask)
+                    _spaceAvailable.wait(lock, [this]() {return _inFlight < _maxInFlight; });
+            }
+            ++_inFlight;
+        }
+        _pool.submit([this, job = std::move(job)]() mutable
+        {
+            compressJob(job);
+        });
+    }
+};
+
+/*
+- writes a BGZF file, the output is readable by every gzip decompressor and by GzipDecompressor in parallel
+- data is collected into jobs of several blocks which are deflated by the pool
+- the thread that completes the next job in file order appends all consecutive finished jobs, so no writer thread is needed
+*/
+class BgzfWriter
+{
+public:
+    static const unsigned int blockDataSize = 0xff00;     // input bytes per block, the deflated block always fits into 64 KiB
+    static const unsigned int blocksPerJob = 16;
+
+private:
+    BgzfCompressionPool& _pool;
+    std::FILE* _file;
+    std::vector<char> _buffer;
+    unsigned int _nextJob;
+
+    std::mutex _mutex;
+    std::condition_variable _written;
+    std::map<unsigned int, std::vector<unsigned char>> _finished;
+    unsigned int _nextWrite;
+    bool _failed;
+
+    BgzfWriter(const BgzfWriter&) = delete;
+    BgzfWriter& operator=(const BgzfWriter&) = delete;
+
+    static void writeUInt16(unsigned char* p, const unsigned int value) noexcept
+    {
+        p[0] = value & 0xff;
+        p[1] = (value >> 8) & 0xff;
+    }
+    static void writeUInt32(unsigned char* p, const unsigned int value) noexcept
+    {
+        writeUInt16(p, value & 0xffff);
+        writeUInt16(p + 2, value >> 16);
+    }
+
+    void flushJob()
+    {
+        if (_buffer.empty())
+            return;
+        _pool.submit(BgzfCompressionPool::Job{ this, _nextJob++, std::move(_buffer) });
+        _buffer = std::vector<char>();
+        _buffer.reserve(blockDataSize * blocksPerJob);
+    }
+
+public:
+    BgzfWriter(BgzfCompressionPool& pool) : _pool(pool), _file(nullptr), _nextJob(0), _nextWrite(0), _failed(false) {};
+
+    ~BgzfWriter()
+    {
+        close();
+    }
+
+    bool open(const char* path)
+    {
+        _file = std::fopen(path, "wb");
+        _buffer.reserve(blockDataSize * blocksPerJob);
+        return _file != nullptr;
+    }
+
+    inline void write(const char* data, size_t size)
+    {
+        if (_failed)
+            throw std::runtime_error("Error while writing BGZF file.");
+        while (size > 0)
+        {
+            const size_t n = std::min(size, blockDataSize * blocksPerJob - _buffer.size());
+            _buffer.insert(_buffer.end(), data, data + n);
+            data += n;
+            size -= n;
+            if (_buffer.size() == blockDataSize * blocksPerJob)
+                flushJob();
+        }
+    }
+
+    /*
+    - waits for all jobs and appends the BGZF end-of-file marker
+    - returns false if a job could not be compressed or the file could not be written completely
+    */
+    bool close()
+    {
+        if (_file == nullptr)
+            return !_failed;
+        flushJob();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _written.wait(lock, [this]() {return _nextWrite == _nextJob; });
+        }
+        static const unsigned char eofBlock[28] = { 0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        if (!_failed && std::fwrite(eofBlock, 1, sizeof(eofBlock), _file) != sizeof(eofBlock))
+            _failed = true;
+        if (std::fclose(_file) != 0)
+            _failed = true;
+        _file = nullptr;
+        return !_failed;
+    }
+
+    // deflates data into consecutive BGZF blocks, called by the pool
+    static bool compress(z_stream& stream, const std::vector<char>& data, std::vector<unsigned char>& out)
+    {
+        const unsigned int maxBlockSize = 65536;
+        out.resize(((data.size() + blockDataSize - 1) / blockDataSize) * maxBlockSize);
+        size_t outPos = 0;
+        for (size_t pos = 0; pos < data.size(); pos += blockDataSize)
+        {
+            const unsigned int inSize = static_cast<unsigned int>(std::min<size_t>(blockDataSize, data.size() - pos));
+            unsigned char* block = &out[outPos];
+            static const unsigned char header[16] = { 0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0 };
+            std::memcpy(block, header, sizeof(header));
+            if (deflateReset(&stream) != Z_OK)
+                return false;
+            stream.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(data.data() + pos));
+            stream.avail_in = inSize;
+            stream.next_out = block + 18;
+            stream.avail_out = maxBlockSize - 18 - 8;
+            if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+                return false;
+            const unsigned int blockSize = 18 + static_cast<unsigned int>(stream.total_out) + 8;
+            writeUInt16(block + 16, blockSize - 1);
+            const unsigned int crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const unsigned char*>(data.data() + pos), inSize);
+            writeUInt32(block + blockSize - 8, crc);
+            writeUInt32(block + blockSize - 4, inSize);
+            outPos += blockSize;
+        }
+        out.resize(outPos);
+        return true;
+    }
+
+    /*
+    - called by the pool when job id is deflated, appends all finished jobs that are next in file order
+    - the output of a failed job is incomplete, after a failure nothing is written anymore, the file is broken anyway
+    */
+    void jobFinished(const unsigned int id, std::vector<unsigned char>&& out, const bool success)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _failed |= !success;
+        _finished.emplace(id, std::move(out));
+        for (auto it = _finished.find(_nextWrite); it != _finished.end(); it = _finished.find(_nextWrite))
+        {
+            if (!_failed && std::fwrite(it->second.data(), 1, it->second.size(), _file) != it->second.size())
+                _failed = true;
+            _finished.erase(it);
+            ++_nextWrite;
+        }
+        _written.notify_all();
+    }
+};
+
+inline void BgzfCompressionPool::compressJob(Job& job)
+{
+    std::unique_ptr<z_stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_streams.empty())
+        {
+            stream = std::move(_streams.back());
+            _streams.pop_back();
+        }
+    }
+    bool initialized = true;
+    if (!stream)
+    {
+        stream = std::make_unique<z_stream>();
+        std::memset(stream.get(), 0, sizeof(z_stream));
+        initialized = deflateInit2(stream.get(), Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    std::vector<unsigned char> out;
+    const bool success = initialized && BgzfWriter::compress(*stream, job.data, out);
+    job.writer->jobFinished(job.id, std::move(out), success);
+    // under the lock, the compression pool can be destroyed as soon as the last job is finished
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (initialized)
+        _streams.push_back(std::move(stream));
+    --_inFlight;
+    _spaceAvailable.notify_all();
+}
@@ -0,0 +1,126 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// instruction sets for which flexcat contains SIMD kernels
+enum class SimdLevel
+{
+    sse42,
+    avx2,
+    avx512bw
+};
+
+namespace cpu_features
+{
+    // registers of cpuid leaf, subleaf
+    inline void cpuid(const unsigned int leaf, const unsigned int subleaf, unsigned int registers[4]) noexcept
+    {
+#ifdef _MSC_VER
+        int cpuInfo[4];
+        __cpuidex(cpuInfo, leaf, subleaf);
+        for (unsigned int i = 0; i < 4; ++i)
+            registers[i] = static_cast<unsigned int>(cpuInfo[i]);
+#else
+        registers[0] = registers[1] = registers[2] = registers[3] = 0;
+        if (static_cast<unsigned int>(__get_cpuid_max(0, nullptr)) >= leaf)
+            __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    }
+
+    // register states that the operating system saves on context switches, a CPU feature is useless without them
+    inline unsigned long long enabledRegisterStates() noexcept
+    {
+        unsigned int registers[4];
+        cpuid(1, 0, registers);
+        const unsigned int osxsaveBit = 1 << 27;
+        if ((registers[2] & osxsaveBit) == 0)
+            return 0;
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+    }
+}
+
+inline bool is_avx2_supported(void)
+{
+    const unsigned long long xmmYmmState = 0x06;
+    if ((cpu_features::enabledRegisterStates() & xmmYmmState) != xmmYmmState)
+        return false;
+    unsigned int registers[4];
+    cpu_features::cpuid(7, 0, registers);
+    const unsigned int avx2Bit = 1 << 5;
+    return (registers[1] & avx2Bit) != 0;
+}
+
+inline bool is_avx512bw_supported(void)
+{
+    const unsigned long long xmmYmmZmmState = 0xe6;
+    if ((cpu_features::enabledRegisterStates() & xmmYmmZmmState) != xmmYmmZmmState)
+        return false;
+    unsigned int registers[4];
+    cpu_features::cpuid(7, 0, registers);
+    const unsigned int avx512fBit = 1 << 16;
+    const unsigned int avx512bwBit = 1u << 30;
+    return (registers[1] & avx512fBit) != 0 && (registers[1] & avx512bwBit) != 0;
+}
+
+// widest instruction set of this CPU, detected once
+inline SimdLevel getSupportedSimdLevel() noexcept
+{
+    static const SimdLevel simdLevel = is_avx512bw_supported() ? SimdLevel::avx512bw : (is_avx2_supported() ? SimdLevel::avx2 : SimdLevel::sse42);
+    return simdLevel;
+}
+
+namespace cpu_features
+{
+    inline SimdLevel& selectedSimdLevel() noexcept
+    {
+        static SimdLevel simdLevel = getSupportedSimdLevel();
+        return simdLevel;
+    }
+}
+
+// instruction set of the kernels, the widest one of this CPU unless setSimdLevel() selected another
+inline SimdLevel getSimdLevel() noexcept
+{
+    return cpu_features::selectedSimdLevel();
+}
+
+/*
+- forces the kernels of simdLevel, used by the tests to compare the kernels of all instruction sets
+- returns false and keeps the current level if this CPU does not support simdLevel
+- not synchronized, call it while no alignment is running, a TransposedReadBatch has to be cleared afterwards
+*/
+inline bool setSimdLevel(const SimdLevel simdLevel) noexcept
+{
+    if (simdLevel > getSupportedSimdLevel())
+        return false;
+    cpu_features::selectedSimdLevel() = simdLevel;
+    return true;
+}
+
+inline const char* toString(const SimdLevel simdLevel) noexcept
+{
+    switch (simdLevel)
+    {
+    case SimdLevel::avx512bw:
+        return "AVX-512BW";
+    case SimdLevel::avx2:
+        return "AVX2";
+    default:
+        return "SSE4.2";
+    }
+}
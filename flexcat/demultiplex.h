@@ -41,6 +41,8 @@
 #include <seqan/sequence.h>
 #include <seqan/index.h>
 #include <seqan/seq_io.h>
+#include <numeric>
+#include <nmmintrin.h>
 
 #include "helper_functions.h"
 #include "general_stats.h"
@@ -57,6 +59,7 @@ struct DemultiplexingParams
 	std::vector<std::string> barcodeIds;
 	std::string multiplexFile;
 	bool approximate;
+	unsigned int maxDistance;
 	bool hardClip;
 	bool run;
 	bool runx;
@@ -64,6 +67,7 @@ struct DemultiplexingParams
 
 	DemultiplexingParams() :
 		approximate(false),
+		maxDistance(1),
 		hardClip(false),
 		run(false),
 		runx(false),
@@ -71,6 +75,9 @@ struct DemultiplexingParams
 	{};
 };
 
+// returned by getMatchIndex if the read is equally close to more than one barcode
+const int AMBIGUOUS_BARCODE = -2;
+
 // ============================================================================
 // Objects
 // ============================================================================
@@ -107,20 +114,370 @@ struct BarcodeMatcher
     {
         return _barcodeLength;
     }
+    inline unsigned int getNumBarcodes() const noexcept
+    {
+        return _patterns.size();
+    }
 private:
     const std::vector<std::string> _patterns;
     unsigned int _barcodeLength;
 };
 
+/*
+- looks up the 2-bit encoded barcode of a read in an open addressed hash table
+- in approximate mode the table also holds every variant with one substitution, including N
+- variants of different barcodes with the same distance are ambiguous, getMatchIndex returns AMBIGUOUS_BARCODE for them
+- barcodes longer than maxLength or containing N are matched with a linear scan over the variants
+*/
+class HashBarcodeMatcher
+{
+public:
+    static const unsigned int maxLength = 28;
+
+    HashBarcodeMatcher(const std::vector<std::string>& barcodes, const bool approximate)
+        : _barcodeLength(0), _numBarcodes(barcodes.size()), _variationsPerBarcode(1), _ambiguousVariants(0), _mask(0)
+    {
+        if (barcodes.empty())
+            return;
+        _barcodeLength = barcodes[0].size();
+        bool encodable = _barcodeLength <= maxLength;
+        for (const auto& barcode : barcodes)
+        {
+            assert(barcode.size() == _barcodeLength);
+            for (const char c : barcode)
+                encodable &= seqan::ordValue(seqan::Dna5(c)) < 4;
+        }
+        if (!encodable)
+        {
+            _patterns = barcodes;
+            if (approximate)
+            {
+                buildAllVariations(_patterns);
+                _variationsPerBarcode = _barcodeLength * 5;
+            }
+            return;
+        }
+
+        const unsigned int numEntries = _numBarcodes * (approximate ? _barcodeLength * 4 + 1 : 1);
+        unsigned int capacity = 16;
+        while (capacity < numEntries * 2)
+            capacity *= 2;
+        _mask = capacity - 1;
+        _table.assign(capacity, Entry());
+
+        int index = 0;
+        for (const auto& barcode : barcodes)
+        {
+            uint64_t key = 0;
+            for (unsigned int k = 0; k < _barcodeLength; ++k)
+                key |= static_cast<uint64_t>(seqan::ordValue(seqan::Dna5(barcode[k]))) << (2 * k);
+            insert(key, index, 0);
+            if (approximate)
+            {
+                for (unsigned int k = 0; k < _barcodeLength; ++k)
+                {
+                    const uint64_t cleared = key & ~(uint64_t(3) << (2 * k));
+                    for (uint64_t base = 0; base < 4; ++base)
+                    {
+                        const uint64_t variant = cleared | (base << (2 * k));
+                        if (variant != key)
+                            insert(variant, index, 1);
+                    }
+                    insert(cleared | nPosition(k), index, 1);
+                }
+            }
+            ++index;
+        }
+        for (const auto& entry : _table)
+            _ambiguousVariants += entry.index == ambiguous;
+    }
+
+    template <template <typename> class TRead, typename TSeq>
+    int getMatchIndex(const TRead<TSeq>& read) const noexcept
+    {
+        if (!_patterns.empty())
+            return getMatchIndexLinear(read);
+        if (_table.empty())
+            return -1;
+        const auto& seq = getBarcodeSeq(read);
+        if (length(seq) < _barcodeLength || (IsMultiplexRead<TRead<TSeq>>::value && length(seq) != _barcodeLength))
+            return -1;
+
+        // N is encoded as A and its position is stored above the bases, a second N can not match
+        uint64_t key = 0;
+        uint64_t nKey = 0;
+        for (unsigned int k = 0; k < _barcodeLength; ++k)
+        {
+            const uint64_t base = seqan::ordValue(seqan::Dna5(seq[k]));
+            if (base == 4)
+            {
+                if (nKey != 0)
+                    return -1;
+                nKey = nPosition(k);
+                continue;
+            }
+            key |= base << (2 * k);
+        }
+        key |= nKey;
+
+        for (uint64_t slot = hash(key);; slot = (slot + 1) & _mask)
+        {
+            const Entry& entry = _table[slot];
+            if (entry.key == key)
+                return entry.index == ambiguous ? AMBIGUOUS_BARCODE : entry.index;
+            if (entry.key == emptyKey)
+                return -1;
+        }
+    }
+    inline unsigned int getBarcodeLength() const noexcept
+    {
+        return _barcodeLength;
+    }
+    inline unsigned int getNumBarcodes() const noexcept
+    {
+        return _numBarcodes;
+    }
+    // number of variants that are shared by more than one barcode with the same distance
+    inline unsigned int getAmbiguousVariants() const noexcept
+    {
+        return _ambiguousVariants;
+    }
+
+private:
+    static const uint64_t emptyKey = ~uint64_t(0);
+    static const int ambiguous = -2;
+
+    struct Entry
+    {
+        uint64_t key;
+        int index;
+        unsigned int distance;
+
+        Entry() : key(emptyKey), index(-1), distance(0) {};
+    };
+
+    std::vector<Entry> _table;
+    std::vector<std::string> _patterns;
+    unsigned int _barcodeLength;
+    unsigned int _numBarcodes;
+    unsigned int _variationsPerBarcode;
+    unsigned int _ambiguousVariants;
+    uint64_t _mask;
+
+    inline uint64_t nPosition(const unsigned int pos) const noexcept
+    {
+        return static_cast<uint64_t>(pos + 1) << (2 * _barcodeLength);
+    }
+    inline uint64_t hash(const uint64_t key) const noexcept
+    {
+        return ((key * 0x9E3779B97F4A7C15ull) >> 32) & _mask;
+    }
+
+    // the variant with the smaller distance wins, equal distances of different barcodes are ambiguous
+    void insert(const uint64_t key, const int index, const unsigned int distance) noexcept
+    {
+        for (uint64_t slot = hash(key);; slot = (slot + 1) & _mask)
+        {
+            Entry& entry = _table[slot];
+            if (entry.key == emptyKey)
+            {
+                entry.key = key;
+                entry.index = index;
+                entry.distance = distance;
+                return;
+            }
+            if (entry.key != key)
+                continue;
+            if (distance < entry.distance)
+            {
+                entry.index = index;
+                entry.distance = distance;
+            }
+            else if (distance == entry.distance && entry.index != index)
+                entry.index = ambiguous;
+            return;
+        }
+    }
+
+    template <template <typename> class TRead, typename TSeq>
+    int getMatchIndexLinear(const TRead<TSeq>& read) const noexcept
+    {
+        int index = 0;
+        const std::string prefix = getPrefix(read, _barcodeLength);
+        for (const auto& pattern : _patterns)
+        {
+            if (pattern == prefix)
+                return index / _variationsPerBarcode;
+            ++index;
+        }
+        return -1;
+    }
+};
+
+/*
+- matches barcodes with up to maxDistance substitutions, N in the read always counts as substitution
+- pigeonhole index: the barcodes are split into maxDistance + 1 segments, a read within maxDistance
+  matches at least one segment exactly
+- the candidates of all segments are verified with a SIMD hamming distance
+- a read with the same smallest distance to more than one barcode is AMBIGUOUS_BARCODE
+*/
+class HammingBarcodeMatcher
+{
+public:
+    static const unsigned int maxLength = 64;
+
+    HammingBarcodeMatcher(const std::vector<std::string>& barcodes, const unsigned int maxDistance)
+        : _barcodeLength(0), _numBarcodes(barcodes.size()), _maxDistance(maxDistance), _stride(0), _bucketMask(0)
+    {
+        if (barcodes.empty())
+            return;
+        _barcodeLength = barcodes[0].size();
+        assert(_barcodeLength <= maxLength);
+        _stride = (_barcodeLength + 15) & ~15u;
+        _barcodes.assign(_numBarcodes * _stride, 0);
+        for (unsigned int i = 0; i < _numBarcodes; ++i)
+        {
+            assert(barcodes[i].size() == _barcodeLength);
+            for (unsigned int k = 0; k < _barcodeLength; ++k)
+                _barcodes[i * _stride + k] = seqan::ordValue(seqan::Dna5(barcodes[i][k]));
+        }
+
+        // with more segments than bases, empty segments make every barcode a candidate
+        const unsigned int numSegments = _maxDistance + 1;
+        _segmentBegin.resize(numSegments + 1);
+        for (unsigned int segment = 0; segment <= numSegments; ++segment)
+            _segmentBegin[segment] = segment * _barcodeLength / numSegments;
+
+        // one bucket list per segment, barcodes with the same segment hash are stored consecutively
+        unsigned int numBuckets = 16;
+        while (numBuckets < _numBarcodes * 2)
+            numBuckets *= 2;
+        _bucketMask = numBuckets - 1;
+        _segments.resize(numSegments);
+        std::vector<unsigned int> buckets(_numBarcodes);
+        for (unsigned int segment = 0; segment < numSegments; ++segment)
+        {
+            auto& index = _segments[segment];
+            index.bucketBegin.assign(numBuckets + 1, 0);
+            for (unsigned int i = 0; i < _numBarcodes; ++i)
+            {
+                buckets[i] = bucket(segmentKey(&_barcodes[i * _stride], segment));
+                ++index.bucketBegin[buckets[i] + 1];
+            }
+            std::partial_sum(index.bucketBegin.begin(), index.bucketBegin.end(), index.bucketBegin.begin());
+            index.barcodes.resize(_numBarcodes);
+            std::vector<unsigned int> fill(index.bucketBegin.begin(), index.bucketBegin.end() - 1);
+            for (unsigned int i = 0; i < _numBarcodes; ++i)
+                index.barcodes[fill[buckets[i]]++] = i;
+        }
+    }
+
+    template <template <typename> class TRead, typename TSeq>
+    int getMatchIndex(const TRead<TSeq>& read) const noexcept
+    {
+        if (_numBarcodes == 0)
+            return -1;
+        const auto& seq = getBarcodeSeq(read);
+        if (length(seq) < _barcodeLength || (IsMultiplexRead<TRead<TSeq>>::value && length(seq) != _barcodeLength))
+            return -1;
+
+        alignas(16) unsigned char bases[maxLength] = {};
+        for (unsigned int k = 0; k < _barcodeLength; ++k)
+        {
+            const unsigned char base = seqan::ordValue(seqan::Dna5(seq[k]));
+            bases[k] = base == readN ? readNValue : base;
+        }
+
+        int best = -1;
+        unsigned int bestDistance = _maxDistance + 1;
+        bool tie = false;
+        for (unsigned int segment = 0; segment < _segments.size(); ++segment)
+        {
+            const auto& index = _segments[segment];
+            const unsigned int b = bucket(segmentKey(bases, segment));
+            // a barcode that matches several segments is verified again, but can not tie with itself
+            for (unsigned int i = index.bucketBegin[b]; i < index.bucketBegin[b + 1]; ++i)
+            {
+                const int candidate = index.barcodes[i];
+                const unsigned int distance = hammingDistance(bases, &_barcodes[candidate * _stride]);
+                if (distance > _maxDistance)
+                    continue;
+                if (distance < bestDistance)
+                {
+                    best = candidate;
+                    bestDistance = distance;
+                    tie = false;
+                }
+                else if (distance == bestDistance && candidate != best)
+                    tie = true;
+            }
+        }
+        return tie ? AMBIGUOUS_BARCODE : best;
+    }
+    inline unsigned int getBarcodeLength() const noexcept
+    {
+        return _barcodeLength;
+    }
+    inline unsigned int getNumBarcodes() const noexcept
+    {
+        return _numBarcodes;
+    }
+
+private:
+    // N in the read is replaced by a value that never occurs in a barcode, so it is a mismatch even against N in a barcode
+    static const unsigned char readN = 4;
+    static const unsigned char readNValue = 0xff;
+
+    struct SegmentIndex
+    {
+        std::vector<unsigned int> bucketBegin;
+        std::vector<unsigned int> barcodes;
+    };
+
+    std::vector<unsigned char> _barcodes;   // ordValues, every barcode padded with zeros to _stride
+    std::vector<SegmentIndex> _segments;
+    std::vector<unsigned int> _segmentBegin;
+    unsigned int _barcodeLength;
+    unsigned int _numBarcodes;
+    unsigned int _maxDistance;
+    unsigned int _stride;
+    unsigned int _bucketMask;
+
+    inline uint64_t segmentKey(const unsigned char* bases, const unsigned int segment) const noexcept
+    {
+        uint64_t key = 0;
+        for (unsigned int k = _segmentBegin[segment]; k < _segmentBegin[segment + 1]; ++k)
+            key = key * 5 + bases[k];
+        return key;
+    }
+    // collisions only produce more candidates, the hamming distance rejects them
+    inline unsigned int bucket(const uint64_t key) const noexcept
+    {
+        return ((key * 0x9E3779B97F4A7C15ull) >> 32) & _bucketMask;
+    }
+    // both sequences are padded with zeros, the padding always matches
+    inline unsigned int hammingDistance(const unsigned char* read, const unsigned char* barcode) const noexcept
+    {
+        unsigned int distance = 0;
+        for (unsigned int k = 0; k < _stride; k += 16)
+        {
+            const __m128i equal = _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(read + k)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(barcode + k)));
+            distance += 16 - _mm_popcnt_u32(_mm_movemask_epi8(equal));
+        }
+        return distance;
+    }
+};
+
 // ============================================================================
 // Functions
 // ============================================================================
 
-// checks if all barcodes have the same length and removes reads that are shorter than the barcodes
-template <typename TReads, typename TBarcodes, typename TStats>
-bool check(TReads& reads, TBarcodes& barcodes, TStats& stats) noexcept
+// checks if all barcodes have the same length
+template <typename TBarcodes>
+bool checkBarcodes(const TBarcodes& barcodes) noexcept
 {
-    unsigned len = length(barcodes[0]);
+    const unsigned len = length(barcodes[0]);
     for (const auto& barcode : barcodes)
     {
         if (len != length(barcode))
@@ -129,6 +486,16 @@ bool check(TReads& reads, TBarcodes& barcodes, TStats& stats) noexcept
             return false;
         }
     }
+    return true;
+}
+
+// checks if all barcodes have the same length and removes reads that are shorter than the barcodes
+template <typename TReads, typename TBarcodes, typename TStats>
+bool check(TReads& reads, TBarcodes& barcodes, TStats& stats) noexcept
+{
+    if (!checkBarcodes(barcodes))
+        return false;
+    const unsigned len = length(barcodes[0]);
     auto it = std::remove_if(reads.begin(), reads.end(), [len](auto& read) {return length(read.seq) <= len;});
     stats.removedShort += std::distance(it, reads.end());
     reads.erase(it, reads.end());
@@ -168,8 +535,8 @@ void buildAllVariations(TBarcodes& barcodes)
 }
 
 // only used for testing
-template <template <typename> class TRead, typename TSeq, typename TBarcodeFinder>
-void MatchBarcodes(std::vector<TRead<TSeq>>& reads, const TBarcodeFinder& finder) noexcept
+template <template <typename> class TRead, typename TSeq, typename TAlloc, typename TBarcodeFinder>
+void MatchBarcodes(std::vector<TRead<TSeq>, TAlloc>& reads, const TBarcodeFinder& finder) noexcept
 {
     std::for_each(reads.begin(), reads.end(), [&finder](auto& read){
         read.demuxResult = finder.getMatchIndex(read);});
@@ -180,38 +547,55 @@ struct ApproximateBarcodeMatching {};
 struct ExactBarcodeMatching {};
 
 template <typename TRead, typename TFinder, typename TStats>
-void MatchBarcodes(std::vector<TRead>& reads, const TFinder& finder, TStats& stats, const ExactBarcodeMatching&)
+void matchBarcode(TRead& read, const TFinder& finder, TStats& stats, const ExactBarcodeMatching&)
 {
-    for (auto& read : reads)
+    const int index = finder.getMatchIndex(read);
+    // ambiguous reads stay unidentified, but are counted in the last entry of matchedBarcodeReads
+    read.demuxResult = index == AMBIGUOUS_BARCODE ? 0 : index + 1;
+    const unsigned int statsIndex = index == AMBIGUOUS_BARCODE ? finder.getNumBarcodes() + 1 : read.demuxResult;
+    if (stats.matchedBarcodeReads.size() < statsIndex + 1)
     {
-        read.demuxResult = finder.getMatchIndex(read) + 1;
-        if (stats.matchedBarcodeReads.size() < static_cast<unsigned int>(read.demuxResult) + 1)
-        {
-            std::cout << "error: matchedBarcodeReads too small!" << std::endl;
-            throw(std::runtime_error("error: matchedBarcodeReads too small!"));
-        }
-        ++stats.matchedBarcodeReads[read.demuxResult];
+        std::cout << "error: matchedBarcodeReads too small!" << std::endl;
+        throw(std::runtime_error("error: matchedBarcodeReads too small!"));
     }
+    ++stats.matchedBarcodeReads[statsIndex];
 }
 
 //Overload if approximate search has been used.
 template <typename TRead, typename TFinder, typename TStats>
-void MatchBarcodes(std::vector<TRead>& reads, const TFinder& finder, TStats& stats, const ApproximateBarcodeMatching&)
+void matchBarcode(TRead& read, const TFinder& finder, TStats& stats, const ApproximateBarcodeMatching&)
 {
     const float dividend = float(finder.getBarcodeLength()*5.0);		//value by which the index will be corrected.
-    for (auto& read: reads)			             
+    read.demuxResult = finder.getMatchIndex(read) ;
+    if (read.demuxResult != -1)
+        read.demuxResult = int(floor(float(read.demuxResult) / dividend));
+    ++read.demuxResult;
+    if (stats.matchedBarcodeReads.size() < static_cast<unsigned int>(read.demuxResult) + 1)
     {
-        read.demuxResult = finder.getMatchIndex(read) ;
-        if (read.demuxResult != -1)
-            read.demuxResult = int(floor(float(read.demuxResult) / dividend));
-        ++read.demuxResult;
-        if (stats.matchedBarcodeReads.size() < static_cast<unsigned int>(read.demuxResult) + 1)
-        {
-            std::cout << "error: matchedBarcodeReads too small!" << std::endl;
-            throw(std::runtime_error("error: matchedBarcodeReads too small!"));
-        }
-        ++stats.matchedBarcodeReads[read.demuxResult];
+        std::cout << "error: matchedBarcodeReads too small!" << std::endl;
+        throw(std::runtime_error("error: matchedBarcodeReads too small!"));
     }
+    ++stats.matchedBarcodeReads[read.demuxResult];
+}
+
+// HashBarcodeMatcher and HammingBarcodeMatcher resolve the variants themselves and return the index of the barcode
+template <typename TRead, typename TStats>
+void matchBarcode(TRead& read, const HashBarcodeMatcher& finder, TStats& stats, const ApproximateBarcodeMatching&)
+{
+    matchBarcode(read, finder, stats, ExactBarcodeMatching());
+}
+
+template <typename TRead, typename TStats>
+void matchBarcode(TRead& read, const HammingBarcodeMatcher& finder, TStats& stats, const ApproximateBarcodeMatching&)
+{
+    matchBarcode(read, finder, stats, ExactBarcodeMatching());
+}
+
+template <typename TRead, typename TAlloc, typename TFinder, typename TStats, typename TMatchMode>
+void MatchBarcodes(std::vector<TRead, TAlloc>& reads, const TFinder& finder, TStats& stats, const TMatchMode& matchMode)
+{
+    for (auto& read : reads)
+        matchBarcode(read, finder, stats, matchMode);
 }
 
 struct ClipSoft {};
@@ -219,24 +603,22 @@ struct ClipHard {};
 
 //Overload for deleting only matched barcodes 
 template<typename TRead, typename TClipMode>
-void clipBarcodes(std::vector<TRead>& reads, const int len, const TClipMode&) noexcept
+void clipBarcode(TRead& read, const int len, const TClipMode&) noexcept
 {
-    if (std::is_same<TClipMode,ClipSoft>::value) // static if
-    {
-        std::for_each(reads.begin(), reads.end(), [len](auto& read) {
-            if(read.demuxResult != 0)
-                erase(read.seq, 0, len);
-        });
-    }
-    else
-    {
-        for (auto& read : reads)
-            erase(read.seq, 0, len);
-    }
+    if (std::is_same<TClipMode,ClipSoft>::value && read.demuxResult == 0) // static if
+        return;
+    erase(read.seq, 0, len);
+}
+
+template<typename TRead, typename TAlloc, typename TClipMode>
+void clipBarcodes(std::vector<TRead, TAlloc>& reads, const int len, const TClipMode& clipMode) noexcept
+{
+    for (auto& read : reads)
+        clipBarcode(read, len, clipMode);
 }
 
-template<template <typename> class TRead, typename TSeq, typename TFinder, typename TStats>
-void demultiplex(std::vector<TRead<TSeq>>& reads, const TFinder& finder,
+template<template <typename> class TRead, typename TSeq, typename TAlloc, typename TFinder, typename TStats>
+void demultiplex(std::vector<TRead<TSeq>, TAlloc>& reads, const TFinder& finder,
     const bool hardClip, TStats& stats, const bool approximate, const bool exclude)
 {
     if(approximate)
@@ -0,0 +1,291 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+non owning view into a character buffer, C++14 has no std::string_view
+*/
+struct StringView
+{
+    const char* ptr;
+    unsigned int len;
+
+    StringView() noexcept : ptr(nullptr), len(0) {};
+    StringView(const char* ptr, const unsigned int len) noexcept : ptr(ptr), len(len) {};
+
+    inline const char* begin() const noexcept
+    {
+        return ptr;
+    }
+    inline const char* end() const noexcept
+    {
+        return ptr + len;
+    }
+    inline unsigned int size() const noexcept
+    {
+        return len;
+    }
+    inline bool empty() const noexcept
+    {
+        return len == 0;
+    }
+    inline char operator[](const unsigned int pos) const noexcept
+    {
+        return ptr[pos];
+    }
+    explicit operator std::string() const
+    {
+        return std::string(ptr, len);
+    }
+};
+
+struct FastqRecordView
+{
+    StringView id;      // without the leading '@'
+    StringView seq;
+    StringView qual;
+};
+
+/*
+- parses one 4-line FASTQ record starting at pos
+- returns false and leaves pos untouched if [pos, end) does not contain a complete record
+- if isLastBlock is true, the last line of the buffer does not need a trailing newline and an incomplete record throws
+*/
+inline bool parseFastqRecord(const char*& pos, const char* const end, FastqRecordView& record, const bool isLastBlock = true)
+{
+    const char* cur = pos;
+    while (cur != end && (*cur == '\n' || *cur == '\r'))    // tolerate empty lines between records
+        ++cur;
+    if (cur == end)
+        return false;
+    if (*cur != '@')
+        throw std::runtime_error("Invalid FASTQ record: expected '@' at start of record.");
+
+    auto nextLine = [end, isLastBlock](const char* lineBegin, StringView& line) -> const char*
+    {
+        if (lineBegin == nullptr)
+            return nullptr;
+        const char* newLine = static_cast<const char*>(std::memchr(lineBegin, '\n', end - lineBegin));
+        const char* lineEnd = newLine;
+        const char* next = newLine + 1;
+        if (newLine == nullptr)
+        {
+            if (!isLastBlock || lineBegin == end)
+                return nullptr;
+            lineEnd = end;
+            next = end;
+        }
+        if (lineEnd != lineBegin && *(lineEnd - 1) == '\r')
+            --lineEnd;
+        line = StringView(lineBegin, static_cast<unsigned int>(lineEnd - lineBegin));
+        return next;
+    };
+
+    StringView plusLine;
+    cur = nextLine(cur, record.id);
+    cur = nextLine(cur, record.seq);
+    cur = nextLine(cur, plusLine);
+    cur = nextLine(cur, record.qual);
+    if (cur == nullptr)
+    {
+        if (isLastBlock)
+            throw std::runtime_error("Invalid FASTQ record: incomplete record at end of file.");
+        return false;
+    }
+    if (plusLine.empty() || plusLine[0] != '+')
+        throw std::runtime_error("Invalid FASTQ record: expected '+' line.");
+    if (record.seq.size() != record.qual.size())
+        throw std::runtime_error("Invalid FASTQ record: sequence and quality have different lengths.");
+    ++record.id.ptr;    // strip '@'
+    --record.id.len;
+    pos = cur;
+    return true;
+}
+
+/*
+- common interface of the readers that bypass SeqFileIn
+- the returned views stay valid until the next call of readBatch()
+*/
+class FastqBatchReader
+{
+public:
+    virtual ~FastqBatchReader() = default;
+    virtual const std::vector<FastqRecordView>& readBatch(const unsigned int maxRecords) = 0;
+};
+
+/*
+read only memory mapping of a whole file
+*/
+class MappedFile
+{
+private:
+    const char* _data;
+    size_t _size;
+#ifdef _WIN32
+    HANDLE _file;
+    HANDLE _mapping;
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+#ifdef _WIN32
+    MappedFile() : _data(nullptr), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(NULL) {};
+#else
+    MappedFile() : _data(nullptr), _size(0) {};
+#endif
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const char* path)
+    {
+        close();
+#ifdef _WIN32
+        _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (_file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(_file, &fileSize))
+            return false;
+        _size = static_cast<size_t>(fileSize.QuadPart);
+        if (_size == 0)
+            return true;
+        _mapping = CreateFileMapping(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping == NULL)
+            return false;
+        _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        return _data != nullptr;
+#else
+        const int fd = ::open(path, O_RDONLY);
+        if (fd == -1)
+            return false;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        _size = static_cast<size_t>(fileStat.st_size);
+        if (_size == 0)
+        {
+            ::close(fd);
+            return true;
+        }
+        void* mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);    // the mapping stays valid after closing the descriptor
+        if (mapped == MAP_FAILED)
+        {
+            _size = 0;
+            return false;
+        }
+        madvise(mapped, _size, MADV_SEQUENTIAL);
+        _data = static_cast<const char*>(mapped);
+        return true;
+#endif
+    }
+
+    void close() noexcept
+    {
+#ifdef _WIN32
+        if (_data != nullptr)
+            UnmapViewOfFile(_data);
+        if (_mapping != NULL)
+            CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE)
+            CloseHandle(_file);
+        _mapping = NULL;
+        _file = INVALID_HANDLE_VALUE;
+#else
+        if (_data != nullptr)
+            munmap(const_cast<char*>(_data), _size);
+#endif
+        _data = nullptr;
+        _size = 0;
+    }
+
+    inline const char* begin() const noexcept
+    {
+        return _data;
+    }
+    inline const char* end() const noexcept
+    {
+        return _data + _size;
+    }
+    inline size_t size() const noexcept
+    {
+        return _size;
+    }
+};
+
+/*
+- maps an uncompressed FASTQ file into memory
+- readBatch() finds the record boundaries of the next block and hands out views into the mapped region
+- no sequence data is copied here, the caller materializes only what it needs
+*/
+class MappedFastqReader : public FastqBatchReader
+{
+private:
+    MappedFile _file;
+    const char* _pos;
+    std::vector<FastqRecordView> _batch;
+
+public:
+    MappedFastqReader() : _pos(nullptr) {};
+
+    bool open(const char* path)
+    {
+        if (!_file.open(path))
+            return false;
+        _pos = _file.begin();
+        return true;
+    }
+
+    inline bool readRecord(FastqRecordView& record)
+    {
+        if (_pos == nullptr)
+            return false;
+        return parseFastqRecord(_pos, _file.end(), record);
+    }
+
+    // returned views stay valid as long as the reader exists, the batch vector is reused on the next call
+    const std::vector<FastqRecordView>& readBatch(const unsigned int maxRecords) override
+    {
+        _batch.resize(maxRecords);
+        unsigned int numRecords = 0;
+        while (numRecords < maxRecords && readRecord(_batch[numRecords]))
+            ++numRecords;
+        _batch.resize(numRecords);
+        return _batch;
+    }
+
+    bool atEnd() const noexcept
+    {
+        const char* cur = _pos;
+        if (cur == nullptr)
+            return true;
+        while (cur != _file.end() && (*cur == '\n' || *cur == '\r'))
+            ++cur;
+        return cur == _file.end();
+    }
+};
@@ -65,27 +65,7 @@
 #include "read.h"
 #include "read_writer.h"
 #include "ptc.h"
-
-
-#ifdef _MSC_VER
-bool is_avx2_supported(void)
-{
-    int cpuInfo[4];
-    __cpuid(cpuInfo, 7);
-    const int ebx = cpuInfo[1];
-    const int bit_AVX2 = 0x10;
-    return ebx & bit_AVX2 ? true : false;
-}
-#else
-#include <cpuid.h>
-
-bool is_avx2_supported(void)
-{
-    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
-    __get_cpuid(7, &eax, &ebx, &ecx, &edx);
-    return ebx & bit_AVX2 ? true : false;
-}
-#endif
+#include "fused_stages.h"
 
 
 using namespace seqan;
@@ -96,131 +76,25 @@ using namespace seqan;
 // ============================================================================
 
 
-template<template <typename> class TRead, typename TSeq, typename = std::enable_if_t < std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value>>
-inline void loadMultiplex(std::vector<TRead<TSeq>>& reads, unsigned records, seqan::SeqFileIn& multiplexFile)
+template<template <typename> class TRead, typename TSeq, typename TAlloc, typename = std::enable_if_t < std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value>>
+inline void loadMultiplex(std::vector<TRead<TSeq>, TAlloc>& reads, AsyncMultiplexReader& multiplexReader)
 {
     (void)reads;
-    (void)multiplexFile;
-    (void)records;
-}
-
-template<template <typename> class TRead, typename TSeq, typename = std::enable_if_t < std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value>>
-inline void loadMultiplex(std::vector<TRead<TSeq>>& reads, unsigned records, seqan::SeqFileIn& multiplexFile, bool = false)
-{
-    seqan::String<char> id;
-    unsigned int i = 0;
-    while (i < records && !atEnd(multiplexFile))
-    {
-        readRecord(id, reads[i].demultiplex, multiplexFile);
-        ++i;
-    }
+    (void)multiplexReader;
 }
 
-// PROGRAM STAGES ---------------------
-//Preprocessing Stage
-template<typename TReadSet, typename TStats>
-void preprocessingStage(const ProcessingParams& processingParams, TReadSet& readSet, TStats& stats)
+// the barcodes were read ahead on the reader thread, they are swapped into the reads and the old ones are recycled
+template<template <typename> class TRead, typename TSeq, typename TAlloc, typename = std::enable_if_t < std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value>>
+inline void loadMultiplex(std::vector<TRead<TSeq>, TAlloc>& reads, AsyncMultiplexReader& multiplexReader, bool = false)
 {
-    if (processingParams.runPre)
-    {
-        //Trimming and filtering
-        if (processingParams.trimLeft + processingParams.trimRight + processingParams.minLen != 0)
-            preTrim(readSet, processingParams.trimLeft, processingParams.trimRight,
-                processingParams.minLen, processingParams.tagTrimming, stats);
-       // Detecting uncalled Bases
-        if (processingParams.runCheckUncalled)
-        {
-            if (processingParams.runSubstitute)
-                processN(readSet, processingParams.uncalled, processingParams.substitute, stats);
-            else
-                processN(readSet, processingParams.uncalled, NoSubstitute(), stats);
-        }
-    }
+    auto& barcodes = multiplexReader.next();
+    const unsigned int numBarcodes = std::min(reads.size(), barcodes.size());
+    for (unsigned int i = 0; i < numBarcodes; ++i)
+        swap(reads[i].demultiplex, barcodes[i]);
+    for (unsigned int i = numBarcodes; i < reads.size(); ++i)
+        clear(reads[i].demultiplex);    // recycled reads still hold the barcode of their last batch
 }
 
-// DEMULTIPLEXING
-template <typename TRead, typename TFinder, typename TStats>
-int demultiplexingStage(const DemultiplexingParams& params, std::vector<TRead>& reads, TFinder& esaFinder,
-    TStats& stats)
-{
-    if (!params.run)
-        return 0;
-    if (!check(reads, params.barcodes, stats))
-        return -1;
-    demultiplex(reads, esaFinder, params.hardClip, stats, params.approximate, params.exclude);
-    return 0;
-}
-
-// ADAPTER TRIMMING
-template <typename TRead, typename TlsBlock>
-void adapterTrimmingStage(std::vector<TRead>& reads, TlsBlock& tlsBlock)
-{
-    if (!tlsBlock.params.run)
-        return;
-    if(tlsBlock.params.tag)
-        if(tlsBlock.params.best)
-            if(tlsBlock.params.nler)
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<true>(), AdapterSelectionMethod::Best(), ErrorRateMode::nonLinear());
-            else
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<true>(), AdapterSelectionMethod::Best(), ErrorRateMode::linear());
-        else
-            if (tlsBlock.params.nler)
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<true>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::nonLinear());
-            else
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<true>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::linear());
-    else
-        if (tlsBlock.params.best)
-            if (tlsBlock.params.nler)
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<false>(), AdapterSelectionMethod::Best(), ErrorRateMode::nonLinear());
-            else
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<false>(), AdapterSelectionMethod::Best(), ErrorRateMode::linear());
-        else
-            if (tlsBlock.params.nler)
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<false>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::nonLinear());
-            else
-                stripAdapterBatch(reads, tlsBlock, TagAdapter<false>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::linear());
-}
-
-// QUALITY TRIMMING
-template <typename TRead, typename TStats>
-void qualityTrimmingStage(const QualityTrimmingParams& params, std::vector<TRead>& reads, TStats& stats)
-{
-    if (params.run)
-    {
-        switch (params.trim_mode)
-        {
-        case TrimmingMode::E_WINDOW:
-        {
-            trimBatch(reads, params.cutoff, Mean(5), params.tag);
-            break;
-        }
-        case TrimmingMode::E_BWA:
-        {
-            trimBatch(reads, params.cutoff, BWA(), params.tag);
-        }
-        case TrimmingMode::E_TAIL:
-        {
-            trimBatch(reads, params.cutoff, Tail(), params.tag);
-        }
-        }
-        stats.removedQuality += removeShortSeqs(reads, params.min_length);
-    }
-}
-
-//Postprocessing
-template<typename TRead, typename TStats>
-void postprocessingStage(const ProcessingParams& params, std::vector<TRead>& reads, TStats& stats)
-{
-    if (params.runPost)
-    {
-        if ((params.minLength != 0) && (params.finalLength == 0))
-            stats.removedShort += removeShortSeqs(reads, params.minLength);
-        else if (params.finalLength != 0)
-            trimTo(reads, params.finalLength, stats);
-    }
-}
-
-// END PROGRAM STAGES ---------------------
 template <typename TOutStream, typename TStats>
 void printStatistics(const ProgramParams& programParams, const TStats& generalStats, const float totalTime, DemultiplexingParams& demultiplexParams,
                 const AdapterTrimmingParams& adapterParams, const OutputStreams& outputStreams, const bool timing, TOutStream &outStream)
@@ -268,11 +142,7 @@ void printStatistics(const ProgramParams& programParams, const TStats& generalSt
         outStream << "\nBarcode Demultiplexing statistics\n";
         outStream << "=================================\n";
 
-        unsigned barcodesTotal = length(demultiplexParams.barcodes);
-        if (demultiplexParams.approximate)
-        {
-            barcodesTotal = barcodesTotal/(length(demultiplexParams.barcodes[0])*5);
-        }
+        const unsigned barcodesTotal = length(demultiplexParams.barcodes);
 
         outStream << "Unidentified:\t\t" << generalStats.matchedBarcodeReads[0];
         if (generalStats.readCount != 0)
@@ -281,6 +151,16 @@ void printStatistics(const ProgramParams& programParams, const TStats& generalSt
                 ((double)generalStats.readCount) * 100 << "%) reads";
         }  
         outStream << "\n";
+        if (demultiplexParams.approximate)
+        {
+            outStream << "Ambiguous:\t\t" << generalStats.matchedBarcodeReads[barcodesTotal + 1];
+            if (generalStats.readCount != 0)
+            {
+                outStream  << "\t\t(" << std::setprecision(3) << (double)generalStats.matchedBarcodeReads[barcodesTotal + 1] /
+                    ((double)generalStats.readCount) * 100 << "%) reads";
+            }
+            outStream << "\n";
+        }
         for (unsigned i = 1; i <= barcodesTotal; ++i)
         {
             outStream << demultiplexParams.barcodeIds[i-1]<<":\t" << generalStats.matchedBarcodeReads[i];
@@ -363,31 +243,67 @@ void printStatistics(const ProgramParams& programParams, const TStats& generalSt
         outStream << "write time       : " << std::setw(5) << generalStats.writeTime << " seconds  " << generalStats.writeTime / totalTime * 100 << "%.\n";
         outStream << "------------------\n";
         outStream << "total time       : " << std::setw(5) << totalTime << " seconds.\n";
+        const ptc::WaitStats waitStats = ptc::waitStats();
+        if (programParams.num_threads > 1 && waitStats.spinWaits + waitStats.sleepWaits != 0)
+        {
+            outStream << "waits            : " << waitStats.spinWaits << " ended spinning (" << waitStats.spinIterations << " spin iterations), "
+                << waitStats.sleepWaits << " slept for " << waitStats.sleepTime << " seconds\n";
+        }
         outStream << std::endl;
     }
 }
 
-template < template<typename> class TRead, typename TSeq, typename = std::enable_if_t<std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value> >
-unsigned int readReads(std::vector<TRead<TSeq>>& reads, const unsigned int records, InputFileStreams& inputFileStreams, bool = false)
+// writes a mapped record directly into the (recycled) buffers of a read, no temporaries involved
+template <typename TSeq>
+inline void assignRecord(std::string& id, TSeq& seq, const FastqRecordView& record)
+{
+    id.assign(record.id.ptr, record.id.len);
+    resize(seq, record.seq.len);
+    auto it = begin(seq);
+    for (unsigned int k = 0; k < record.seq.len; ++k, ++it)
+    {
+        *it = record.seq[k];
+        assignQualityValue(*it, static_cast<int>(record.qual[k]) - 33);
+    }
+}
+
+template < template<typename> class TRead, typename TSeq, typename TAlloc, typename = std::enable_if_t<std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value> >
+unsigned int readReads(std::vector<TRead<TSeq>, TAlloc>& reads, const unsigned int records, InputFileStreams& inputFileStreams, bool = false)
 {
+    if (inputFileStreams.fastqReader1)
+    {
+        const auto& batch = inputFileStreams.fastqReader1->readBatch(records);
+        reads.resize(batch.size());
+        for (unsigned int i = 0; i < batch.size(); ++i)
+            assignRecord(reads[i].id, reads[i].seq, batch[i]);
+        return batch.size();
+    }
     reads.resize(records);
     unsigned int i = 0;
-    TSeq seq;
-    std::string id;
     while (i < records && !atEnd(inputFileStreams.fileStream1))
     {
-        readRecord(id, seq, inputFileStreams.fileStream1);
-        reads[i].id = id;
-        reads[i].seq = seq;
+        readRecord(reads[i].id, reads[i].seq, inputFileStreams.fileStream1);
         ++i;
     }
     reads.resize(i);
     return i;
 }
 
-template < template<typename> class TRead, typename TSeq, typename = std::enable_if_t<std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value> >
-unsigned int readReads(std::vector<TRead<TSeq>>& reads, const unsigned int records, InputFileStreams& inputFileStreams)
+template < template<typename> class TRead, typename TSeq, typename TAlloc, typename = std::enable_if_t<std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value> >
+unsigned int readReads(std::vector<TRead<TSeq>, TAlloc>& reads, const unsigned int records, InputFileStreams& inputFileStreams)
 {
+    if (inputFileStreams.fastqReader1)
+    {
+        const auto& batch1 = inputFileStreams.fastqReader1->readBatch(records);
+        const auto& batch2 = inputFileStreams.fastqReader2->readBatch(batch1.size());
+        reads.resize(batch2.size());
+        for (unsigned int i = 0; i < batch2.size(); ++i)
+        {
+            assignRecord(reads[i].id, reads[i].seq, batch1[i]);
+            assignRecord(reads[i].idRev, reads[i].seqRev, batch2[i]);
+        }
+        return batch2.size();
+    }
     reads.resize(records);
     unsigned int i = 0;
     while (i < records && !atEnd(inputFileStreams.fileStream1))
@@ -413,8 +329,8 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
     unsigned int numReads = 0;
     auto readReader = [&numReads, &programParams, &inputFileStreams, &demultiplexingParams, &adapterTrimmingParams]() {
         const auto t1 = std::chrono::steady_clock::now();
-        TStats stats = TStats(length(demultiplexingParams.barcodeIds) + 1, adapterTrimmingParams.adapters.size());
-        auto item = std::make_unique<std::vector<TRead<TSeq>>>();
+        TStats stats = TStats(length(demultiplexingParams.barcodeIds) + 2, adapterTrimmingParams.adapters.size());
+        auto item = std::make_unique<ReadBatch<TRead<TSeq>>>();
         if (numReads >= programParams.firstReads)    // maximum read number reached -> dont do further reads
         {
             // return empty unique_ptr to signal eof
@@ -422,7 +338,7 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
             return std::unique_ptr<std::tuple<decltype(item), TStats>>();
         }
         readReads(*item, programParams.records, inputFileStreams);
-        loadMultiplex(*item, programParams.records, inputFileStreams.fileStreamMultiplex);
+        loadMultiplex(*item, inputFileStreams.multiplexReader);
         numReads += item->size();
         if (item->empty())    // no more reads available
         {
@@ -433,35 +349,35 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
         stats.readTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - t1).count();
         return std::make_unique<std::tuple<decltype(item), TStats>>(std::make_tuple(std::move(item), stats));
     };
-    auto readReaderReuse = [&numReads, &programParams, &inputFileStreams, &demultiplexingParams, &adapterTrimmingParams](std::unique_ptr<std::tuple<std::unique_ptr<std::vector<TRead<TSeq>>>,TStats>>&& usedItem) {
+    auto readReaderReuse = [&numReads, &programParams, &inputFileStreams, &demultiplexingParams, &adapterTrimmingParams](std::unique_ptr<std::tuple<std::unique_ptr<ReadBatch<TRead<TSeq>>>,TStats>>&& usedItem) {
         const auto t1 = std::chrono::steady_clock::now();
 
         auto item = std::move(usedItem);
         if (item == nullptr)
         {
-            item = std::make_unique<std::tuple<std::unique_ptr<std::vector<TRead<TSeq>>>, TStats>>();
-            std::get<0>(*item) = std::make_unique<std::vector<TRead<TSeq>>>();
-            std::get<1>(*item) = TStats(length(demultiplexingParams.barcodeIds) + 1, adapterTrimmingParams.adapters.size());
+            item = std::make_unique<std::tuple<std::unique_ptr<ReadBatch<TRead<TSeq>>>, TStats>>();
+            std::get<0>(*item) = std::make_unique<ReadBatch<TRead<TSeq>>>();
+            std::get<1>(*item) = TStats(length(demultiplexingParams.barcodeIds) + 2, adapterTrimmingParams.adapters.size());
         }
         else
             std::get<1>(*item).clear();
         //if(std::get<0>(*item) == nullptr) // this check is not necessary
-        //    std::get<0>(*item) = std::make_unique<std::vector<TRead<TSeq>>>();
+        //    std::get<0>(*item) = std::make_unique<ReadBatch<TRead<TSeq>>>();
         TStats& stats = std::get<1>(*item);
         auto& reads = *std::get<0>(*item);
         if (numReads >= programParams.firstReads)    // maximum read number reached -> dont do further reads
         {
             // return empty unique_ptr to signal eof
             item.release();
-            return std::unique_ptr<std::tuple<std::unique_ptr<std::vector<TRead<TSeq>>>, TStats>>();
+            return std::unique_ptr<std::tuple<std::unique_ptr<ReadBatch<TRead<TSeq>>>, TStats>>();
         }
         readReads(reads, programParams.records, inputFileStreams);
-        loadMultiplex(reads, programParams.records, inputFileStreams.fileStreamMultiplex);
+        loadMultiplex(reads, inputFileStreams.multiplexReader);
         numReads += reads.size();
         if (reads.empty())    // no more reads available
         {
             // return empty unique_ptr to signal eof
-            return std::unique_ptr<std::tuple<std::unique_ptr<std::vector<TRead<TSeq>>>, TStats>>();
+            return std::unique_ptr<std::tuple<std::unique_ptr<ReadBatch<TRead<TSeq>>>, TStats>>();
         }
         stats.readTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - t1).count();
         return item;
@@ -473,19 +389,16 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
         const auto t1 = std::chrono::steady_clock::now();
         auto reads = std::move(std::get<0>(*t));
         TStats& stats = std::get<1>(*t);
-        TlsBlockAdapterTrimming<typename TStats::TAdapterTrimmingStats> tlsBlock(stats.adapterTrimmingStats, adapterTrimmingParams);
+        using TlsBlock = TlsBlockAdapterTrimming<typename TStats::TAdapterTrimmingStats>;
+        TlsBlock tlsBlock(stats.adapterTrimmingStats, adapterTrimmingParams);
         stats.readCount = reads->size();
-        preprocessingStage(processingParams, *reads, stats);
-        if (demultiplexingStage(demultiplexingParams, *reads, esaFinder, stats) != 0)
-            std::cerr << "DemultiplexingStage error" << std::endl;
-        qualityTrimmingStage(qualityTrimmingParams, *reads, stats);
-        adapterTrimmingStage(*reads, tlsBlock);
-        postprocessingStage(processingParams, *reads, stats);
+        FusedStages<TEsaFinder, TlsBlock, TStats> stages(processingParams, demultiplexingParams, qualityTrimmingParams, esaFinder, tlsBlock, stats);
+        stages(*reads);
         stats.processTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - t1).count();
-        return std::make_unique<std::tuple<decltype(reads), decltype(demultiplexingParams.barcodeIds), TStats>>(std::make_tuple(std::move(reads), demultiplexingParams.barcodeIds, stats));
+        return std::make_unique<std::tuple<decltype(reads), std::reference_wrapper<const decltype(demultiplexingParams.barcodeIds)>, TStats>>(std::make_tuple(std::move(reads), std::cref(demultiplexingParams.barcodeIds), stats));
     };
 
-    TStats generalStats(length(demultiplexingParams.barcodeIds) + 1, adapterTrimmingParams.adapters.size());
+    TStats generalStats(length(demultiplexingParams.barcodeIds) + 2, adapterTrimmingParams.adapters.size());
 
     bool reuse = true; // this should be disabled only for debugging
     if (programParams.num_threads > 1)
@@ -494,14 +407,14 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
         {
             if (programParams.ordered)
             {
-                auto ptc_unit = ptc::ordered_ptc(readReaderReuse, transformer, readWriter, programParams.num_threads);
+                auto ptc_unit = ptc::ordered_ptc(readReaderReuse, transformer, readWriter, ptc::sharedThreadPool(programParams.num_threads));
                 ptc_unit->start();
                 auto f = ptc_unit->get_future();
                 stats = f.get();
             }
             else
             {
-                auto ptc_unit = ptc::unordered_ptc(readReaderReuse, transformer, readWriter, programParams.num_threads);
+                auto ptc_unit = ptc::unordered_ptc(readReaderReuse, transformer, readWriter, ptc::sharedThreadPool(programParams.num_threads));
                 ptc_unit->start();
                 auto f = ptc_unit->get_future();
                 stats = f.get();
@@ -511,14 +424,14 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
         {
             if (programParams.ordered)
             {
-                auto ptc_unit = ptc::ordered_ptc(readReader, transformer, readWriter, programParams.num_threads);
+                auto ptc_unit = ptc::ordered_ptc(readReader, transformer, readWriter, ptc::sharedThreadPool(programParams.num_threads));
                 ptc_unit->start();
                 auto f = ptc_unit->get_future();
                 stats = f.get();
             }
             else
             {
-                auto ptc_unit = ptc::unordered_ptc(readReader, transformer, readWriter, programParams.num_threads);
+                auto ptc_unit = ptc::unordered_ptc(readReader, transformer, readWriter, ptc::sharedThreadPool(programParams.num_threads));
                 ptc_unit->start();
                 auto f = ptc_unit->get_future();
                 stats = f.get();
@@ -527,16 +440,16 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
     }
     else
     {
-        std::unique_ptr<std::vector<TRead<TSeq>>> readSet;
+        auto readSet = std::make_unique<ReadBatch<TRead<TSeq>>>();
         const auto tMain = std::chrono::steady_clock::now();
         while (stats.readCount < programParams.firstReads)
         {
-            generalStats = TStats(length(demultiplexingParams.barcodeIds) + 1, adapterTrimmingParams.adapters.size());
+            generalStats = TStats(length(demultiplexingParams.barcodeIds) + 2, adapterTrimmingParams.adapters.size());
             auto t1 = std::chrono::steady_clock::now();
-            readSet.reset(new std::vector<TRead<TSeq>>(programParams.records));
             const auto numReadsRead = readReads(*readSet, programParams.records, inputFileStreams);
             if (numReadsRead == 0)
                 break;
+            loadMultiplex(*readSet, inputFileStreams.multiplexReader);
             generalStats.readTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - t1).count();
             auto res = transformer(std::make_unique<std::tuple<decltype(readSet),decltype(generalStats)>>(std::make_tuple(std::move(readSet), generalStats)));
             generalStats = std::get<2>(*res);
@@ -544,6 +457,7 @@ int mainLoop(TRead<TSeq>, const ProgramParams& programParams, InputFileStreams&
             t1 = std::chrono::steady_clock::now();
             outputStreams.writeSeqs(*(std::get<0>(*res)), demultiplexingParams.barcodeIds);
             generalStats.writeTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - t1).count();
+            readSet = std::move(std::get<0>(*res));     // recycle the batch for the next iteration
 
             // Print information
             const auto deltaTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - tMain).count();
@@ -569,7 +483,7 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
     if(!is_avx2_supported())
     {
         std::cout << "\nYour CPU does not support AVX2. Please recompile on your machine or use a binary"
-            << " that has been compiled without AVX2 support.\n";
+            << " that has been compiled without AVX2 support, the adapter kernels select AVX2 at runtime anyway.\n";
         return 1;
     }
 #endif
@@ -643,19 +557,10 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
     //--------------------------------------------------
 
     DemultiplexingParams demultiplexingParams;
-    seqan::SeqFileIn multiplexInFile;    //Initialising the SequenceStream for the multiplex file
 
     if(flexiProgram == FlexiProgram::DEMULTIPLEXING || flexiProgram == FlexiProgram::ALL_STEPS)
     {
         getOptionValue(demultiplexingParams.multiplexFile, parser, "x");
-        if (isSet(parser, "x"))
-        {
-            if (!open(multiplexInFile, seqan::toCString(demultiplexingParams.multiplexFile)))
-            {
-                std::cerr << "Could not open file " << demultiplexingParams.multiplexFile << " for reading!" << std::endl;
-                return 1;
-            }
-        }
 
         if (loadDemultiplexingParams(parser, demultiplexingParams) != 0)
             return 1;
@@ -668,7 +573,15 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
     // Process Barcodes
     //--------------------------------------------------
 
-    BarcodeMatcher esaFinder(demultiplexingParams.barcodes);
+    // the hash table would need every variant for distances above 1, they use the pigeonhole index instead
+    const bool hammingMatching = demultiplexingParams.approximate && demultiplexingParams.maxDistance > 1;
+    const HashBarcodeMatcher hashFinder(hammingMatching ? std::vector<std::string>() : demultiplexingParams.barcodes,
+        demultiplexingParams.approximate);
+    const HammingBarcodeMatcher hammingFinder(hammingMatching ? demultiplexingParams.barcodes : std::vector<std::string>(),
+        demultiplexingParams.maxDistance);
+    if (hashFinder.getAmbiguousVariants() != 0)
+        std::cout << "\nWarning: " << hashFinder.getAmbiguousVariants() << " barcode variants match more than one barcode, "
+            "reads with these barcodes remain unidentified.\n";
 
     if(flexiProgram == FlexiProgram::DEMULTIPLEXING && (!isSet(parser, "x") && !isSet(parser, "b")))
     {
@@ -724,6 +637,12 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
     InputFileStreams inputFileStreams;
     if (loadProgramParams(parser, programParams, inputFileStreams) != 0)
         return 1;
+    // the multiplex file is read on its own thread, it needs the batch size from the program parameters
+    if (demultiplexingParams.runx && !inputFileStreams.multiplexReader.open(seqan::toCString(demultiplexingParams.multiplexFile), programParams.records))
+    {
+        std::cerr << "Could not open file " << demultiplexingParams.multiplexFile << " for reading!" << std::endl;
+        return 1;
+    }
 
     if (checkParams(programParams, inputFileStreams, processingParams, demultiplexingParams, adapterTrimmingParams, qualityTrimmingParams) != 0)
         return 1;
@@ -750,7 +669,7 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
         useDefault = true;
     }
 
-    OutputStreams outputStreams(seqan::toCString(output), noQuality);
+    OutputStreams outputStreams(seqan::toCString(output), noQuality, ptc::sharedThreadPool(programParams.num_threads));
 
     // Output additional Information on selected stages:
     if (!isSet(parser, "ni"))
@@ -760,11 +679,7 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
         std::cout << "Overview:\n";
         std::cout << "=========\n";
         std::cout << "Application Type: " << sizeof(void*) * 8 << " bit" << std::endl;
-#ifdef __AVX2__        
-        std::cout << "AVX2: enabled" << std::endl;
-#else
-        std::cout << "AVX2: disabled" << std::endl;
-#endif
+        std::cout << "SIMD kernels: " << toString(getSimdLevel()) << std::endl;
         getArgumentValue(filename1, parser, 0, 0);
         std::cout << "Forward-read file: " << filename1 << "\n";
         if (programParams.fileCount == 2)
@@ -844,7 +759,7 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
                 std::cout << "\tMultiplex barcodes file:  NO" << demultiplexingParams.multiplexFile << "\n";
 
             if (demultiplexingParams.approximate)
-                std::cout << "\tApproximate matching: YES\n";
+                std::cout << "\tApproximate matching: YES, up to " << demultiplexingParams.maxDistance << " mismatches\n";
             else
                 std::cout << "\tApproximate matching: NO\n";
 
@@ -931,6 +846,12 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
                 std::cout << "\tAdapter selection method: best\n";
             else
                 std::cout << "\tAdapter selection method: top-down\n";
+            if (isSet(parser, "gapped"))
+                std::cout << "\tAdapter alignment: gapped\n";
+            else if (isSet(parser, "batch") && !isSet(parser, "topdown"))
+                std::cout << "\tAdapter alignment: ungapped, reads in batches of " << getBatchSize() << "\n";
+            else
+                std::cout << "\tAdapter alignment: ungapped\n";
             std::cout << "\n";
         }
         if (qualityTrimmingParams.run)
@@ -950,25 +871,35 @@ int flexcatMain(const FlexiProgram flexiProgram, int argc, char const ** argv)
     // Start processing. Different functions are needed for one or two input files.
     std::cout << "\nProcessing reads...\n" << std::endl;
 
-    GeneralStats generalStats(length(demultiplexingParams.barcodeIds) + 1, adapterTrimmingParams.adapters.size());
+    // matchedBarcodeReads: unidentified, one entry per barcode, ambiguous
+    GeneralStats generalStats(length(demultiplexingParams.barcodeIds) + 2, adapterTrimmingParams.adapters.size());
+    const auto runMainLoop = [&](const auto read)
+    {
+        if (hammingMatching)
+            mainLoop(read, programParams, inputFileStreams, demultiplexingParams, processingParams, adapterTrimmingParams, qualityTrimmingParams, hammingFinder, outputStreams, generalStats);
+        else
+            mainLoop(read, programParams, inputFileStreams, demultiplexingParams, processingParams, adapterTrimmingParams, qualityTrimmingParams, hashFinder, outputStreams, generalStats);
+    };
     if (fileCount == 1)
     {
         if (!demultiplexingParams.run)
             outputStreams.addStream("", 0, useDefault);
         if(demultiplexingParams.runx)
-            mainLoop(ReadMultiplex<seqan::Dna5QString>(), programParams, inputFileStreams, demultiplexingParams, processingParams, adapterTrimmingParams, qualityTrimmingParams, esaFinder, outputStreams, generalStats);
+            runMainLoop(ReadMultiplex<seqan::Dna5QString>());
         else
-            mainLoop(Read<seqan::Dna5QString>(), programParams, inputFileStreams, demultiplexingParams, processingParams, adapterTrimmingParams, qualityTrimmingParams, esaFinder, outputStreams, generalStats);
+            runMainLoop(Read<seqan::Dna5QString>());
     }
     else
     {
         if (!demultiplexingParams.run)
             outputStreams.addStreams("", "", 0, useDefault);
         if (demultiplexingParams.runx)
-            mainLoop(ReadMultiplexPairedEnd<seqan::Dna5QString>(), programParams, inputFileStreams, demultiplexingParams, processingParams, adapterTrimmingParams, qualityTrimmingParams, esaFinder, outputStreams, generalStats);
+            runMainLoop(ReadMultiplexPairedEnd<seqan::Dna5QString>());
         else
-            mainLoop(ReadPairedEnd<seqan::Dna5QString>(), programParams, inputFileStreams, demultiplexingParams, processingParams, adapterTrimmingParams, qualityTrimmingParams, esaFinder, outputStreams, generalStats);
+            runMainLoop(ReadPairedEnd<seqan::Dna5QString>());
     }
+    if (!outputStreams.close())
+        return 1;
     generalStats.processTime /= programParams.num_threads;
 
     const float totalTime = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - t1).count();;
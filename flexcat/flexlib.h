@@ -34,8 +34,14 @@
 
 #pragma once
 
+#include <memory>
+
 #include <seqan/sequence.h>
 
+#include "fastq_reader.h"
+#include "gzip_reader.h"
+#include "multiplex_reader.h"
+
 struct ProcessingParams
 {
     seqan::Dna substitute;
@@ -68,7 +74,10 @@ struct ProcessingParams
 
 struct InputFileStreams
 {
-    seqan::SeqFileIn fileStream1, fileStream2, fileStreamMultiplex;
+    seqan::SeqFileIn fileStream1, fileStream2;
+    AsyncMultiplexReader multiplexReader;
+    // set if the input is plain or gzip compressed FASTQ, readReads() then bypasses SeqFileIn
+    std::unique_ptr<FastqBatchReader> fastqReader1, fastqReader2;
 };
 
 
@@ -0,0 +1,235 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#include "flexlib.h"
+#include "general_processing.h"
+#include "demultiplex.h"
+#include "read_trimming.h"
+#include "adapter_trimming.h"
+
+/*
+- all enabled stages are run on one read after the other while it is in the cache, instead of sweeping the batch once per stage
+- a stage returns false if it drops the read, the following stages are skipped and the kept reads are compacted in the same pass
+- the statistics are the same as with separate stages, a dropped read is counted by the first stage that drops it
+- stripAdapterBatchBest() needs the whole batch, in this case the batch is compacted before the adapter stage and once more after the postprocessing
+*/
+template <typename TFinder, typename TlsBlock, typename TStats>
+class FusedStages
+{
+    const ProcessingParams& _processingParams;
+    const DemultiplexingParams& _demultiplexingParams;
+    const QualityTrimmingParams& _qualityTrimmingParams;
+    const TFinder& _finder;
+    TlsBlock& _tlsBlock;
+    TStats& _stats;
+    std::string _insertToken;
+    bool _runDemultiplexing;
+    unsigned int _barcodeLength;
+
+    template <typename TReads, typename TProcess>
+    static void processAndCompact(TReads& reads, TProcess&& process)
+    {
+        auto out = reads.begin();
+        for (auto it = reads.begin(); it != reads.end(); ++it)
+        {
+            if (!process(*it))
+                continue;
+            if (out != it)
+                *out = std::move(*it);
+            ++out;
+        }
+        reads.erase(out, reads.end());
+    }
+
+    template <typename TRead>
+    bool preprocessing(TRead& read)
+    {
+        if (!_processingParams.runPre)
+            return true;
+        //Trimming and filtering
+        if (_processingParams.trimLeft + _processingParams.trimRight + _processingParams.minLen != 0)
+        {
+            if (_processingParams.tagTrimming)
+                preTrimRead<true>(read, _processingParams.trimLeft, _processingParams.trimRight, _insertToken);
+            else
+                preTrimRead<false>(read, _processingParams.trimLeft, _processingParams.trimRight, _insertToken);
+            if (read.minSeqLen() < _processingParams.minLen)
+            {
+                ++_stats.removedShort;
+                return false;
+            }
+        }
+        // Detecting uncalled Bases
+        if (_processingParams.runCheckUncalled)
+        {
+            const int c = _processingParams.runSubstitute ? findN(read, _processingParams.uncalled, _processingParams.substitute)
+                : findN(read, _processingParams.uncalled, NoSubstitute());
+            if (c == -1)
+            {
+                ++_stats.removedN;
+                return false;
+            }
+            _stats.uncalledBases += c;
+        }
+        return true;
+    }
+
+    template <typename TRead>
+    bool demultiplexing(TRead& read)
+    {
+        if (!_runDemultiplexing)
+            return true;
+        if (length(read.seq) <= _barcodeLength)
+        {
+            ++_stats.removedShort;
+            return false;
+        }
+        if (_demultiplexingParams.approximate)
+            matchBarcode(read, _finder, _stats, ApproximateBarcodeMatching());
+        else
+            matchBarcode(read, _finder, _stats, ExactBarcodeMatching());
+        if (_demultiplexingParams.exclude && read.demuxResult == 0)
+            return false;
+        if (!IsMultiplexRead<TRead>::value)   // clipping is not done for multiplex barcodes, only for inline barcodes
+        {
+            if (_demultiplexingParams.hardClip)
+                clipBarcode(read, _finder.getBarcodeLength(), ClipHard());
+            else
+                clipBarcode(read, _finder.getBarcodeLength(), ClipSoft());
+        }
+        return true;
+    }
+
+    template <typename TRead>
+    bool qualityTrimming(TRead& read)
+    {
+        if (!_qualityTrimmingParams.run)
+            return true;
+        switch (_qualityTrimmingParams.trim_mode)
+        {
+        case TrimmingMode::E_WINDOW:
+            trimQuality(read, Mean(5));
+            break;
+        case TrimmingMode::E_BWA:
+            trimQuality(read, BWA());
+            break;
+        case TrimmingMode::E_TAIL:
+            trimQuality(read, Tail());
+            break;
+        }
+        if (read.minSeqLen() < static_cast<unsigned int>(_qualityTrimmingParams.min_length))
+        {
+            ++_stats.removedQuality;
+            return false;
+        }
+        return true;
+    }
+
+    template <typename TRead, typename TSpec>
+    void trimQuality(TRead& read, const TSpec& spec)
+    {
+        if (_qualityTrimmingParams.tag)
+            trimReadQuality(read, _qualityTrimmingParams.cutoff, spec, TagTrimming<true>());
+        else
+            trimReadQuality(read, _qualityTrimmingParams.cutoff, spec, TagTrimming<false>());
+    }
+
+    template <typename TRead>
+    bool postprocessing(TRead& read)
+    {
+        if (!_processingParams.runPost)
+            return true;
+        if ((_processingParams.minLength != 0) && (_processingParams.finalLength == 0))
+        {
+            if (read.minSeqLen() < _processingParams.minLength)
+            {
+                ++_stats.removedShort;
+                return false;
+            }
+        }
+        else if (_processingParams.finalLength != 0)
+        {
+            trimReadTo(read, _processingParams.finalLength);
+            if (read.minSeqLen() < _processingParams.finalLength)
+            {
+                ++_stats.removedShort;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename TReads, typename TTagAdapter, typename TAdapterSelectionMethod, typename TErrorRateMode>
+    void run(TReads& reads, TTagAdapter, TAdapterSelectionMethod, TErrorRateMode)
+    {
+        using TRead = typename TReads::value_type;
+        const bool runAdapterTrimming = _tlsBlock.params.run;
+        if (runAdapterTrimming && isBatchAdapterTrimming<TRead>(_tlsBlock, TAdapterSelectionMethod()))
+        {
+            processAndCompact(reads, [this](TRead& read) {
+                return preprocessing(read) && demultiplexing(read) && qualityTrimming(read);});
+            stripAdapterBatchBest(reads, _tlsBlock, TTagAdapter(), TErrorRateMode());
+            processAndCompact(reads, [this](TRead& read) {return postprocessing(read);});
+            return;
+        }
+        processAndCompact(reads, [this, runAdapterTrimming](TRead& read) {
+            if (!(preprocessing(read) && demultiplexing(read) && qualityTrimming(read)))
+                return false;
+            if (runAdapterTrimming)
+                stripAdapterRead(read, _tlsBlock, TTagAdapter(), TAdapterSelectionMethod(), TErrorRateMode());
+            return postprocessing(read);
+        });
+    }
+
+public:
+    FusedStages(const ProcessingParams& processingParams, const DemultiplexingParams& demultiplexingParams,
+        const QualityTrimmingParams& qualityTrimmingParams, const TFinder& finder, TlsBlock& tlsBlock, TStats& stats)
+        : _processingParams(processingParams), _demultiplexingParams(demultiplexingParams), _qualityTrimmingParams(qualityTrimmingParams),
+        _finder(finder), _tlsBlock(tlsBlock), _stats(stats), _runDemultiplexing(false), _barcodeLength(0)
+    {
+        if (processingParams.tagTrimming)
+            _insertToken.reserve(8 + processingParams.trimLeft + processingParams.trimRight);
+        if (demultiplexingParams.run)
+        {
+            _runDemultiplexing = checkBarcodes(demultiplexingParams.barcodes);
+            if (!_runDemultiplexing)
+                std::cerr << "DemultiplexingStage error" << std::endl;
+            else
+                _barcodeLength = demultiplexingParams.barcodes[0].size();
+        }
+    }
+
+    template <typename TReads>
+    void operator()(TReads& reads)
+    {
+        const auto& params = _tlsBlock.params;
+        if (params.tag)
+            if (params.best)
+                if (params.nler)
+                    run(reads, TagAdapter<true>(), AdapterSelectionMethod::Best(), ErrorRateMode::nonLinear());
+                else
+                    run(reads, TagAdapter<true>(), AdapterSelectionMethod::Best(), ErrorRateMode::linear());
+            else
+                if (params.nler)
+                    run(reads, TagAdapter<true>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::nonLinear());
+                else
+                    run(reads, TagAdapter<true>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::linear());
+        else
+            if (params.best)
+                if (params.nler)
+                    run(reads, TagAdapter<false>(), AdapterSelectionMethod::Best(), ErrorRateMode::nonLinear());
+                else
+                    run(reads, TagAdapter<false>(), AdapterSelectionMethod::Best(), ErrorRateMode::linear());
+            else
+                if (params.nler)
+                    run(reads, TagAdapter<false>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::nonLinear());
+                else
+                    run(reads, TagAdapter<false>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::linear());
+    }
+};
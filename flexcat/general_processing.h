@@ -39,6 +39,7 @@
 #include <seqan/basic.h>
 #include <seqan/sequence.h>
 #include <seqan/stream.h>
+#include <nmmintrin.h>
 
 #include "helper_functions.h"
 #include "general_stats.h"
@@ -100,6 +101,42 @@ inline int findNUniversal(TSeq& seq, unsigned allowed, const TSub substitute) no
     return c;                   //sequence not deleted, number of substitutions returned
 }
 
+/*
+- same as findNUniversal, but compares 16 bytes of the packed Dna5Q buffer at once
+- N is a single byte value in Dna5Q, so one compare finds it regardless of the quality
+- only the found positions are substituted, N is rare in real data
+*/
+template<typename TSub>
+inline int findNUniversal(seqan::Dna5QString& seq, unsigned allowed, const TSub substitute) noexcept
+{
+    const __m128i nVec = _mm_set1_epi8(static_cast<char>(DNA5Q_N));
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(seqan::begin(seq, seqan::Standard()));
+    const unsigned int len = length(seq);
+    unsigned c = 0;
+    unsigned int k = 0;
+    for (; k + 16 <= len; k += 16)
+    {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + k)), nVec));
+        if (mask == 0)  // likely
+            continue;
+        c += _mm_popcnt_u32(mask);
+        if (c > allowed)
+            return -1;          //sequence will be removed
+        for (; mask != 0; mask &= mask - 1)
+            replaceN(seq[k + __builtin_ctz(mask)], substitute);
+    }
+    for (; k < len; ++k)
+    {
+        if (bytes[k] == DNA5Q_N)
+        {
+            replaceN(seq[k], substitute);
+            if (++c > allowed)
+                return -1;
+        }
+    }
+    return c;
+}
+
 template<template<typename> class TRead, typename TSeq, typename TSub,
     typename = std::enable_if_t<std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>> ::value >>
 constexpr inline int findNMultiplex(TRead<TSeq>& read, unsigned allowed, const TSub substitute, bool = false) noexcept
@@ -152,120 +189,118 @@ int findN(TRead<TSeq>& read, unsigned allowed, const TSub substitute) noexcept
 }
 
 //universal function for all combinations of options
-template<template <typename> class TRead, typename TSeq, typename TSub, typename TStats>
-void processN(std::vector<TRead<TSeq>>& reads, unsigned allowed, TSub substitute, TStats& stats) noexcept
+//counting, substitution and removal are done in one pass, the kept reads are compacted in place
+template<template <typename> class TRead, typename TSeq, typename TAlloc, typename TSub, typename TStats>
+void processN(std::vector<TRead<TSeq>, TAlloc>& reads, unsigned allowed, TSub substitute, TStats& stats) noexcept
 {
-    std::vector<int> res(length(reads));
-    std::transform(reads.begin(), reads.end(), res.begin(),[allowed, substitute, &stats](auto& read) ->auto
+    auto out = reads.begin();
+    for (auto it = reads.begin(); it != reads.end(); ++it)
     {
-        auto const resElement = findN(read, allowed, substitute);
-        if(resElement != -1)
-            stats.uncalledBases += resElement;
-        return resElement;
-    });
-    stats.removedN += _eraseSeqs(res, -1, reads);
+        const auto resElement = findN(*it, allowed, substitute);
+        if (resElement == -1)
+            continue;
+        stats.uncalledBases += resElement;
+        if (out != it)
+            *out = std::move(*it);
+        ++out;
+    }
+    stats.removedN += std::distance(out, reads.end());
+    reads.erase(out, reads.end());
 }
 
-template<template <typename> class TRead, typename TSeq>
-unsigned int removeShortSeqs(std::vector<TRead<TSeq>>& reads, const unsigned min) noexcept
+template<template <typename> class TRead, typename TSeq, typename TAlloc>
+unsigned int removeShortSeqs(std::vector<TRead<TSeq>, TAlloc>& reads, const unsigned min) noexcept
 {
     const auto numReads = (int)length(reads);
     reads.erase(std::remove_if(reads.begin(), reads.end(), [min](const auto& read) {return read.minSeqLen() < min;}), reads.end());
     return numReads - length(reads);
 }
 
-// main preTrim function
-template<template <typename> class TRead, typename TSeq, bool tagTrimming,
+// main preTrim function, insertToken is only a buffer that is reused between the reads
+template<bool tagTrimming, template <typename> class TRead, typename TSeq,
     typename = std::enable_if_t < std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same < TRead<TSeq>, ReadMultiplex < TSeq >> ::value >>
-unsigned int _preTrim(std::vector<TRead<TSeq>>& reads, const unsigned head, const unsigned tail, const unsigned min, bool = false) noexcept(!tagTrimming)
+void preTrimRead(TRead<TSeq>& read, const unsigned head, const unsigned tail, std::string& insertToken, bool = false) noexcept(!tagTrimming)
 {
-    std::string insertToken;
-    if(tagTrimming)
-        insertToken.reserve(8 + head + tail);
-    std::for_each(reads.begin(), reads.end(), [head, tail, &insertToken](auto& read)
+    auto seqLen = length(read.seq);
+    if (seqLen > (head + tail))
     {
-        auto seqLen = length(read.seq);
-        if (seqLen > (head + tail))
+        if (head > 0)
         {
-            if (head > 0)
-            {
-                if (tagTrimming)
-                    insertToken = ":TL:" + std::string(prefix(read.seq, head));
-                erase(read.seq, 0, head);
-            }
-            if (tail > 0)
-            {
-                seqLen = length(read.seq);
-                if (tagTrimming)
-                    insertToken += ":TR:" + std::string(suffix(read.seq, seqLen - tail));
-                erase(read.seq, seqLen - tail, seqLen);
-            }
-            if (tagTrimming && insertToken.size() != 0)
-                insertAfterFirstToken(read.id, std::move(insertToken));
+            if (tagTrimming)
+                insertToken = ":TL:" + std::string(prefix(read.seq, head));
+            erase(read.seq, 0, head);
         }
-        else
-            clear(read.seq);
-    });
-
-    return removeShortSeqs(reads, min);
+        if (tail > 0)
+        {
+            seqLen = length(read.seq);
+            if (tagTrimming)
+                insertToken += ":TR:" + std::string(suffix(read.seq, seqLen - tail));
+            erase(read.seq, seqLen - tail, seqLen);
+        }
+        if (tagTrimming && insertToken.size() != 0)
+            insertAfterFirstToken(read.id, std::move(insertToken));
+    }
+    else
+        clear(read.seq);
 }
 
-template<template <typename> class TRead, typename TSeq, bool tagTrimming,
+template<bool tagTrimming, template <typename> class TRead, typename TSeq,
     typename = std::enable_if_t < std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same < TRead<TSeq>, ReadMultiplexPairedEnd < TSeq >> ::value >>
-unsigned int _preTrim(std::vector<TRead<TSeq>>& reads, const unsigned head, const unsigned tail, const unsigned min) noexcept(!tagTrimming)
+void preTrimRead(TRead<TSeq>& read, const unsigned head, const unsigned tail, std::string& tempString) noexcept(!tagTrimming)
 {
-    std::string tempString;
-    if(tagTrimming)
-        tempString.reserve(8 + head + tail);
-    std::for_each(reads.begin(), reads.end(), [head, tail, &tempString](auto& read)
+    if (read.minSeqLen() > (head + tail))
     {
-        if (read.minSeqLen() > (head + tail))
+        if (head > 0)
         {
-            std::string insertToken;
-            if (head > 0)
+            if (tagTrimming)
             {
-                if (tagTrimming)
-                {
-                    tempString = ":TL:";
-                    append(tempString, prefix(read.seq, std::min<int>(length(read.seq), head)));
-                    insertAfterFirstToken(read.id, std::move(tempString));
-                    tempString = ":TL:";
-                    append(tempString, prefix(read.seqRev, std::min<int>(length(read.seqRev), head)));
-                    insertAfterFirstToken(read.idRev, std::move(tempString));
-                }
-                erase(read.seq, 0, std::min<int>(length(read.seq),head));
-                erase(read.seqRev, 0, std::min<int>(length(read.seqRev),head));
+                tempString = ":TL:";
+                append(tempString, prefix(read.seq, std::min<int>(length(read.seq), head)));
+                insertAfterFirstToken(read.id, std::move(tempString));
+                tempString = ":TL:";
+                append(tempString, prefix(read.seqRev, std::min<int>(length(read.seqRev), head)));
+                insertAfterFirstToken(read.idRev, std::move(tempString));
             }
-            if (tail > 0)
-            {
-                const auto seqLen = length(read.seq);
-                const auto seqLenRev = length(read.seqRev);
-                if (tagTrimming)
-                {
-                    tempString = ":TR:";
-                    append(tempString, suffix(read.seq, std::max<int>(0, seqLen - tail)));
-                    insertAfterFirstToken(read.id, std::move(tempString));
-                    tempString = ":TR:";
-                    append(tempString, suffix(read.seqRev, std::max<int>(0, seqLenRev - tail)));
-                    insertAfterFirstToken(read.idRev, std::move(tempString));
-                }
-                erase(read.seq, std::max<int>(0, seqLen - tail), seqLen);
-                erase(read.seqRev, std::max<int>(0, seqLenRev - tail), seqLenRev);
-            }
-            if (tagTrimming && insertToken.size() != 0)
-                insertAfterFirstToken(read.id, std::move(insertToken));
+            erase(read.seq, 0, std::min<int>(length(read.seq),head));
+            erase(read.seqRev, 0, std::min<int>(length(read.seqRev),head));
         }
-        else
+        if (tail > 0)
         {
-            clear(read.seq);
-            clear(read.seqRev);
+            const auto seqLen = length(read.seq);
+            const auto seqLenRev = length(read.seqRev);
+            if (tagTrimming)
+            {
+                tempString = ":TR:";
+                append(tempString, suffix(read.seq, std::max<int>(0, seqLen - tail)));
+                insertAfterFirstToken(read.id, std::move(tempString));
+                tempString = ":TR:";
+                append(tempString, suffix(read.seqRev, std::max<int>(0, seqLenRev - tail)));
+                insertAfterFirstToken(read.idRev, std::move(tempString));
+            }
+            erase(read.seq, std::max<int>(0, seqLen - tail), seqLen);
+            erase(read.seqRev, std::max<int>(0, seqLenRev - tail), seqLenRev);
         }
-    });
+    }
+    else
+    {
+        clear(read.seq);
+        clear(read.seqRev);
+    }
+}
+
+template<template <typename> class TRead, typename TSeq, bool tagTrimming, typename TAlloc>
+unsigned int _preTrim(std::vector<TRead<TSeq>, TAlloc>& reads, const unsigned head, const unsigned tail, const unsigned min) noexcept(!tagTrimming)
+{
+    std::string insertToken;
+    if(tagTrimming)
+        insertToken.reserve(8 + head + tail);
+    for (auto& read : reads)
+        preTrimRead<tagTrimming>(read, head, tail, insertToken);
     return removeShortSeqs(reads, min);
 }
 
-template <template<typename> class TRead, typename TSeq, typename TStats>
-void preTrim(std::vector<TRead<TSeq>>& reads, const unsigned head, const unsigned tail, const unsigned min, const bool tagTrimming, TStats& stats)
+template <template<typename> class TRead, typename TSeq, typename TAlloc, typename TStats>
+void preTrim(std::vector<TRead<TSeq>, TAlloc>& reads, const unsigned head, const unsigned tail, const unsigned min, const bool tagTrimming, TStats& stats)
 {
     if(tagTrimming)
         stats.removedShort += _preTrim<TRead, TSeq, true>(reads, head, tail, min);
@@ -273,32 +308,34 @@ void preTrim(std::vector<TRead<TSeq>>& reads, const unsigned head, const unsigne
         stats.removedShort += _preTrim<TRead, TSeq, false>(reads, head, tail, min);
 }
 
-//Trims sequences to specific length and deletes to short ones together with their IDs
-template<template <typename> class TRead, typename TSeq, typename TStats,
+//Trims sequences to specific length, too short ones are removed by trimTo
+template<template <typename> class TRead, typename TSeq,
     typename = std::enable_if_t < std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same < TRead<TSeq>, ReadMultiplex < TSeq >> ::value >>
-void trimTo(std::vector<TRead<TSeq>>& reads, const unsigned len, TStats& stats, bool = true) noexcept
+void trimReadTo(TRead<TSeq>& read, const unsigned len, bool = true) noexcept
 {
-    for(auto& read : reads)
-        if (read.minSeqLen() > len)
-            erase(read.seq, len, length(read.seq));
-
-    stats.removedShort += removeShortSeqs(reads, len);
+    if (read.minSeqLen() > len)
+        erase(read.seq, len, length(read.seq));
 }
 
-template<template <typename> class TRead, typename TSeq, typename TStats,
+template<template <typename> class TRead, typename TSeq,
     typename = std::enable_if_t < std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same < TRead<TSeq>, ReadMultiplexPairedEnd < TSeq >> ::value >>
-void trimTo(std::vector<TRead<TSeq>>& reads, const unsigned len, TStats& stats) noexcept
+void trimReadTo(TRead<TSeq>& read, const unsigned len) noexcept
 {
-    for (auto& read : reads)
+    if (read.minSeqLen() > len)
     {
-            if (read.minSeqLen() > len)
-            {
-                if (length(read.seq) > len)
-                    erase(read.seq, len, length(read.seq));
-                if (length(read.seqRev) > len)
-                    erase(read.seqRev, len, length(read.seqRev));
-            }
+        if (length(read.seq) > len)
+            erase(read.seq, len, length(read.seq));
+        if (length(read.seqRev) > len)
+            erase(read.seqRev, len, length(read.seqRev));
     }
+}
+
+//Trims sequences to specific length and deletes to short ones together with their IDs
+template<template <typename> class TRead, typename TSeq, typename TAlloc, typename TStats>
+void trimTo(std::vector<TRead<TSeq>, TAlloc>& reads, const unsigned len, TStats& stats) noexcept
+{
+    for (auto& read : reads)
+        trimReadTo(read, len);
 
     stats.removedShort += removeShortSeqs(reads, len);
 }
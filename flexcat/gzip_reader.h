@@ -0,0 +1,479 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "fastq_reader.h"
+#include "ptc.h"
+
+/*
+- BGZF (blocked gzip, written by bgzip/samtools) is a series of gzip members of at most 64 KiB each
+- every member carries its compressed size in the 'BC' extra subfield, so block boundaries are known without inflating
+*/
+namespace bgzf
+{
+    const unsigned int headerSize = 18;
+    const unsigned int footerSize = 8;
+
+    inline unsigned int readUInt16(const unsigned char* p) noexcept
+    {
+        return p[0] | (p[1] << 8);
+    }
+    inline unsigned int readUInt32(const unsigned char* p) noexcept
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+    }
+
+    inline bool isBlockHeader(const unsigned char* header, const size_t size) noexcept
+    {
+        return size >= headerSize && header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0
+            && readUInt16(header + 10) >= 6 && header[12] == 'B' && header[13] == 'C' && readUInt16(header + 14) == 2;
+    }
+
+    // total size of the block including header and footer
+    inline unsigned int blockSize(const unsigned char* header) noexcept
+    {
+        return readUInt16(header + 16) + 1;
+    }
+}
+
+/*
+- inflates a gzip file on background threads and hands out the decompressed data in file order
+- BGZF input is split into jobs of several blocks by a reader thread, the jobs are inflated in parallel as tasks of a ptc::ThreadPool
+- plain gzip can only be inflated sequentially, this is done on one background thread so that inflation overlaps with parsing
+- the number of chunks in flight is bounded, so memory usage does not depend on the file size
+*/
+class GzipDecompressor
+{
+public:
+    using Chunk = std::vector<char>;
+
+private:
+    struct Job
+    {
+        unsigned int id;
+        std::vector<unsigned char> data;
+    };
+
+    static const size_t jobSize = 512 * 1024;            // compressed bytes per BGZF job
+    static const size_t sequentialChunkSize = 1 << 21;   // inflated bytes per chunk of plain gzip input
+
+    std::FILE* _file;
+    bool _bgzf;
+    unsigned int _maxInFlight;
+    ptc::ThreadPool* _pool;
+
+    std::mutex _mutex;
+    std::condition_variable _resultAvailable;
+    std::condition_variable _spaceAvailable;
+    std::condition_variable _taskFinished;
+    std::map<unsigned int, Chunk> _results;
+    unsigned int _nextJob;
+    unsigned int _nextResult;
+    unsigned int _numTasks;     // submitted to the pool and not yet finished
+    bool _inputDone;
+    bool _stop;
+    std::exception_ptr _error;
+    std::vector<std::thread> _threads;
+    std::vector<std::unique_ptr<z_stream>> _streams;    // idle inflate streams of the pool tasks
+
+    GzipDecompressor(const GzipDecompressor&) = delete;
+    GzipDecompressor& operator=(const GzipDecompressor&) = delete;
+
+    void setError(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error)
+                _error = error;
+            _inputDone = true;
+        }
+        _resultAvailable.notify_all();
+    }
+
+    void setInputDone()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _inputDone = true;
+        }
+        _resultAvailable.notify_all();
+    }
+
+    // blocks while too many chunks are in flight, returns false if the decompressor is shut down
+    bool waitForSpace(std::unique_lock<std::mutex>& lock)
+    {
+        _spaceAvailable.wait(lock, [this]() {return _stop || _nextJob - _nextResult < _maxInFlight; });
+        return !_stop;
+    }
+
+    // returns false if the decompressor is shut down, the caller stops reading then
+    bool submitJob(Job&& job)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!waitForSpace(lock))
+            return false;
+        job.id = _nextJob++;
+        ++_numTasks;
+        lock.unlock();
+        _pool->submit([this, job = std::move(job)]()
+        {
+            inflateJob(job);
+        });
+        return true;
+    }
+
+    bool submitResult(Chunk&& chunk)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!waitForSpace(lock))
+            return false;
+        _results.emplace(_nextJob++, std::move(chunk));
+        lock.unlock();
+        _resultAvailable.notify_all();
+        return true;
+    }
+
+    void readBgzfBlocks()
+    {
+        try
+        {
+            unsigned char header[bgzf::headerSize];
+            Job job;
+            size_t n;
+            while ((n = std::fread(header, 1, bgzf::headerSize, _file)) != 0)
+            {
+                if (!bgzf::isBlockHeader(header, n))
+                    throw std::runtime_error("Invalid BGZF block header.");
+                const unsigned int blockSize = bgzf::blockSize(header);
+                if (blockSize < bgzf::headerSize + bgzf::footerSize)
+                    throw std::runtime_error("Invalid BGZF block size.");
+                const size_t offset = job.data.size();
+                job.data.resize(offset + blockSize);
+                std::memcpy(&job.data[offset], header, bgzf::headerSize);
+                if (std::fread(&job.data[offset + bgzf::headerSize], 1, blockSize - bgzf::headerSize, _file) != blockSize - bgzf::headerSize)
+                    throw std::runtime_error("Unexpected end of BGZF file.");
+                if (job.data.size() >= jobSize)
+                {
+                    if (!submitJob(std::move(job)))
+                        return;
+                    job = Job();
+                }
+            }
+            if (!job.data.empty() && !submitJob(std::move(job)))
+                return;
+            setInputDone();
+        }
+        catch (...)
+        {
+            setError(std::current_exception());
+        }
+    }
+
+    static void inflateBgzfBlocks(z_stream& stream, const std::vector<unsigned char>& data, Chunk& out)
+    {
+        size_t outSize = 0;
+        for (size_t pos = 0; pos < data.size(); pos += bgzf::blockSize(&data[pos]))
+            outSize += bgzf::readUInt32(&data[pos + bgzf::blockSize(&data[pos]) - 4]);
+        out.resize(outSize);
+        size_t outPos = 0;
+        for (size_t pos = 0; pos < data.size(); pos += bgzf::blockSize(&data[pos]))
+        {
+            const unsigned char* block = &data[pos];
+            const unsigned int blockSize = bgzf::blockSize(block);
+            const unsigned int dataOffset = 12 + bgzf::readUInt16(block + 10);
+            const unsigned int crc = bgzf::readUInt32(block + blockSize - 8);
+            const unsigned int inflatedSize = bgzf::readUInt32(block + blockSize - 4);
+            if (dataOffset + bgzf::footerSize > blockSize)
+                throw std::runtime_error("Invalid BGZF block size.");
+            if (inflateReset(&stream) != Z_OK)
+                throw std::runtime_error("Error while inflating BGZF block.");
+            stream.next_in = const_cast<unsigned char*>(block + dataOffset);
+            stream.avail_in = blockSize - dataOffset - bgzf::footerSize;
+            stream.next_out = reinterpret_cast<unsigned char*>(out.data() + outPos);
+            stream.avail_out = inflatedSize;
+            if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_out != 0)
+                throw std::runtime_error("Error while inflating BGZF block.");
+            if (crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<unsigned char*>(out.data() + outPos), inflatedSize) != crc)
+                throw std::runtime_error("CRC mismatch in BGZF block.");
+            outPos += inflatedSize;
+        }
+    }
+
+    // runs on the pool, the job is skipped if the decompressor is shut down or has failed already
+    void inflateJob(const Job& job)
+    {
+        std::unique_ptr<z_stream> stream;
+        bool skip;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            skip = _stop || _error;
+            if (!skip && !_streams.empty())
+            {
+                stream = std::move(_streams.back());
+                _streams.pop_back();
+            }
+        }
+        if (!skip)
+        {
+            try
+            {
+                if (!stream)
+                {
+                    stream = std::make_unique<z_stream>();
+                    std::memset(stream.get(), 0, sizeof(z_stream));
+                    if (inflateInit2(stream.get(), -15) != Z_OK)     // raw deflate, the gzip framing is handled by inflateBgzfBlocks
+                    {
+                        stream.reset();
+                        throw std::runtime_error("Could not initialize zlib.");
+                    }
+                }
+                Chunk chunk;
+                inflateBgzfBlocks(*stream, job.data, chunk);
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _results.emplace(job.id, std::move(chunk));
+                }
+                _resultAvailable.notify_all();
+            }
+            catch (...)
+            {
+                setError(std::current_exception());
+            }
+        }
+        // under the lock, the decompressor can be destroyed as soon as the last task is finished
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (stream)
+            _streams.push_back(std::move(stream));
+        --_numTasks;
+        _taskFinished.notify_all();
+    }
+
+    void inflateSequential()
+    {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, 15 + 32) != Z_OK)     // +32: detect gzip or zlib header
+        {
+            setError(std::make_exception_ptr(std::runtime_error("Could not initialize zlib.")));
+            return;
+        }
+        try
+        {
+            std::vector<unsigned char> in(1 << 18);
+            Chunk out(sequentialChunkSize);
+            size_t outPos = 0;
+            int ret = Z_STREAM_END;
+            bool stopped = false;   // set when the decompressor is destroyed before the end of the file
+            while (true)
+            {
+                if (stream.avail_in == 0)
+                {
+                    stream.avail_in = static_cast<unsigned int>(std::fread(in.data(), 1, in.size(), _file));
+                    stream.next_in = in.data();
+                    if (stream.avail_in == 0)
+                        break;
+                }
+                stream.next_out = reinterpret_cast<unsigned char*>(out.data() + outPos);
+                stream.avail_out = static_cast<unsigned int>(out.size() - outPos);
+                ret = inflate(&stream, Z_NO_FLUSH);
+                if (ret == Z_STREAM_END)
+                    inflateReset(&stream);      // concatenated gzip members
+                else if (ret != Z_OK)
+                    throw std::runtime_error("Error while inflating gzip file.");
+                outPos = out.size() - stream.avail_out;
+                if (outPos == out.size())
+                {
+                    if (!submitResult(std::move(out)))
+                    {
+                        stopped = true;
+                        break;
+                    }
+                    out = Chunk(sequentialChunkSize);
+                    outPos = 0;
+                }
+            }
+            if (!stopped)
+            {
+                if (ret != Z_STREAM_END)
+                    throw std::runtime_error("Unexpected end of gzip file.");
+                out.resize(outPos);
+                if (out.empty() || submitResult(std::move(out)))
+                    setInputDone();
+            }
+        }
+        catch (...)
+        {
+            setError(std::current_exception());
+        }
+        inflateEnd(&stream);
+    }
+
+public:
+    GzipDecompressor() : _file(nullptr), _bgzf(false), _maxInFlight(0), _pool(nullptr), _nextJob(0), _nextResult(0), _numTasks(0), _inputDone(false), _stop(false) {};
+
+    ~GzipDecompressor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _spaceAvailable.notify_all();
+        for (auto& thread : _threads)
+            thread.join();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _taskFinished.wait(lock, [this]() {return _numTasks == 0; });
+        }
+        for (auto& stream : _streams)
+            inflateEnd(stream.get());
+        if (_file != nullptr)
+            std::fclose(_file);
+    }
+
+    // BGZF input is inflated on pool, plain gzip always on one background thread
+    bool open(const char* path, ptc::ThreadPool& pool)
+    {
+        _file = std::fopen(path, "rb");
+        if (_file == nullptr)
+            return false;
+        unsigned char header[bgzf::headerSize];
+        const size_t n = std::fread(header, 1, bgzf::headerSize, _file);
+        std::rewind(_file);
+        _bgzf = bgzf::isBlockHeader(header, n);
+        if (_bgzf)
+        {
+            _pool = &pool;
+            _maxInFlight = 2 * pool.size() + 2;
+            _threads.emplace_back(&GzipDecompressor::readBgzfBlocks, this);
+        }
+        else
+        {
+            _maxInFlight = 4;
+            _threads.emplace_back(&GzipDecompressor::inflateSequential, this);
+        }
+        return true;
+    }
+
+    bool isBgzf() const noexcept
+    {
+        return _bgzf;
+    }
+
+    // moves the next inflated chunk into chunk, returns false at the end of the file
+    bool next(Chunk& chunk)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _resultAvailable.wait(lock, [this]() {return _error || _results.count(_nextResult) != 0 || (_inputDone && _nextResult == _nextJob); });
+        if (_error)
+            std::rethrow_exception(_error);
+        const auto it = _results.find(_nextResult);
+        if (it == _results.end())
+            return false;
+        chunk.swap(it->second);
+        _results.erase(it);
+        ++_nextResult;
+        lock.unlock();
+        _spaceAvailable.notify_all();
+        return true;
+    }
+};
+
+/*
+- FASTQ reader on top of GzipDecompressor, record boundaries are found while the next chunks are inflated in the background
+- only the incomplete record at the end of a chunk is copied when the next chunk is appended
+*/
+class InflatingFastqReader : public FastqBatchReader
+{
+private:
+    GzipDecompressor _decompressor;
+    GzipDecompressor::Chunk _chunk;
+    std::vector<char> _buffer;
+    size_t _pos;
+    bool _eof;
+    std::vector<FastqRecordView> _batch;
+
+    static inline void rebase(StringView& view, const char* oldBase, const char* newBase) noexcept
+    {
+        view.ptr = newBase + (view.ptr - oldBase);
+    }
+
+    /*
+    - drops everything before batchBegin and appends the next chunk
+    - the views of the records already parsed in this batch are moved along
+    */
+    bool appendChunk(size_t& batchBegin, const unsigned int numRecords)
+    {
+        if (!_decompressor.next(_chunk))
+            return false;
+        const size_t keep = _buffer.size() - batchBegin;
+        const char* oldBase = _buffer.data() + batchBegin;
+        std::vector<char> grown;
+        const bool reallocate = keep + _chunk.size() > _buffer.capacity();
+        if (reallocate)
+        {
+            grown.reserve(2 * (keep + _chunk.size()));
+            grown.assign(_buffer.begin() + batchBegin, _buffer.end());
+        }
+        else
+            std::memmove(_buffer.data(), oldBase, keep);
+        const char* newBase = reallocate ? grown.data() : _buffer.data();
+        for (unsigned int i = 0; i < numRecords; ++i)
+        {
+            rebase(_batch[i].id, oldBase, newBase);
+            rebase(_batch[i].seq, oldBase, newBase);
+            rebase(_batch[i].qual, oldBase, newBase);
+        }
+        if (reallocate)
+            _buffer.swap(grown);
+        _buffer.resize(keep);
+        _buffer.insert(_buffer.end(), _chunk.begin(), _chunk.end());
+        _pos -= batchBegin;
+        batchBegin = 0;
+        return true;
+    }
+
+public:
+    InflatingFastqReader() : _pos(0), _eof(false) {};
+
+    bool open(const char* path, ptc::ThreadPool& pool)
+    {
+        return _decompressor.open(path, pool);
+    }
+
+    const std::vector<FastqRecordView>& readBatch(const unsigned int maxRecords) override
+    {
+        _batch.resize(maxRecords);
+        size_t batchBegin = _pos;
+        unsigned int numRecords = 0;
+        while (numRecords < maxRecords)
+        {
+            const char* cur = _buffer.data() + _pos;
+            if (parseFastqRecord(cur, _buffer.data() + _buffer.size(), _batch[numRecords], _eof))
+            {
+                _pos = cur - _buffer.data();
+                ++numRecords;
+            }
+            else if (_eof)
+                break;
+            else if (!appendChunk(batchBegin, numRecords))
+                _eof = true;
+        }
+        _batch.resize(numRecords);
+        return _batch;
+    }
+};
@@ -15,6 +15,9 @@
 
 #include "read.h"
 
+// seqan::Dna5Q stores the base in bits 0-1 and the quality in bits 2-7, N is a single value without quality
+const unsigned char DNA5Q_N = seqan::Dna5Q('N').value;
+
 template<typename T>
 struct function_traits
 {
@@ -146,6 +149,33 @@ std::string getPrefix(const TRead<TSeq>& read, unsigned len, bool = false) noexc
     return seqanToStd(read.demultiplex);
 }
 
+template <typename TRead>
+struct IsMultiplexRead : std::false_type {};
+template <typename TSeq>
+struct IsMultiplexRead<ReadMultiplex<TSeq>> : std::true_type {};
+template <typename TSeq>
+struct IsMultiplexRead<ReadMultiplexPairedEnd<TSeq>> : std::true_type {};
+
+template <typename TRead>
+struct IsPairedEndRead : std::false_type {};
+template <typename TSeq>
+struct IsPairedEndRead<ReadPairedEnd<TSeq>> : std::true_type {};
+template <typename TSeq>
+struct IsPairedEndRead<ReadMultiplexPairedEnd<TSeq>> : std::true_type {};
+
+// same as getPrefix, but returns the sequence holding the barcode without copying it
+template <template <typename> class TRead, typename TSeq, typename = std::enable_if_t<!IsMultiplexRead<TRead<TSeq>>::value>>
+const TSeq& getBarcodeSeq(const TRead<TSeq>& read) noexcept
+{
+    return read.seq;
+}
+
+template <template <typename> class TRead, typename TSeq, typename = std::enable_if_t<IsMultiplexRead<TRead<TSeq>>::value>>
+const TSeq& getBarcodeSeq(const TRead<TSeq>& read, bool = false) noexcept
+{
+    return read.demultiplex;
+}
+
 template <typename T>
 std::vector<T> operator+(const std::vector<T>& a, const std::vector<T>& b) noexcept
 {
@@ -178,8 +208,8 @@ void for_each_argument(F f, Ts&&... a) {
     std::make_tuple(f(std::forward<Ts>(a))...); 
 }
 
-template<typename Trem, typename TremVal, typename TRead>
-auto _eraseSeqs(const Trem& rem, const TremVal remVal, std::vector<TRead>& reads) noexcept
+template<typename Trem, typename TremVal, typename TRead, typename TAlloc>
+auto _eraseSeqs(const Trem& rem, const TremVal remVal, std::vector<TRead, TAlloc>& reads) noexcept
 {
     const auto oldSize = reads.size();
     auto it = rem.cbegin();
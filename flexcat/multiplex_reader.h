@@ -0,0 +1,147 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <seqan/sequence.h>
+#include <seqan/seq_io.h>
+
+/*
+- reads the barcodes of the multiplex file (-x) on a background thread, so the producer only reads the reads
+- the barcodes are read in batches of the same size as the read batches, the n-th call of next() belongs to the n-th batch of reads
+- at most maxInFlight batches are read ahead, batches returned by next() are recycled by the reader thread
+*/
+class AsyncMultiplexReader
+{
+public:
+    using Batch = std::vector<seqan::Dna5QString>;
+
+private:
+    static const unsigned int maxInFlight = 4;
+
+    seqan::SeqFileIn _file;
+    unsigned int _records;
+
+    std::mutex _mutex;
+    std::condition_variable _batchAvailable;
+    std::condition_variable _spaceAvailable;
+    std::deque<Batch> _batches;
+    std::vector<Batch> _free;
+    Batch _current;
+    bool _inputDone;
+    bool _stop;
+    std::exception_ptr _error;
+    std::thread _thread;
+
+    AsyncMultiplexReader(const AsyncMultiplexReader&) = delete;
+    AsyncMultiplexReader& operator=(const AsyncMultiplexReader&) = delete;
+
+    void readBatches()
+    {
+        try
+        {
+            seqan::CharString id;
+            bool eof = false;
+            while (!eof)
+            {
+                Batch batch;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _spaceAvailable.wait(lock, [this]() {return _stop || _batches.size() < maxInFlight; });
+                    if (_stop)
+                        return;
+                    if (!_free.empty())
+                    {
+                        batch.swap(_free.back());
+                        _free.pop_back();
+                    }
+                }
+                batch.resize(_records);
+                unsigned int i = 0;
+                while (i < _records && !atEnd(_file))
+                {
+                    readRecord(id, batch[i], _file);
+                    ++i;
+                }
+                batch.resize(i);
+                eof = i < _records;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (!batch.empty())
+                        _batches.push_back(std::move(batch));
+                    _inputDone = eof;
+                }
+                _batchAvailable.notify_one();
+            }
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _error = std::current_exception();
+                _inputDone = true;
+            }
+            _batchAvailable.notify_one();
+        }
+    }
+
+public:
+    AsyncMultiplexReader() : _records(0), _inputDone(false), _stop(false) {};
+
+    ~AsyncMultiplexReader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _spaceAvailable.notify_all();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    // records is the number of reads per batch
+    bool open(const char* path, const unsigned int records)
+    {
+        if (!seqan::open(_file, path))
+            return false;
+        _records = records;
+        _thread = std::thread(&AsyncMultiplexReader::readBatches, this);
+        return true;
+    }
+
+    bool isOpen() const noexcept
+    {
+        return _thread.joinable();
+    }
+
+    // the returned batch stays valid until the next call, it is empty at the end of the file
+    Batch& next()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_current.empty())
+        {
+            _free.emplace_back();
+            _free.back().swap(_current);
+        }
+        _batchAvailable.wait(lock, [this]() {return _error || !_batches.empty() || _inputDone; });
+        // the batches read before the error are handed out first, the error belongs to the batch after them
+        if (!_batches.empty())
+        {
+            _current.swap(_batches.front());
+            _batches.pop_front();
+        }
+        else if (_error)
+            std::rethrow_exception(_error);
+        lock.unlock();
+        _spaceAvailable.notify_one();
+        return _current;
+    }
+};
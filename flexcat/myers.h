@@ -0,0 +1,142 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/*
+- Myers' bit-vector algorithm for the edit distance of a pattern against a text
+- one column of the DP matrix is stored as vertical deltas in pv (+1) and mv (-1) bit vectors
+- patterns longer than 64 are split into blocks which pass the horizontal delta of their last row on to the next block (Hyyroe)
+- characters are ordinal values 0-3 for ACGT and 4 for N, N matches every base in pattern and text
+*/
+namespace myers
+{
+    const unsigned int alphabetSize = 5;
+    const unsigned int blockSize = 64;
+    const unsigned int maxBlocks = 4;   // AdapterItem stores the adapter length in an unsigned char
+    const unsigned int maxLength = blockSize * maxBlocks;
+
+    struct Pattern
+    {
+        std::array<uint64_t, alphabetSize * maxBlocks> peq;
+        unsigned int length;
+        unsigned int numBlocks;
+        uint64_t lastBit;   // bit of the last pattern position in the last block
+    };
+
+    struct State
+    {
+        std::array<uint64_t, maxBlocks> pv;
+        std::array<uint64_t, maxBlocks> mv;
+        int score;      // distance of the whole pattern at the current column
+    };
+
+    // getOrdValue(i) returns the ordinal value of pattern position i, length must not exceed maxLength
+    template <typename TGetOrdValue>
+    inline void buildPattern(Pattern& pattern, const unsigned int length, TGetOrdValue getOrdValue) noexcept
+    {
+        pattern.peq.fill(0);
+        pattern.length = length;
+        pattern.numBlocks = (length + blockSize - 1) / blockSize;
+        pattern.lastBit = uint64_t(1) << ((length - 1) % blockSize);
+        for (unsigned int i = 0; i < length; ++i)
+        {
+            const unsigned int block = i / blockSize;
+            const uint64_t bit = uint64_t(1) << (i % blockSize);
+            const unsigned int ordValue = getOrdValue(i);
+            for (unsigned int c = 0; c < alphabetSize; ++c)
+                if (ordValue == 4 || ordValue == c || c == 4)
+                    pattern.peq[c * maxBlocks + block] |= bit;
+        }
+    }
+
+    // column before the first text character, D[i][-1] = i
+    inline void initState(State& state, const Pattern& pattern) noexcept
+    {
+        state.pv.fill(~uint64_t(0));
+        state.mv.fill(0);
+        state.score = pattern.length;
+    }
+
+    // advances one block by one text column, hin is the horizontal delta entering the first row of the block
+    inline int advanceBlock(uint64_t& pv, uint64_t& mv, uint64_t eq, const int hin, const uint64_t highBit) noexcept
+    {
+        if (hin < 0)
+            eq |= 1;
+        const uint64_t xv = eq | mv;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        const int hout = (ph & highBit) ? 1 : ((mh & highBit) ? -1 : 0);
+        ph <<= 1;
+        mh <<= 1;
+        if (hin < 0)
+            mh |= 1;
+        else if (hin > 0)
+            ph |= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        return hout;
+    }
+
+    /*
+    - advances the state by the text character ordValue
+    - anchoredStart = false: the alignment can start anywhere in the text (D[0][j] = 0)
+    - anchoredStart = true: the alignment starts at the first text character (D[0][j] = j + 1)
+    */
+    inline void advance(State& state, const Pattern& pattern, const unsigned int ordValue, const bool anchoredStart) noexcept
+    {
+        int carry = anchoredStart ? 1 : 0;
+        const unsigned int lastBlock = pattern.numBlocks - 1;
+        for (unsigned int block = 0; block < lastBlock; ++block)
+            carry = advanceBlock(state.pv[block], state.mv[block], pattern.peq[ordValue * maxBlocks + block], carry, uint64_t(1) << (blockSize - 1));
+        carry = advanceBlock(state.pv[lastBlock], state.mv[lastBlock], pattern.peq[ordValue * maxBlocks + lastBlock], carry, pattern.lastBit);
+        state.score += carry;
+    }
+
+    // distances of all pattern prefixes at the current column for a search with free start, prefixScores[i] belongs to the prefix of length i
+    template <typename TScores>
+    inline void getPrefixScores(TScores& prefixScores, const State& state, const Pattern& pattern) noexcept
+    {
+        int score = 0;
+        prefixScores[0] = 0;
+        for (unsigned int i = 0; i < pattern.length; ++i)
+        {
+            const uint64_t bit = uint64_t(1) << (i % blockSize);
+            if (state.pv[i / blockSize] & bit)
+                ++score;
+            else if (state.mv[i / blockSize] & bit)
+                --score;
+            prefixScores[i + 1] = score;
+        }
+    }
+
+    /*
+    - aligns the whole pattern to the text, starting at the first text character
+    - returns the length of the text prefix for which the distance equals distance, the one closest to the pattern length is preferred
+    - distance has to be reachable, e.g. the distance of the same alignment found by a search in the opposite direction
+    */
+    template <typename TGetOrdValue>
+    inline unsigned int findAlignedLength(const Pattern& pattern, const unsigned int maxTextLength, TGetOrdValue getOrdValue, const int distance) noexcept
+    {
+        State state;
+        initState(state, pattern);
+        unsigned int alignedLength = 0;
+        unsigned int minDifference = state.score == distance ? pattern.length : maxLength;
+        for (unsigned int k = 0; k < maxTextLength; ++k)
+        {
+            advance(state, pattern, getOrdValue(k), true);
+            const unsigned int difference = k + 1 > pattern.length ? k + 1 - pattern.length : pattern.length - k - 1;
+            if (state.score == distance && difference < minDifference)
+            {
+                alignedLength = k + 1;
+                minDifference = difference;
+            }
+        }
+        return alignedLength;
+    }
+}
@@ -0,0 +1,290 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Pipeline of an arbitrary number of stages, built from the ptc containers.
+// A serial source produces the items, every following stage gets its own bounded
+// input channel and its own threads, the last stage is the sink. Example:
+//
+//   ptc::make_pipeline(readBlock)
+//       .then(ptc::parallel(4, ptc::StageOrder::ordered), inflate)
+//       .then(ptc::serial(), parse)
+//       .then(ptc::parallel(8, ptc::StageOrder::unordered), process)
+//       .then(ptc::serial(), write)
+//       .run();
+//
+// - the source is called as std::unique_ptr<T>() and returns nullptr at the end
+// - a stage is called as std::unique_ptr<U>(std::unique_ptr<T>), returning nullptr drops the item
+// - the last stage returns void
+// ==========================================================================
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ptc.h"
+
+namespace ptc
+{
+    enum class StageOrder
+    {
+        ordered,    // results are handed to the next stage in the order the inputs arrived
+        unordered   // results are handed on as soon as they are ready
+    };
+
+    struct StageSpec
+    {
+        unsigned int numThreads;
+        StageOrder order;
+        unsigned int queueDepth;    // size of the input channel of the stage
+    };
+
+    // one thread, keeps the order of its input
+    inline StageSpec serial(const unsigned int queueDepth = 4) noexcept
+    {
+        return StageSpec{ 1, StageOrder::ordered, queueDepth };
+    }
+
+    inline StageSpec parallel(const unsigned int numThreads, const StageOrder order, unsigned int queueDepth = 0) noexcept
+    {
+        if (queueDepth == 0)
+            queueDepth = numThreads * 2;
+        return StageSpec{ std::max(numThreads, 1u), order, queueDepth };
+    }
+
+    /*
+    - bounded multi producer multi consumer channel between two stages
+    - pop() blocks until an item is available or the channel is closed and empty
+    - the position returned by pop() numbers the items in the order they were pushed
+    */
+    template <typename TItem>
+    class Channel
+    {
+    private:
+        RingBuffer<TItem, InputPolicy::multi, OutputPolicy::multi, DefaultWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no> _items;
+        WaitManager<DefaultWaitPolicy> _itemAvailable;
+        std::atomic_bool _closed;
+        const unsigned int _numConsumers;
+    public:
+        Channel(const unsigned int queueDepth, const unsigned int numConsumers) : _items(queueDepth), _closed(false), _numConsumers(numConsumers) {};
+
+        void push(std::unique_ptr<TItem> item)
+        {
+            _items.insert(std::move(item));
+            _itemAvailable.signal();
+        }
+        bool pop(std::unique_ptr<TItem>& item, size_t& position)
+        {
+            while (true)
+            {
+                // read before try_retrieve, all items are pushed before close()
+                const bool closed = _closed.load(std::memory_order_acquire);
+                if (_items.try_retrieve(item, position))
+                    return true;
+                if (closed)
+                    return false;
+                _itemAvailable.wait();
+            }
+        }
+        void close()
+        {
+            _closed.store(true, std::memory_order_release);
+            _itemAvailable.signal(_numConsumers);
+        }
+    };
+
+    /*
+    - output side of a stage, unordered results go straight into the channel of the next stage
+    - ordered results go through a ReorderRing, whoever completes the next expected item drains the ring into the channel,
+      so no extra thread is needed, the _draining flag makes sure that only one thread drains at a time
+    */
+    template <typename TItem>
+    class StageOutput
+    {
+    private:
+        using ordered_item_type = mypair<std::unique_ptr<TItem>, size_t>;
+        Channel<TItem>& _channel;
+        const bool _ordered;
+        ReorderRing<ordered_item_type> _reorderRing;
+        std::atomic_bool _draining;
+
+        void drain()
+        {
+            std::unique_ptr<ordered_item_type> item;
+            while (!_draining.exchange(true))
+            {
+                while (_reorderRing.try_retrieve(item))
+                    if (item->first != nullptr)     // dropped items keep their place in the order
+                        _channel.push(std::move(item->first));
+                _draining.store(false);
+                // the next item could have arrived while the flag was still set
+                if (!_reorderRing.ready())
+                    return;
+            }
+        }
+    public:
+        StageOutput(Channel<TItem>& channel, const StageSpec& spec)
+            : _channel(channel), _ordered(spec.order == StageOrder::ordered && spec.numThreads > 1), _reorderRing(spec.numThreads), _draining(false) {};
+
+        void emit(std::unique_ptr<TItem> item, size_t position)
+        {
+            if (!_ordered)
+            {
+                if (item != nullptr)
+                    _channel.push(std::move(item));
+                return;
+            }
+            if (_reorderRing.insert(std::make_unique<ordered_item_type>(item, position)))
+                drain();
+        }
+        void close()
+        {
+            _channel.close();
+        }
+    };
+
+    template <typename TFunc>
+    struct StageDef
+    {
+        StageSpec spec;
+        TFunc func;
+    };
+
+    template <typename TIn, typename... TStageDefs>
+    class StageChain;
+
+    // the sink, an ordered sink is always run with one thread, otherwise the calls could not be ordered
+    template <typename TIn, typename TFunc>
+    class StageChain<TIn, StageDef<TFunc>>
+    {
+    private:
+        TFunc& _func;
+        const unsigned int _numThreads;
+        Channel<TIn> _input;
+        std::vector<std::thread> _threads;
+    public:
+        StageChain(StageDef<TFunc>& def)
+            : _func(def.func), _numThreads(def.spec.order == StageOrder::ordered ? 1 : def.spec.numThreads),
+            _input(def.spec.queueDepth, _numThreads), _threads(_numThreads) {};
+
+        Channel<TIn>& input() noexcept
+        {
+            return _input;
+        }
+        void start()
+        {
+            for (auto& thread : _threads)
+            {
+                thread = std::thread([this]()
+                {
+                    std::unique_ptr<TIn> item;
+                    size_t position;
+                    while (_input.pop(item, position))
+                        _func(std::move(item));
+                });
+            }
+        }
+        void join()
+        {
+            for (auto& thread : _threads)
+                if (thread.joinable())
+                    thread.join();
+        }
+    };
+
+    template <typename TIn, typename TFunc, typename TNextDef, typename... TRest>
+    class StageChain<TIn, StageDef<TFunc>, TNextDef, TRest...>
+    {
+    private:
+        using TOut = typename std::result_of_t<TFunc&(std::unique_ptr<TIn>)>::element_type;
+
+        StageChain<TOut, TNextDef, TRest...> _next;     // constructed first, its input channel is the output of this stage
+        TFunc& _func;
+        Channel<TIn> _input;
+        StageOutput<TOut> _output;
+        std::atomic<unsigned int> _running;
+        std::vector<std::thread> _threads;
+    public:
+        StageChain(StageDef<TFunc>& def, TNextDef& nextDef, TRest&... rest)
+            : _next(nextDef, rest...), _func(def.func), _input(def.spec.queueDepth, def.spec.numThreads),
+            _output(_next.input(), def.spec), _running(def.spec.numThreads), _threads(def.spec.numThreads) {};
+
+        Channel<TIn>& input() noexcept
+        {
+            return _input;
+        }
+        void start()
+        {
+            _next.start();
+            for (auto& thread : _threads)
+            {
+                thread = std::thread([this]()
+                {
+                    std::unique_ptr<TIn> item;
+                    size_t position;
+                    while (_input.pop(item, position))
+                        _output.emit(_func(std::move(item)), position);
+                    // the last thread closes the channel, all items of the other threads are emitted by now
+                    if (_running.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        _output.close();
+                });
+            }
+        }
+        void join()
+        {
+            for (auto& thread : _threads)
+                if (thread.joinable())
+                    thread.join();
+            _next.join();
+        }
+    };
+
+    template <typename TSource, typename... TStageDefs>
+    class Pipeline
+    {
+    private:
+        TSource _source;
+        std::tuple<TStageDefs...> _stages;
+
+        using source_item_type = typename std::result_of_t<TSource&()>::element_type;
+
+        template <size_t... I>
+        void run(std::index_sequence<I...>)
+        {
+            StageChain<source_item_type, TStageDefs...> chain(std::get<I>(_stages)...);
+            Channel<source_item_type>& channel = chain.input();
+            chain.start();
+            while (auto item = _source())
+                channel.push(std::move(item));
+            channel.close();
+            chain.join();
+        }
+    public:
+        Pipeline(TSource source, std::tuple<TStageDefs...> stages) : _source(std::move(source)), _stages(std::move(stages)) {};
+
+        template <typename TFunc>
+        auto then(const StageSpec& spec, TFunc func) &&
+        {
+            return Pipeline<TSource, TStageDefs..., StageDef<TFunc>>(std::move(_source),
+                std::tuple_cat(std::move(_stages), std::make_tuple(StageDef<TFunc>{ spec, std::move(func) })));
+        }
+
+        // the source is run on the calling thread, returns when the last stage has processed all items
+        void run()
+        {
+            static_assert(sizeof...(TStageDefs) > 0, "a pipeline needs at least one stage after the source");
+            run(std::index_sequence_for<TStageDefs...>());
+        }
+    };
+
+    template <typename TSource>
+    auto make_pipeline(TSource source)
+    {
+        return Pipeline<TSource>(std::move(source), std::tuple<>());
+    }
+}
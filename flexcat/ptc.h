@@ -6,9 +6,23 @@
 // ==========================================================================
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <future>
 #include <functional>
-#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <boost/lockfree/queue.hpp>
 
@@ -39,6 +53,19 @@ namespace ptc
         struct Sleep {};
         struct Semaphore {};
         struct Spin {};
+        struct Futex {};    // event count with adaptive spinning, falls back to Semaphore on other platforms than linux
+    }
+#if defined(__linux__)
+    using DefaultWaitPolicy = WaitPolicy::Futex;
+#else
+    using DefaultWaitPolicy = WaitPolicy::Semaphore;
+#endif
+
+    // Default uses Slots or LockfreeQueue depending on the OrderPolicy, RingBuffer is used for every OrderPolicy
+    namespace ContainerPolicy
+    {
+        struct Default {};
+        struct RingBuffer {};
     }
     constexpr unsigned int defaultSleepMS = 10;
 
@@ -166,6 +193,147 @@ namespace ptc
         }
     };
 
+    // process wide counters of WaitManager<WaitPolicy::Futex>, waits that could be satisfied without waiting are not counted
+    struct WaitStats
+    {
+        unsigned long long spinWaits = 0;       // waits that ended while spinning
+        unsigned long long spinIterations = 0;
+        unsigned long long sleepWaits = 0;      // waits that had to sleep in the kernel
+        double sleepTime = 0;                   // seconds
+    };
+
+    struct WaitCounters
+    {
+        std::atomic<unsigned long long> spinWaits{ 0 };
+        std::atomic<unsigned long long> spinIterations{ 0 };
+        std::atomic<unsigned long long> sleepWaits{ 0 };
+        std::atomic<unsigned long long> sleepNs{ 0 };
+    };
+
+    inline WaitCounters& waitCounters() noexcept
+    {
+        static WaitCounters counters;
+        return counters;
+    }
+
+    inline WaitStats waitStats() noexcept
+    {
+        const WaitCounters& counters = waitCounters();
+        WaitStats stats;
+        stats.spinWaits = counters.spinWaits.load(std::memory_order_relaxed);
+        stats.spinIterations = counters.spinIterations.load(std::memory_order_relaxed);
+        stats.sleepWaits = counters.sleepWaits.load(std::memory_order_relaxed);
+        stats.sleepTime = counters.sleepNs.load(std::memory_order_relaxed) * 1e-9;
+        return stats;
+    }
+
+#if defined(__linux__)
+    /*
+    - counting like a semaphore, but the sleeping is done on a futex event count, signal() only enters the kernel if somebody sleeps
+    - the spin limit adapts to the recent waits, it grows if spinning succeeded or if the recent kernel waits were shorter
+      than the time spent spinning before them, otherwise it shrinks, so waiting for a slow reader or writer does not burn cycles
+    */
+    template <>
+    struct WaitManager<WaitPolicy::Futex>
+    {
+    private:
+        static constexpr unsigned int _minSpin = 16;
+        static constexpr unsigned int _maxSpin = 8192;
+
+        std::atomic<int> _count;
+        std::atomic<unsigned int> _spinLimit;
+        std::atomic<unsigned long long> _avgSleepNs;
+        FutexEventCount _event;
+
+        inline bool tryTake() noexcept
+        {
+            int count = _count.load(std::memory_order_relaxed);
+            while (count > 0)
+                if (_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                    return true;
+            return false;
+        }
+        static inline void pause() noexcept
+        {
+#if defined(__SSE2__)
+            _mm_pause();
+#else
+            std::atomic_signal_fence(std::memory_order_acquire);
+#endif
+        }
+        bool spin(WaitCounters& counters, const unsigned int spinLimit) noexcept
+        {
+            for (unsigned int i = 1; i <= spinLimit; ++i)
+            {
+                pause();
+                if (tryTake())
+                {
+                    counters.spinWaits.fetch_add(1, std::memory_order_relaxed);
+                    counters.spinIterations.fetch_add(i, std::memory_order_relaxed);
+                    if (spinLimit < _maxSpin)
+                        _spinLimit.store(spinLimit + spinLimit / 8, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            counters.spinIterations.fetch_add(spinLimit, std::memory_order_relaxed);
+            return false;
+        }
+        void sleep(WaitCounters& counters, const unsigned int spinLimit, const unsigned long long spinNs) noexcept
+        {
+            const auto t1 = std::chrono::steady_clock::now();
+            while (true)
+            {
+                const auto key = _event.prepareWait();
+                if (tryTake())
+                {
+                    _event.cancelWait();
+                    break;
+                }
+                _event.commitWait(key);
+            }
+            const unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t1).count();
+            counters.sleepWaits.fetch_add(1, std::memory_order_relaxed);
+            counters.sleepNs.fetch_add(ns, std::memory_order_relaxed);
+
+            const unsigned long long avgSleepNs = (_avgSleepNs.load(std::memory_order_relaxed) * 7 + ns) / 8;
+            _avgSleepNs.store(avgSleepNs, std::memory_order_relaxed);
+            // no std::min/max, they take references and the constants have no definition outside the class
+            if (avgSleepNs < spinNs)    // spinning a bit longer would have been cheaper than sleeping
+                _spinLimit.store(spinLimit * 2 < _maxSpin ? spinLimit * 2 : _maxSpin, std::memory_order_relaxed);
+            else
+                _spinLimit.store(spinLimit / 2 > _minSpin ? spinLimit / 2 : _minSpin, std::memory_order_relaxed);
+        }
+    public:
+        WaitManager() : _count(0), _spinLimit(128), _avgSleepNs(0) {};
+
+        inline void signal() noexcept {
+            _count.fetch_add(1, std::memory_order_release);
+            _event.notify();
+        }
+        inline void signal(const unsigned int n) noexcept {
+            _count.fetch_add(static_cast<int>(n), std::memory_order_release);
+            _event.notify(static_cast<int>(n));
+        }
+        void wait() noexcept {
+            if (tryTake())
+                return;
+            WaitCounters& counters = waitCounters();
+            const unsigned int spinLimit = _spinLimit.load(std::memory_order_relaxed);
+            const auto t1 = std::chrono::steady_clock::now();
+            if (spin(counters, spinLimit))
+                return;
+            const unsigned long long spinNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t1).count();
+            sleep(counters, spinLimit, spinNs);
+        }
+        inline bool probably_available() const noexcept {
+            return _count.load(std::memory_order_relaxed) > 0;
+        }
+    };
+#else
+    template <>
+    struct WaitManager<WaitPolicy::Futex> : public WaitManager<WaitPolicy::Semaphore> {};
+#endif
+
     template <>
     struct WaitManager<WaitPolicy::Sleep>
     {
@@ -271,13 +439,12 @@ namespace ptc
                     return;
                 _item_available.wait();
             }
-            return true;
         }
         bool try_retrieve(std::unique_ptr<TItem>& retrieve_item) noexcept {
             TItem* temp = nullptr;
             for (auto& item : _items)
             {
-                if ((temp = item.load(std::memory_order_relaxed)) != nullptr)
+                if ((temp = item.load(std::memory_order_acquire)) != nullptr)
                 {
                     if (outputPolicy == OutputPolicy::single)
                     {
@@ -338,7 +505,7 @@ namespace ptc
             while (true)
             {
                 if(try_retrieve(item))
-                    return true;
+                    return;
                 _item_available.wait();
             }
         }
@@ -355,31 +522,419 @@ namespace ptc
         }
     };
 
+    /*
+    - bounded MPMC ring buffer by Dmitry Vyukov, every cell has a sequence number that tells producers and consumers if it is free
+    - producers and consumers only contend on their own position counter and on the cell they use, not on all slots like Slots does
+    - the cells and the two positions are padded to separate cache lines, the capacity is rounded up to a power of two
+    - with InputPolicy::single or OutputPolicy::single the position of that side is advanced without CAS
+    */
+    template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy,
+        BlockingInsert blockingInsert = BlockingInsert::yes, BlockingRetrieve blockingRetrieve = BlockingRetrieve::yes>
+    struct RingBuffer
+    {
+    private:
+        static const size_t cacheLineSize = 64;
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            TItem* item;
+            char pad[cacheLineSize - sizeof(std::atomic<size_t>) - sizeof(TItem*)];
+        };
+
+        std::unique_ptr<char[]> _buffer;    // new[] does not respect the alignment of Cell, so the cells are placed manually
+        Cell* _cells;
+        size_t _mask;
+        char _pad0[cacheLineSize];
+        std::atomic<size_t> _insertPos;
+        char _pad1[cacheLineSize - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> _retrievePos;
+        char _pad2[cacheLineSize - sizeof(std::atomic<size_t>)];
+        WaitManager<TWaitPolicy> _slot_available;
+        WaitManager<TWaitPolicy> _item_available;
+
+        static size_t capacity(const unsigned int numSlots) noexcept
+        {
+            size_t size = 2;
+            while (size < numSlots)
+                size *= 2;
+            return size;
+        }
+    public:
+        RingBuffer(const unsigned int numSlots) : _buffer(new char[(capacity(numSlots) + 1) * cacheLineSize]), _mask(capacity(numSlots) - 1), _insertPos(0), _retrievePos(0)
+        {
+            void* aligned = _buffer.get();
+            size_t space = (_mask + 2) * cacheLineSize;
+            _cells = reinterpret_cast<Cell*>(std::align(cacheLineSize, (_mask + 1) * sizeof(Cell), aligned, space));
+            for (size_t i = 0; i <= _mask; ++i)
+            {
+                new (&_cells[i]) Cell;
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+                _cells[i].item = nullptr;
+            }
+        }
+        ~RingBuffer()
+        {
+            std::unique_ptr<TItem> item;
+            while (try_retrieve(item))  // items that were never retrieved
+                item.reset();
+        }
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        bool try_insert(std::unique_ptr<TItem>& insert_item) noexcept {
+            size_t pos = _insertPos.load(std::memory_order_relaxed);
+            Cell* cell;
+            while (true)
+            {
+                cell = &_cells[pos & _mask];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (inputPolicy == InputPolicy::single)
+                    {
+                        _insertPos.store(pos + 1, std::memory_order_relaxed);
+                        break;
+                    }
+                    if (_insertPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;   // full
+                else
+                    pos = _insertPos.load(std::memory_order_relaxed);
+            }
+            cell->item = insert_item.release();
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            if (blockingRetrieve == BlockingRetrieve::yes)
+                _item_available.signal();
+            return true;
+        }
+        template<BlockingInsert _bi = blockingInsert, typename = std::enable_if_t<_bi == BlockingInsert::yes>>
+        void insert(std::unique_ptr<TItem> item) noexcept {
+            while (true)
+            {
+                if (try_insert(item))
+                    return;
+                _slot_available.wait();
+            }
+        }
+        template<BlockingRetrieve _br = blockingRetrieve, typename = std::enable_if_t<_br == BlockingRetrieve::yes>>
+        void retrieve(std::unique_ptr<TItem>& item) noexcept {
+            while (true)
+            {
+                if (try_retrieve(item))
+                    return;
+                _item_available.wait();
+            }
+        }
+        bool try_retrieve(std::unique_ptr<TItem>& retrieve_item) noexcept {
+            size_t position;
+            return try_retrieve(retrieve_item, position);
+        }
+        // position is the sequence number of the item, items are retrieved in the order they were inserted
+        bool try_retrieve(std::unique_ptr<TItem>& retrieve_item, size_t& position) noexcept {
+            size_t pos = _retrievePos.load(std::memory_order_relaxed);
+            Cell* cell;
+            while (true)
+            {
+                cell = &_cells[pos & _mask];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0)
+                {
+                    if (outputPolicy == OutputPolicy::single)
+                    {
+                        _retrievePos.store(pos + 1, std::memory_order_relaxed);
+                        break;
+                    }
+                    if (_retrievePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;   // empty
+                else
+                    pos = _retrievePos.load(std::memory_order_relaxed);
+            }
+            retrieve_item.reset(cell->item);
+            position = pos;
+            cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+            if (blockingInsert == BlockingInsert::yes)
+                _slot_available.signal();
+            return true;
+        }
+    };
+
     // todo: use CRTP for better interface
-    template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy, typename TOrderPolicy>
+    template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy, typename TOrderPolicy,
+        typename TContainerPolicy = ContainerPolicy::Default>
     struct ContainerSelector : public Slots<TItem, inputPolicy, outputPolicy, TWaitPolicy>
     {
     };
 
     template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy>
-    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, OrderPolicy::Unordered> : public Slots<TItem, inputPolicy, outputPolicy, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
+    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, OrderPolicy::Unordered, ContainerPolicy::Default> : public Slots<TItem, inputPolicy, outputPolicy, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
     {
         ContainerSelector(const unsigned int size) : Slots<TItem, inputPolicy, outputPolicy, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>(size) {};
     };
 
     // note: using a slot for unordered mode is a lot faster than using a lockfree queue (depending on compiler and system)
     template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy>
-    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, OrderPolicy::Unordered_use_queue> : public LockfreeQueue<TItem, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
+    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, OrderPolicy::Unordered_use_queue, ContainerPolicy::Default> : public LockfreeQueue<TItem, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
     {
         ContainerSelector(const unsigned int size) : LockfreeQueue<TItem, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>(size) {};
     };
 
     template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy>
-    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, OrderPolicy::Ordered> : public LockfreeQueue<TItem, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
+    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, OrderPolicy::Ordered, ContainerPolicy::Default> : public LockfreeQueue<TItem, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
     {
         ContainerSelector(const unsigned int size) : LockfreeQueue<TItem, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>(size) {};
     };
 
+    template<typename TItem, InputPolicy inputPolicy, OutputPolicy outputPolicy, typename TWaitPolicy, typename TOrderPolicy>
+    struct ContainerSelector<TItem, inputPolicy, outputPolicy, TWaitPolicy, TOrderPolicy, ContainerPolicy::RingBuffer> : public RingBuffer<TItem, inputPolicy, outputPolicy, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>
+    {
+        ContainerSelector(const unsigned int size) : RingBuffer<TItem, inputPolicy, outputPolicy, TWaitPolicy, BlockingInsert::yes, BlockingRetrieve::no>(size) {};
+    };
+
+
+    /*
+    - reorder buffer of the ordered mode, the transformer threads put the items directly at id % window
+    - the consumer only has to be woken up if the next expected item arrives, items that are further ahead wait in their slot
+    - a transformer thread blocks if its item is a whole window ahead, this can not deadlock, because the items are handed
+      out in id order, so the next expected item is never held by a blocked thread
+    */
+    template <typename TItem>
+    struct ReorderRing
+    {
+    private:
+        using id_t = decltype(std::declval<TItem>().second);
+        std::vector<std::atomic<TItem*>> _items;
+        const id_t _mask;
+        std::atomic<id_t> _next;
+        std::atomic<unsigned int> _numBlocked;
+        std::mutex _mutex;
+        std::condition_variable _windowMoved;
+
+        static id_t windowSize(const unsigned int numSlots) noexcept
+        {
+            id_t size = 16;
+            while (size < 4 * numSlots)
+                size *= 2;
+            return size;
+        }
+    public:
+        ReorderRing(const unsigned int numSlots) : _items(windowSize(numSlots)), _mask(windowSize(numSlots) - 1), _next(0), _numBlocked(0) {};
+        ~ReorderRing()
+        {
+            for (auto& item : _items)
+                delete item.load(std::memory_order_relaxed);
+        }
+
+        // returns true if the item is the next expected one, the consumer has to be woken up then
+        bool insert(std::unique_ptr<TItem> item)
+        {
+            const id_t id = item->second;
+            if (id - _next.load(std::memory_order_acquire) > _mask)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                ++_numBlocked;
+                _windowMoved.wait(lock, [this, id]() {return id - _next.load() <= _mask; });
+                --_numBlocked;
+            }
+            // seq_cst store and load, either the consumer sees the item or this thread sees that it is the next one
+            _items[id & _mask].store(item.release());
+            return id == _next.load();
+        }
+
+        // true if the next expected item has arrived
+        bool ready() const noexcept
+        {
+            return _items[_next.load() & _mask].load() != nullptr;
+        }
+
+        // only called by the consumer, retrieves the next expected item
+        bool try_retrieve(std::unique_ptr<TItem>& item)
+        {
+            const id_t next = _next.load(std::memory_order_relaxed);
+            TItem* temp = _items[next & _mask].load();
+            if (temp == nullptr)
+                return false;
+            _items[next & _mask].store(nullptr, std::memory_order_relaxed);
+            item.reset(temp);
+            _next.store(next + 1);
+            if (_numBlocked.load() != 0)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _windowMoved.notify_all();
+            }
+            return true;
+        }
+    };
+
+    // move only replacement for std::function<void()>, tasks usually own a batch of reads
+    struct Task
+    {
+    private:
+        struct Callable
+        {
+            virtual ~Callable() {};
+            virtual void operator()() = 0;
+        };
+        template <typename TFunc>
+        struct CallableImpl : public Callable
+        {
+            TFunc func;
+            CallableImpl(TFunc&& func) : func(std::move(func)) {};
+            void operator()() override
+            {
+                func();
+            }
+        };
+        std::unique_ptr<Callable> _callable;
+    public:
+        Task() = default;
+        template <typename TFunc, typename = std::enable_if_t<!std::is_same<std::decay_t<TFunc>, Task>::value>>
+        Task(TFunc func) : _callable(std::make_unique<CallableImpl<TFunc>>(std::move(func))) {};
+
+        void operator()()
+        {
+            (*_callable)();
+        }
+    };
+
+    /*
+    - work stealing thread pool that is shared by all ptc units of a process
+    - every worker has its own deque, tasks submitted by a worker go to its own deque, tasks from other threads are distributed round robin
+    - workers take the oldest task of their own deque and steal the newest task of the others
+    - threads that have to wait for the pool can run pending tasks with tryRunTask() instead of sleeping
+    */
+    struct ThreadPool
+    {
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::vector<std::thread> _threads;
+        WaitManager<DefaultWaitPolicy> _taskAvailable;
+        std::atomic<unsigned int> _nextWorker;
+        std::atomic_bool _run;
+
+        struct WorkerId
+        {
+            const ThreadPool* pool = nullptr;
+            unsigned int index = 0;
+        };
+        static WorkerId& workerId() noexcept
+        {
+            thread_local WorkerId id;
+            return id;
+        }
+        // index of the worker that runs on this thread, numWorkers if it is not a worker of this pool
+        unsigned int workerIndex() const noexcept
+        {
+            const WorkerId& id = workerId();
+            return id.pool == this ? id.index : static_cast<unsigned int>(_workers.size());
+        }
+
+        bool popTask(Worker& worker, Task& task, const bool steal)
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty())
+                return false;
+            if (steal)
+            {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            return true;
+        }
+    public:
+        explicit ThreadPool(const unsigned int numThreads) : _nextWorker(0), _run(true)
+        {
+            const unsigned int numWorkers = std::max(numThreads, 1u);
+            for (unsigned int i = 0; i < numWorkers; ++i)
+                _workers.emplace_back(std::make_unique<Worker>());
+            for (unsigned int i = 0; i < numWorkers; ++i)
+            {
+                _threads.emplace_back([this, i]()
+                {
+                    workerId().pool = this;
+                    workerId().index = i;
+                    while (true)
+                    {
+                        // read before tryRunTask, all tasks are submitted before the destructor runs
+                        const bool run = _run.load(std::memory_order_acquire);
+                        if (tryRunTask())
+                            continue;
+                        if (!run)
+                            return;
+                        _taskAvailable.wait();
+                    }
+                });
+            }
+        }
+        ~ThreadPool()
+        {
+            _run.store(false, std::memory_order_release);
+            _taskAvailable.signal(static_cast<unsigned int>(_threads.size()));
+            for (auto& thread : _threads)
+                thread.join();
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        unsigned int size() const noexcept
+        {
+            return static_cast<unsigned int>(_workers.size());
+        }
+
+        void submit(Task task)
+        {
+            unsigned int index = workerIndex();
+            if (index == _workers.size())
+                index = _nextWorker.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+            {
+                std::lock_guard<std::mutex> lock(_workers[index]->mutex);
+                _workers[index]->tasks.push_back(std::move(task));
+            }
+            _taskAvailable.signal();
+        }
+
+        // runs one pending task on the calling thread, returns false if there was none
+        bool tryRunTask()
+        {
+            const unsigned int numWorkers = size();
+            const unsigned int own = workerIndex();
+            Task task;
+            bool found = own < numWorkers && popTask(*_workers[own], task, false);
+            for (unsigned int i = 1; !found && i <= numWorkers; ++i)
+                found = popTask(*_workers[(own + i) % numWorkers], task, true);
+            if (!found)
+                return false;
+            task();
+            return true;
+        }
+    };
+
+    /*
+    - created by the first call with numThreads workers, 0 means std::thread::hardware_concurrency()
+    - the size is fixed then, later calls have to pass the same numThreads or 0 (asserted)
+    */
+    inline ThreadPool& sharedThreadPool(const unsigned int numThreads = 0)
+    {
+        static ThreadPool pool(numThreads != 0 ? numThreads : std::thread::hardware_concurrency());
+        assert(numThreads == 0 || pool.size() == numThreads);
+        return pool;
+    }
 
     template<typename F, typename Ret>
     void helper(Ret(F::*)());
@@ -409,7 +964,7 @@ namespace ptc
         using reuse_item_type = std::remove_reference_t<typename first_argument<std::remove_reference_t<TSource>>::type>;  // why remove_reference here?
     private:
         TSource& _source;
-        ContainerSelector<typename reuse_item_type::element_type, InputPolicy::multi, OutputPolicy::single, WaitPolicy::Semaphore, OrderPolicy::Unordered> _usedItems;
+        ContainerSelector<typename reuse_item_type::element_type, InputPolicy::multi, OutputPolicy::single, DefaultWaitPolicy, OrderPolicy::Unordered> _usedItems;
     protected:
         ProduceReuseInterface(TSource& _source) : _source(_source), _usedItems(10) {};
 
@@ -447,13 +1002,13 @@ namespace ptc
     /*
     reads read sets from hd and puts them into slots, waits if no free slots are available
     */
-    template<typename TSource, typename TOrderPolicy, typename TWaitPolicy, bool reuseItems>
+    template<typename TSource, typename TOrderPolicy, typename TWaitPolicy, bool reuseItems, typename TContainerPolicy = ContainerPolicy::Default>
     struct Produce : private OrderManager<TOrderPolicy>, public WaitManager<TWaitPolicy>, public ProduceReuseInterface<TSource, reuseItems>
     {
     public:
         using item_type = typename OrderManager<TOrderPolicy>::template ItemIdPair_t<typename ProduceReuseInterface<TSource, reuseItems>::core_item_type>;
     private:
-        ContainerSelector<item_type, InputPolicy::single, OutputPolicy::multi, TWaitPolicy, TOrderPolicy> _slots;
+        ContainerSelector<item_type, InputPolicy::single, OutputPolicy::multi, TWaitPolicy, TOrderPolicy, TContainerPolicy> _slots;
         const unsigned int _numSlots;
         std::thread _thread;
         std::atomic_bool _eof;
@@ -508,7 +1063,7 @@ namespace ptc
                 const bool eof = _eof.load(std::memory_order_acquire);
                 if (!_slots.try_retrieve(returnItem))
                     if (!eof)
-                        wait();
+                        this->wait();
                     else
                         return false;
                 else
@@ -531,7 +1086,7 @@ namespace ptc
         SinkReuseInterface(TSink&& sink) : _sink(sink), _usedItems(10) {};
         using used_item_type = std::result_of_t<TSink(TCoreItemType)>;
 
-        ContainerSelector<typename used_item_type::element_type, InputPolicy::single, OutputPolicy::multi, WaitPolicy::Semaphore, OrderPolicy::Unordered> _usedItems;
+        ContainerSelector<typename used_item_type::element_type, InputPolicy::single, OutputPolicy::multi, DefaultWaitPolicy, OrderPolicy::Unordered> _usedItems;
         void sink(TCoreItemType&& arg)
         {
             auto temp = _sink(std::move(arg));
@@ -570,22 +1125,73 @@ namespace ptc
     };
 
 
-    template<typename TSink, typename TCoreItemType, typename TOrderPolicy, typename TWaitPolicy, bool reuseItems>
+    template<typename TSink, typename TCoreItemType, typename TOrderPolicy, typename TWaitPolicy, bool reuseItems, typename TContainerPolicy = ContainerPolicy::Default>
     struct Consume : private OrderManager<TOrderPolicy>, private WaitManager<TWaitPolicy>, public SinkReuseInterface<TSink, TCoreItemType, reuseItems>
     {
     public:
         using item_type = typename OrderManager<TOrderPolicy>::template ItemIdPair_t<TCoreItemType>; // for unordered its just plain TCoreItemType
         using ownSink = std::is_same<TSink, std::remove_reference_t<TSink()>>;    // not used
     private:
-        ContainerSelector<item_type, InputPolicy::multi, OutputPolicy::single, TWaitPolicy, TOrderPolicy> _slots;
+        static const bool ordered = std::is_same<TOrderPolicy, OrderPolicy::Ordered>::value;
+        std::conditional_t<ordered, ReorderRing<item_type>,
+            ContainerSelector<item_type, InputPolicy::multi, OutputPolicy::single, TWaitPolicy, TOrderPolicy, TContainerPolicy>> _slots;
 
         const unsigned int _numSlots;
         std::thread _thread;
         std::atomic_bool _run;
+        std::atomic<size_t> _numConsumed;
+        WaitManager<TWaitPolicy> _itemConsumed;
+
+        inline void consumeItem(std::unique_ptr<item_type> item)
+        {
+            this->sink(this->extractItem(std::move(item)));
+            _numConsumed.fetch_add(1, std::memory_order_release);
+            _itemConsumed.signal();
+        }
+        template <typename TUnordered>
+        void consumeItems(const TUnordered&)
+        {
+            std::unique_ptr<item_type> item;
+            while (true)
+            {
+                // read before try_retrieve, all items are pushed before shutDown(), so the slots are drained when this is false
+                const bool run = _run.load(std::memory_order_acquire);
+                if (_slots.try_retrieve(item))
+                    consumeItem(std::move(item));
+                else if (!run)
+                    return;
+                else
+                    this->wait();
+            }
+        }
+        void consumeItems(const OrderPolicy::Ordered&)
+        {
+            std::unique_ptr<item_type> item;
+            while (true)
+            {
+                const bool run = _run.load(std::memory_order_acquire);
+                while (_slots.try_retrieve(item))
+                    consumeItem(std::move(item));
+                if (!run)
+                    return;
+                this->wait();   // woken up by pushItem() when the next item arrives
+            }
+        }
+        template <typename TUnordered>
+        void insertItem(std::unique_ptr<item_type> newItem, const TUnordered&)
+        {
+            _slots.insert(std::move(newItem));
+            WaitManager<TWaitPolicy>::signal();
+        }
+        void insertItem(std::unique_ptr<item_type> newItem, const OrderPolicy::Ordered&)
+        {
+            if (_slots.insert(std::move(newItem)))
+                WaitManager<TWaitPolicy>::signal();
+        }
     // function declarations and definitions
     public:
         Consume(TSink sink, const unsigned int numSlots)
-            : OrderManager<TOrderPolicy>(numSlots), SinkReuseInterface<TSink, TCoreItemType, reuseItems>(std::forward<TSink>(sink)), _slots(numSlots), _numSlots(numSlots), _run(false)
+            : OrderManager<TOrderPolicy>(numSlots), SinkReuseInterface<TSink, TCoreItemType, reuseItems>(std::forward<TSink>(sink)), _slots(numSlots), _numSlots(numSlots), _run(false), _numConsumed(0)
         {}
         ~Consume()
         {
@@ -598,103 +1204,131 @@ namespace ptc
             _run = true;
             _thread = std::thread([this]()
             {
-                std::list<std::unique_ptr<item_type>> itemBuffer;
-                std::unique_ptr<item_type> currentItemIdPair;
-                while (_run.load(std::memory_order_relaxed) || !itemBuffer.empty())
-                {
-                    if(std::is_same<TOrderPolicy, OrderPolicy::Ordered>::value && !itemBuffer.empty())  // only in ordered mode
-                    {
-                        for (auto it = itemBuffer.begin();it != itemBuffer.end();++it)
-                        {
-                            if (this->is_next_item((*it).get()))
-                            {
-                                this->sink(std::move(this->extractItem(std::move(*it))));
-                                it = itemBuffer.erase(it);
-                            }
-                        }
-                    }
-                    if (_slots.try_retrieve(currentItemIdPair))
-                    {
-                        if (this->is_next_item(currentItemIdPair.get())) // returns always true for unordered
-                        {
-                            auto temp = this->extractItem(std::move(currentItemIdPair));
-                            this->sink(std::move(temp));
-                        }
-                        else
-                        {
-                            itemBuffer.emplace_back(std::move(currentItemIdPair));
-                        }
-                    }
-                    else if(std::is_same<TOrderPolicy, OrderPolicy::Unordered>::value || 
-                        std::is_same<TOrderPolicy, OrderPolicy::Unordered_use_queue>::value || 
-                        itemBuffer.empty())
-                        wait();
-                }
+                consumeItems(TOrderPolicy());
             });
         }
         void pushItem(std::unique_ptr<item_type> newItem)     // blocks until item could be added
         {
-            _slots.insert(std::move(newItem));
-            WaitManager<TWaitPolicy>::signal();
+            insertItem(std::move(newItem), TOrderPolicy());
+        }
+        // number of items that went through the sink
+        inline size_t numConsumed() const noexcept
+        {
+            return _numConsumed.load(std::memory_order_acquire);
+        }
+        void waitItemConsumed() noexcept
+        {
+            _itemConsumed.wait();
         }
         void shutDown()
         {
-            _run.store(false, std::memory_order_relaxed);
+            _run.store(false, std::memory_order_release);
             WaitManager<TWaitPolicy>::signal();
             if (_thread.joinable())
                 _thread.join();
         }
     };
 
-    template <typename TSource, typename TTransformer, typename TSink, typename TOrderPolicy, typename TWaitPolicy>
+    template <typename TSource, typename TTransformer, typename TSink, typename TOrderPolicy, typename TWaitPolicy,
+        typename TContainerPolicy = ContainerPolicy::Default>
     struct PTC_unit
     {
     private:
         static const bool reuseItems = !std::is_same<typename first_argument<std::remove_reference_t<TSource>>::type, void>::value;
 
-        using Produce_t = Produce<TSource, TOrderPolicy, TWaitPolicy, reuseItems>;
+        using Produce_t = Produce<TSource, TOrderPolicy, TWaitPolicy, reuseItems, TContainerPolicy>;
         using produce_core_item_type = typename Produce_t::core_item_type;
         Produce_t _producer;
 
         const TTransformer _transformer;
         using transform_core_item = typename std::result_of_t<TTransformer(produce_core_item_type)>;
 
-        using Consume_t = Consume<TSink, transform_core_item, TOrderPolicy, TWaitPolicy, reuseItems>;
+        using Consume_t = Consume<TSink, transform_core_item, TOrderPolicy, TWaitPolicy, reuseItems, TContainerPolicy>;
         Consume_t _consumer;
 
         using used_item_type = std::result_of_t<TSink(transform_core_item)>;
 
+        ThreadPool* const _pool;    // nullptr if the unit has its own transformer threads
+        std::atomic<size_t> _numFinished;
+        std::mutex _finishedMutex;
+        std::condition_variable _taskFinished;
         std::vector<std::thread> _threads;
+
+        void transformItem(std::unique_ptr<typename Produce_t::item_type> item)
+        {
+            _consumer.pushItem(std::move(OrderManager<TOrderPolicy>::callTransformer(_transformer, std::move(item))));
+            checkUsedItems();
+        }
+        /*
+        - hands the items of the producer to the pool, one task per item
+        - the number of items that are not through the sink yet is limited to the number of consumer slots,
+          so the reorder ring of the ordered mode never blocks a pool thread
+        - while the limit is reached, this thread runs pool tasks instead of sleeping
+        */
+        void dispatchItems()
+        {
+            const size_t maxInFlight = _pool->size() + 1;
+            size_t numSubmitted = 0;
+            std::unique_ptr<typename Produce_t::item_type> item;
+            while (_producer.getItem(item))
+            {
+                while (numSubmitted - _consumer.numConsumed() >= maxInFlight)
+                    if (!_pool->tryRunTask())
+                        _consumer.waitItemConsumed();
+                ++numSubmitted;
+                _pool->submit([this, item = std::move(item)]() mutable
+                {
+                    transformItem(std::move(item));
+                    // under the lock, the unit can be destroyed as soon as the dispatcher sees the last task finished
+                    std::lock_guard<std::mutex> lock(_finishedMutex);
+                    _numFinished.fetch_add(1, std::memory_order_relaxed);
+                    _taskFinished.notify_one();
+                });
+            }
+            // the tasks use the consumer and the producer until they return
+            while (_numFinished.load(std::memory_order_relaxed) != numSubmitted && _pool->tryRunTask()) {}
+            std::unique_lock<std::mutex> lock(_finishedMutex);
+            _taskFinished.wait(lock, [this, numSubmitted]() {return _numFinished.load(std::memory_order_relaxed) == numSubmitted; });
+        }
     public:
         PTC_unit(TSource& source, const TTransformer& transformer, TSink&& sink, const unsigned int numThreads) :
-            _producer(source, numThreads + 1), _transformer(transformer), _consumer(std::forward<TSink>(sink), numThreads+1), _threads(numThreads){};
+            _producer(source, numThreads + 1), _transformer(transformer), _consumer(std::forward<TSink>(sink), numThreads+1), _pool(nullptr), _numFinished(0), _threads(numThreads){};
+
+        // the transformer runs on the given pool, the unit only has one extra thread that dispatches the items
+        PTC_unit(TSource& source, const TTransformer& transformer, TSink&& sink, ThreadPool& pool) :
+            _producer(source, pool.size() + 1), _transformer(transformer), _consumer(std::forward<TSink>(sink), pool.size() + 1), _pool(&pool), _numFinished(0), _threads(1){};
 
         void start()
         {
             _producer.start();
             _consumer.start();
+            if (_pool != nullptr)
+            {
+                _threads.front() = std::thread([this]()
+                {
+                    dispatchItems();
+                });
+                return;
+            }
             for (auto& _thread : _threads)
             {
                 _thread = std::thread([this]()
                 {
                     std::unique_ptr<typename Produce_t::item_type> item;
                     while (_producer.getItem(item))
-                    {
-                        _consumer.pushItem(std::move(OrderManager<TOrderPolicy>::callTransformer(_transformer, std::move(item))));
-                        checkUsedItems();
-                    }
+                        transformItem(std::move(item));
                 });
             }
         }
 
-        template<typename = std::enable_if_t<reuseItems>>
+        template<bool _reuseItems = reuseItems, std::enable_if_t<_reuseItems, int> = 0>
         void checkUsedItems()
         {
             used_item_type usedItem = nullptr;
             _consumer.getUsedItem(usedItem);
             _producer.pushUsedItem(std::move(usedItem));
         }
-        template<typename = std::enable_if_t<!reuseItems>>
+        template<bool _reuseItems = reuseItems, std::enable_if_t<!_reuseItems, int> = 0>
         void checkUsedItems() const noexcept
         {
         }
@@ -735,21 +1369,49 @@ namespace ptc
     template <typename TSource, typename TTransformer, typename TSink>
     auto ordered_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, const unsigned int numThreads)
     {
-        return std::make_unique<PTC_unit<TSource, TTransformer, TSink&&, OrderPolicy::Ordered, WaitPolicy::Semaphore>>
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink&&, OrderPolicy::Ordered, DefaultWaitPolicy>>
             (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), numThreads);
     }
 
     template <typename TSource, typename TTransformer, typename TSink>
     auto unordered_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, const unsigned int numThreads)
     {
-        return std::make_unique<PTC_unit<TSource, TTransformer, TSink, OrderPolicy::Unordered, WaitPolicy::Semaphore>>
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink, OrderPolicy::Unordered, DefaultWaitPolicy>>
+            (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), numThreads);
+    }
+
+    template <typename TSource, typename TTransformer, typename TSink>
+    auto ordered_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, ThreadPool& pool)
+    {
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink&&, OrderPolicy::Ordered, DefaultWaitPolicy>>
+            (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), pool);
+    }
+
+    template <typename TSource, typename TTransformer, typename TSink>
+    auto unordered_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, ThreadPool& pool)
+    {
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink, OrderPolicy::Unordered, DefaultWaitPolicy>>
+            (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), pool);
+    }
+
+    template <typename TSource, typename TTransformer, typename TSink>
+    auto ordered_ring_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, const unsigned int numThreads)
+    {
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink&&, OrderPolicy::Ordered, DefaultWaitPolicy, ContainerPolicy::RingBuffer>>
+            (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), numThreads);
+    }
+
+    template <typename TSource, typename TTransformer, typename TSink>
+    auto unordered_ring_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, const unsigned int numThreads)
+    {
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink, OrderPolicy::Unordered, DefaultWaitPolicy, ContainerPolicy::RingBuffer>>
             (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), numThreads);
     }
 
     template <typename TSource, typename TTransformer, typename TSink>
     auto unordered_use_queue_ptc(TSource&& source, const TTransformer& transformer, TSink&& sink, const unsigned int numThreads)
     {
-        return std::make_unique<PTC_unit<TSource, TTransformer, TSink, OrderPolicy::Unordered_use_queue, WaitPolicy::Semaphore>>
+        return std::make_unique<PTC_unit<TSource, TTransformer, TSink, OrderPolicy::Unordered_use_queue, DefaultWaitPolicy>>
             (std::forward<TSource>(source), transformer, std::forward<TSink>(sink), numThreads);
     }
 }
@@ -36,6 +36,12 @@
 #ifndef READ_H_
 #define READ_H_
 
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
 template<typename TSeq>
 struct ReadBase
 {
@@ -50,12 +56,18 @@ struct ReadBase
     {
     }
     ReadBase(const ReadBase& rhs) = default;
-    ReadBase(ReadBase&& rhs) noexcept(std::is_nothrow_move_constructible<TSeq>::value)
+    /*
+    - a moved-from read is always empty
+    - move assignment hands the buffers of the target to the source, so reads that are erased
+      from a batch (std::remove_if moves the kept reads over them) keep their memory for ReadArenaAllocator
+    */
+    ReadBase(ReadBase&& rhs) noexcept : demuxResult(rhs.demuxResult), qTrimmed(rhs.qTrimmed)
     {
-        seq = std::move(rhs.seq);
-        id = std::move(rhs.id);
-        demuxResult = rhs.demuxResult;
-        qTrimmed = rhs.qTrimmed;
+        using std::swap;
+        swap(seq, rhs.seq);
+        swap(id, rhs.id);
+        rhs.demuxResult = 0;
+        rhs.qTrimmed = 0;
     }
 
     bool operator==(const ReadBase& rhs) const
@@ -63,18 +75,30 @@ struct ReadBase
         return seq == rhs.seq && id == rhs.id && demuxResult == rhs.demuxResult;
     }
     ReadBase& operator=(const ReadBase& rhs) = default;
-    ReadBase& operator=(const ReadBase&& rhs) noexcept(std::is_nothrow_move_assignable<TSeq>::value)
+    ReadBase& operator=(ReadBase&& rhs) noexcept
     {
-        seq = std::move(rhs.seq);
-        id = std::move(rhs.id);
+        if (this == &rhs)
+            return *this;
+        using std::swap;
+        swap(seq, rhs.seq);
+        swap(id, rhs.id);
         demuxResult = rhs.demuxResult;
         qTrimmed = rhs.qTrimmed;
+        rhs.ReadBase::clear();
         return *this;
     }
     inline unsigned int minSeqLen() const noexcept
     {
         return length(seq);
     }
+    // empties the read but keeps the allocated buffers
+    void clear() noexcept
+    {
+        resize(seq, 0);
+        id.clear();
+        demuxResult = 0;
+        qTrimmed = 0;
+    }
 };
 
 template<typename TSeq>
@@ -89,10 +113,11 @@ struct ReadMultiplex : ReadBase<TSeq>
 
     ReadMultiplex() = default;
     ReadMultiplex(const ReadMultiplex& rhs) = default;
-    ReadMultiplex(ReadMultiplex&& rhs) noexcept(std::is_nothrow_move_constructible<TSeq>::value)
+    ReadMultiplex(ReadMultiplex&& rhs) noexcept
         : ReadBase<TSeq>(std::move(rhs))
     {
-        demultiplex = std::move(rhs.demultiplex);
+        using std::swap;
+        swap(demultiplex, rhs.demultiplex);
     }
 
     bool operator==(const ReadMultiplex& rhs) const
@@ -100,12 +125,22 @@ struct ReadMultiplex : ReadBase<TSeq>
         return ReadBase<TSeq>::operator==(rhs) && demultiplex == rhs.demultiplex;
     }
     ReadMultiplex& operator=(const ReadMultiplex& rhs) = default;
-    ReadMultiplex& operator=(const ReadMultiplex&& rhs)  noexcept(std::is_nothrow_move_assignable<TSeq>::value)
+    ReadMultiplex& operator=(ReadMultiplex&& rhs) noexcept
     {
+        if (this == &rhs)
+            return *this;
         ReadBase<TSeq>::operator=(std::move(rhs));
-        demultiplex = std::move(rhs.demultiplex);
+        using std::swap;
+        swap(demultiplex, rhs.demultiplex);
+        resize(rhs.demultiplex, 0);
         return *this;
     }
+
+    void clear() noexcept
+    {
+        ReadBase<TSeq>::clear();
+        resize(demultiplex, 0);
+    }
 };
 
 template<typename TSeq>
@@ -116,11 +151,12 @@ struct ReadPairedEnd : ReadBase<TSeq>
 
     ReadPairedEnd() = default;
     ReadPairedEnd(const ReadPairedEnd& rhs) = default;
-    ReadPairedEnd(ReadPairedEnd&& rhs) noexcept(std::is_nothrow_move_constructible<TSeq>::value)
+    ReadPairedEnd(ReadPairedEnd&& rhs) noexcept
         : ReadBase<TSeq>(std::move(rhs))
     {
-        seqRev = std::move(rhs.seqRev);
-        idRev = std::move(rhs.idRev);
+        using std::swap;
+        swap(seqRev, rhs.seqRev);
+        swap(idRev, rhs.idRev);
     }
 
     bool operator==(const ReadPairedEnd& rhs) const
@@ -128,17 +164,28 @@ struct ReadPairedEnd : ReadBase<TSeq>
         return ReadBase<TSeq>::operator==(rhs) && seqRev == rhs.seqRev && idRev == rhs.idRev;
     }
     ReadPairedEnd& operator=(const ReadPairedEnd& rhs) = default;
-    ReadPairedEnd& operator=(const ReadPairedEnd&& rhs)  noexcept(std::is_nothrow_move_assignable<TSeq>::value)
+    ReadPairedEnd& operator=(ReadPairedEnd&& rhs) noexcept
     {
+        if (this == &rhs)
+            return *this;
         ReadBase<TSeq>::operator=(std::move(rhs));
-        seqRev = std::move(rhs.seqRev);
-        idRev = std::move(rhs.idRev);
+        using std::swap;
+        swap(seqRev, rhs.seqRev);
+        swap(idRev, rhs.idRev);
+        resize(rhs.seqRev, 0);
+        rhs.idRev.clear();
         return *this;
     }
     inline unsigned int minSeqLen() const noexcept
     {
         return std::min(length(ReadBase<TSeq>::seq), length(seqRev));
     }
+    void clear() noexcept
+    {
+        ReadBase<TSeq>::clear();
+        resize(seqRev, 0);
+        idRev.clear();
+    }
 };
 
 template<typename TSeq>
@@ -148,10 +195,11 @@ struct ReadMultiplexPairedEnd : ReadPairedEnd<TSeq>
 
     ReadMultiplexPairedEnd() = default;
     ReadMultiplexPairedEnd(const ReadMultiplexPairedEnd& rhs) = default;
-    ReadMultiplexPairedEnd(ReadMultiplexPairedEnd&& rhs) noexcept(std::is_nothrow_move_constructible<TSeq>::value)
+    ReadMultiplexPairedEnd(ReadMultiplexPairedEnd&& rhs) noexcept
         : ReadPairedEnd<TSeq>(std::move(rhs))
     {
-        demultiplex = std::move(rhs.demultiplex);
+        using std::swap;
+        swap(demultiplex, rhs.demultiplex);
     }
 
     bool operator==(const ReadMultiplexPairedEnd& rhs) const
@@ -159,12 +207,159 @@ struct ReadMultiplexPairedEnd : ReadPairedEnd<TSeq>
         return ReadPairedEnd<TSeq>::operator==(rhs) && demultiplex == rhs.demultiplex;
     }
     ReadMultiplexPairedEnd& operator=(const ReadMultiplexPairedEnd& rhs) = default;
-    ReadMultiplexPairedEnd& operator=(const ReadMultiplexPairedEnd&& rhs)  noexcept(std::is_nothrow_move_assignable<TSeq>::value)
+    ReadMultiplexPairedEnd& operator=(ReadMultiplexPairedEnd&& rhs) noexcept
     {
+        if (this == &rhs)
+            return *this;
         ReadPairedEnd<TSeq>::operator=(std::move(rhs));
-        demultiplex = std::move(rhs.demultiplex);
+        using std::swap;
+        swap(demultiplex, rhs.demultiplex);
+        resize(rhs.demultiplex, 0);
         return *this;
     }
+
+    void clear() noexcept
+    {
+        ReadPairedEnd<TSeq>::clear();
+        resize(demultiplex, 0);
+    }
+};
+
+/*
+- state shared by the copies of one ReadArenaAllocator
+- reads that are removed from the batch are parked in spare, at most as many as the largest capacity the batch had
+- reads destroyed outside of storage are the moved-from leftovers of a reallocation, they own no buffers
+*/
+template <typename TRead>
+struct ReadArena
+{
+    std::vector<TRead> spare;
+    const TRead* storage = nullptr;
+    std::size_t storageSize = 0;
+    std::size_t highWater = 0;
+    bool parking = true;    // switched off by ~ReadBatch, a destroyed batch does not need its reads anymore
+};
+
+/*
+- allocator of ReadBatch, the memory itself comes from std::allocator
+- reads that are erased from a batch (filtered by a stage or cut off by readReads) are not freed,
+  they are parked in the spare list together with their sequence and id buffers
+- growing the batch again takes the reads from the spare list, they come back empty but with their buffers,
+  so a recycled batch allocates nothing in steady state
+- the spare list belongs to one batch and travels with it between the pipeline threads
+*/
+template <typename TRead>
+struct ReadArenaAllocator
+{
+    using value_type = TRead;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    template <typename U>
+    struct rebind
+    {
+        using other = ReadArenaAllocator<U>;
+    };
+
+    std::shared_ptr<ReadArena<TRead>> arena;
+
+    ReadArenaAllocator() : arena(std::make_shared<ReadArena<TRead>>()) {};
+    ReadArenaAllocator(const ReadArenaAllocator& rhs) = default;
+    template <typename U>
+    ReadArenaAllocator(const ReadArenaAllocator<U>&) : arena(std::make_shared<ReadArena<TRead>>()) {};
+
+    // a copied batch must not share the spare list with the original
+    ReadArenaAllocator select_on_container_copy_construction() const
+    {
+        return ReadArenaAllocator();
+    }
+
+    inline TRead* allocate(const std::size_t n)
+    {
+        TRead* p = std::allocator<TRead>().allocate(n);
+        if (n > arena->highWater)
+        {
+            arena->spare.reserve(n);    // parking never allocates
+            arena->highWater = n;
+        }
+        arena->storage = p;
+        arena->storageSize = n;
+        return p;
+    }
+    inline void deallocate(TRead* p, const std::size_t n) noexcept
+    {
+        if (p == arena->storage)
+        {
+            arena->storage = nullptr;
+            arena->storageSize = 0;
+        }
+        std::allocator<TRead>().deallocate(p, n);
+    }
+
+    template <typename U, typename... TArgs>
+    inline void construct(U* p, TArgs&&... args)
+    {
+        ::new(static_cast<void*>(p)) U(std::forward<TArgs>(args)...);
+    }
+    // default construction (vector::resize) recycles a parked read
+    inline void construct(TRead* p)
+    {
+        auto& spare = arena->spare;
+        if (spare.empty())
+        {
+            ::new(static_cast<void*>(p)) TRead();
+            return;
+        }
+        ::new(static_cast<void*>(p)) TRead(std::move(spare.back()));
+        spare.pop_back();
+        p->clear();
+    }
+
+    template <typename U>
+    inline void destroy(U* p) noexcept
+    {
+        p->~U();
+    }
+    inline void destroy(TRead* p) noexcept
+    {
+        const std::less<const TRead*> less;
+        auto& state = *arena;
+        if (state.parking && !less(p, state.storage) && less(p, state.storage + state.storageSize) && state.spare.size() < state.highWater)
+            state.spare.push_back(std::move(*p));
+        p->~TRead();
+    }
+
+    template <typename U>
+    inline bool operator==(const ReadArenaAllocator<U>&) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    inline bool operator!=(const ReadArenaAllocator<U>&) const noexcept
+    {
+        return false;
+    }
+};
+
+// container for the reads of one batch, behaves like std::vector but keeps the buffers of erased reads
+template <typename TRead>
+class ReadBatch : public std::vector<TRead, ReadArenaAllocator<TRead>>
+{
+    using TBase = std::vector<TRead, ReadArenaAllocator<TRead>>;
+public:
+    using TBase::TBase;
+    ReadBatch() = default;
+    ReadBatch(const ReadBatch& rhs) = default;
+    ReadBatch(ReadBatch&& rhs) = default;
+    ReadBatch& operator=(const ReadBatch& rhs) = default;
+    ReadBatch& operator=(ReadBatch&& rhs) = default;
+
+    ~ReadBatch()
+    {
+        // a moved-from batch owns no storage, it must not switch off the arena it shares with the new owner
+        if (this->capacity() != 0)
+            this->get_allocator().arena->parking = false;
+    }
 };
 
 #endif
\ No newline at end of file
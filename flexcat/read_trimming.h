@@ -36,6 +36,9 @@
 #ifndef READTRIMMING_H
 #define READTRIMMING_H
 
+#include <array>
+#include <nmmintrin.h>
+
 #include "helper_functions.h"
 #include "general_stats.h"
 
@@ -129,13 +132,167 @@ unsigned _trimRead(const TSeq& seq, unsigned const _cutoff, Mean const & spec) n
 	return i;   // i now holds the start of the first window that turned bad.
 }
 
-template <typename TSeq, typename TSpec>
-unsigned trimRead(TSeq& seq, unsigned const cutoff, TSpec const & spec) noexcept
+// Trimming methods on the raw seqan::Dna5Q bytes
+// ----------------------------------------------------------------------------
+/*
+- the qualities are read in place from bits 2-7 of the Dna5Q bytes, the read is not copied
+- 16 (Tail, BWA) or 8 (Mean) positions are processed at once, the remaining positions are processed like in the _trimRead overloads above
+*/
+
+// quality of every raw seqan::Dna5Q byte, N has no quality bits
+inline std::array<unsigned char, 256> initDna5QQualities() noexcept
+{
+    std::array<unsigned char, 256> qualities;
+    for (unsigned int b = 0; b < 256; ++b)
+    {
+        seqan::Dna5Q c;
+        c.value = static_cast<unsigned char>(b);
+        qualities[b] = static_cast<unsigned char>(seqan::getQualityValue(c));
+    }
+    return qualities;
+}
+
+static const std::array<unsigned char, 256> DNA5Q_QUALITIES = initDna5QQualities();
+
+inline __m128i qualities128(const __m128i bytes) noexcept
+{
+    const __m128i q = _mm_and_si128(_mm_srli_epi16(bytes, 2), _mm_set1_epi8(0x3f));
+    return _mm_blendv_epi8(q, _mm_set1_epi8(static_cast<char>(DNA5Q_QUALITIES[DNA5Q_N])),
+        _mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(DNA5Q_N))));
+}
+
+inline unsigned _trimRead(const unsigned char* bytes, const unsigned len, unsigned const cutoff, Tail const &) noexcept
+{
+    // q >= cutoff <=> max(q, cutoff) == q, qualities are at most 63
+    const __m128i cutoffVec = _mm_set1_epi8(static_cast<char>(std::min(cutoff, 255u)));
+    int i = len;
+    for (; i >= 16; i -= 16)
+    {
+        const __m128i q = qualities128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i - 16)));
+        const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(q, cutoffVec), q));
+        if (mask != 0)
+            return i - 16 + (32 - __builtin_clz(mask));
+    }
+    for (--i; i >= 0; --i)
+    {
+        if (DNA5Q_QUALITIES[bytes[i]] >= cutoff)
+            return i + 1;
+    }
+    return 0;
+}
+
+/*
+- the 16 positions of a block are reversed into scan order and summed up with a 16 bit prefix sum relative to the running sum
+- the local sums are within [-1008, 4080], so the break threshold -sum can be clamped to 16 bit without changing the result
+- the new maximum of a block is the horizontal maximum of the local sums before the break
+*/
+inline unsigned _trimRead(const unsigned char* bytes, const unsigned len, unsigned const cutoff, BWA const &) noexcept
+{
+    int max_arg = len - 1, sum = 0, max = 0;
+    int i = len;
+    const auto clamp16 = [](const int v) {return static_cast<short>(std::min(std::max(v, -32768), 32767)); };
+    if (cutoff <= 255)
+    {
+        const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        const __m128i cutoffVec = _mm_set1_epi16(static_cast<short>(cutoff));
+        for (; i >= 16; i -= 16)
+        {
+            const __m128i q = _mm_shuffle_epi8(qualities128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i - 16))), reverse);
+            __m128i lo = _mm_sub_epi16(cutoffVec, _mm_cvtepu8_epi16(q));
+            __m128i hi = _mm_sub_epi16(cutoffVec, _mm_cvtepu8_epi16(_mm_srli_si128(q, 8)));
+            lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+            lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+            lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+            hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+            hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+            hi = _mm_add_epi16(hi, _mm_set1_epi16(static_cast<short>(_mm_extract_epi16(lo, 7))));
+
+            const __m128i breakThreshold = _mm_set1_epi16(clamp16(-sum));
+            const unsigned int breakMask = _mm_movemask_epi8(_mm_packs_epi16(
+                _mm_cmplt_epi16(lo, breakThreshold), _mm_cmplt_epi16(hi, breakThreshold)));
+            // lanes from the break on can not become the new maximum
+            const unsigned int validLanes = breakMask != 0 ? __builtin_ctz(breakMask) : 16;
+            const __m128i validLo = _mm_cmpgt_epi16(_mm_set1_epi16(static_cast<short>(validLanes)), _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+            const __m128i validHi = _mm_cmpgt_epi16(_mm_set1_epi16(static_cast<short>(validLanes)), _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15));
+            const __m128i minValue = _mm_set1_epi16(-32768);
+            const __m128i maskedLo = _mm_blendv_epi8(minValue, lo, validLo);
+            const __m128i maskedHi = _mm_blendv_epi8(minValue, hi, validHi);
+            __m128i blockMax = _mm_max_epi16(maskedLo, maskedHi);
+            blockMax = _mm_max_epi16(blockMax, _mm_shuffle_epi32(blockMax, _MM_SHUFFLE(1, 0, 3, 2)));
+            blockMax = _mm_max_epi16(blockMax, _mm_shuffle_epi32(blockMax, _MM_SHUFFLE(2, 3, 0, 1)));
+            blockMax = _mm_max_epi16(blockMax, _mm_shufflelo_epi16(_mm_shufflehi_epi16(blockMax, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1)));
+            const int localMax = static_cast<short>(_mm_cvtsi128_si32(blockMax));
+            if (validLanes != 0 && sum + localMax > max)
+            {
+                // the first lane with the maximum wins, like the strictly greater update of the scalar version
+                const unsigned int maxMask = _mm_movemask_epi8(_mm_packs_epi16(
+                    _mm_cmpeq_epi16(maskedLo, blockMax), _mm_cmpeq_epi16(maskedHi, blockMax)));
+                max = sum + localMax;
+                max_arg = i - 1 - __builtin_ctz(maxMask);
+            }
+            if (breakMask != 0)
+                return max_arg + 1;
+            sum += static_cast<short>(_mm_extract_epi16(hi, 7));
+        }
+    }
+    for (--i; i >= 0; --i)
+    {
+        sum += static_cast<int>(cutoff) - static_cast<int>(DNA5Q_QUALITIES[bytes[i]]);
+        if (sum < 0)
+            break;
+        if (sum > max)
+        {
+            max = sum;
+            max_arg = i;
+        }
+    }
+    return max_arg + 1;
+}
+
+/*
+- the window sums of 8 positions are built from window shifted 8 byte loads in 16 bit lanes
+- vectorized as long as the whole window is inside the read, the remaining windows are shortened near the end like in the scalar version
+*/
+inline unsigned _trimRead(const unsigned char* bytes, const unsigned len, unsigned const _cutoff, Mean const & spec) noexcept
 {
-	unsigned ret, cut_pos;
-	cut_pos = _trimRead(seqan::Dna5QString(seq), cutoff, spec);
-	ret = length(seq) - cut_pos;
-	erase(seq, cut_pos, length(seq));
+    const unsigned window = spec.window;
+    const unsigned cutoff = _cutoff * window;
+    unsigned i = 0;
+    if (window > 0 && window * 63 < 32768 && cutoff < 32768)
+    {
+        const __m128i cutoffVec = _mm_set1_epi16(static_cast<short>(cutoff));
+        for (; i + 8 + window - 1 <= len; i += 8)
+        {
+            __m128i sums = _mm_setzero_si128();
+            for (unsigned int j = 0; j < window; ++j)
+            {
+                const __m128i q = qualities128(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes + i + j)));
+                sums = _mm_add_epi16(sums, _mm_cvtepu8_epi16(q));
+            }
+            const unsigned int mask = _mm_movemask_epi8(_mm_cmplt_epi16(sums, cutoffVec));
+            if (mask != 0)
+                return i + __builtin_ctz(mask) / 2;
+        }
+    }
+    unsigned avg = 0;
+    for (unsigned int k = i; k < std::min(i + window, len); ++k)
+        avg += DNA5Q_QUALITIES[bytes[k]];
+    for (; i < len && avg >= cutoff; ++i)
+    {
+        avg -= DNA5Q_QUALITIES[bytes[i]];
+        avg += i + window < len ? DNA5Q_QUALITIES[bytes[i + window]] : 0;
+    }
+    return i;
+}
+
+template <typename TSpec>
+unsigned trimRead(seqan::Dna5QString& seq, unsigned const cutoff, TSpec const & spec) noexcept
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(seqan::begin(seq, seqan::Standard()));
+    const unsigned cut_pos = _trimRead(bytes, length(seq), cutoff, spec);
+    const unsigned ret = length(seq) - cut_pos;
+    erase(seq, cut_pos, length(seq));
     return ret;
 }
 
@@ -145,27 +302,30 @@ struct TagTrimming
     static const bool value = tag;
 };
 
+// returns true if the read was trimmed
 template <typename TRead, typename TSpec, typename TTagTrimming>
-unsigned _trimReads(std::vector<TRead>& reads, unsigned const cutoff, const TSpec& spec, TTagTrimming) noexcept(!TTagTrimming::value)
+bool trimReadQuality(TRead& read, unsigned const cutoff, const TSpec& spec, TTagTrimming) noexcept(!TTagTrimming::value)
+{
+    const auto nTrimmed = trimRead(read.seq, cutoff, spec);
+    if (nTrimmed == 0)
+        return false;
+    read.qTrimmed = (unsigned char)nTrimmed;
+    if (TTagTrimming::value)
+        append(read.id, ":QT");
+    return true;
+}
+
+template <typename TRead, typename TAlloc, typename TSpec, typename TTagTrimming>
+unsigned _trimReads(std::vector<TRead, TAlloc>& reads, unsigned const cutoff, const TSpec& spec, TTagTrimming) noexcept(!TTagTrimming::value)
 {
     int trimmedReads = 0;
-    std::transform(reads.begin(),reads.end(),reads.begin(),[&trimmedReads, cutoff, &spec](auto& read)->auto
-    {
-        auto nTrimmed = trimRead(read.seq, cutoff, spec);
-        if (nTrimmed)
-        {
-            read.qTrimmed = (unsigned char)nTrimmed;
-            ++trimmedReads;
-            if (TTagTrimming::value)
-                append(read.id, ":QT");
-        }
-        return read;
-    });
+    for (auto& read : reads)
+        trimmedReads += trimReadQuality(read, cutoff, spec, TTagTrimming());
     return trimmedReads;
 }
 
-template <typename TRead, typename TSpec>
-unsigned trimBatch(std::vector<TRead>& reads, unsigned const cutoff, TSpec const& spec, bool tagOpt)
+template <typename TRead, typename TAlloc, typename TSpec>
+unsigned trimBatch(std::vector<TRead, TAlloc>& reads, unsigned const cutoff, TSpec const& spec, bool tagOpt)
 {
     unsigned trimmedReads;
     if(tagOpt)
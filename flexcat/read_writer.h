@@ -4,60 +4,284 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "bgzf_writer.h"
+
+/*
+- writes the jobs of OutputStreams for a group of samples on its own thread, in submission order
+- submit() only blocks if the shard is maxQueued jobs behind, so writing overlaps with reading and processing
+- with threaded == false submit() runs the job immediately on the calling thread
+- finished jobs are handed out again by acquire(), so their reads keep the buffers
+- numReads and recordBuffer belong to the shard, so the shards never share mutable state
+*/
+class WriterShard
+{
+public:
+    struct Job
+    {
+        virtual ~Job() {};
+        virtual void run() = 0;
+    };
+
+    std::vector<unsigned int> numReads;     // indexed by stream index
+    std::string recordBuffer;
+
+private:
+    static const unsigned int maxQueued = 2;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::unique_ptr<Job>> _queue;
+    std::vector<std::unique_ptr<Job>> _free;
+    bool _busy;
+    bool _stop;
+    std::exception_ptr _error;
+    std::thread _thread;
+
+    // after an error the output file is broken anyway, the remaining jobs are dropped
+    void loop()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _cv.wait(lock, [this]() {return _stop || !_queue.empty(); });
+            if (_queue.empty())
+                break;
+            auto job = std::move(_queue.front());
+            _queue.pop_front();
+            _busy = true;
+            const bool failed = static_cast<bool>(_error);
+            lock.unlock();
+            std::exception_ptr error;
+            if (!failed)
+            {
+                try
+                {
+                    job->run();
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+            }
+            lock.lock();
+            if (error)
+                _error = error;
+            _free.push_back(std::move(job));
+            _busy = false;
+            _cv.notify_all();
+        }
+    }
+
+    // called with _mutex locked
+    void rethrowError()
+    {
+        if (!_error)
+            return;
+        auto error = _error;
+        _error = nullptr;
+        std::rethrow_exception(error);
+    }
+
+public:
+    WriterShard(const bool threaded) : _busy(false), _stop(false)
+    {
+        if (threaded)
+            _thread = std::thread(&WriterShard::loop, this);
+    }
+
+    // writes the queued jobs before the thread exits
+    ~WriterShard()
+    {
+        if (!_thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    // a finished job of type TJob, or a new one
+    template <typename TJob>
+    std::unique_ptr<TJob> acquire()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (!_free.empty())
+        {
+            auto job = std::move(_free.back());
+            _free.pop_back();
+            if (TJob* p = dynamic_cast<TJob*>(job.get()))
+            {
+                job.release();
+                return std::unique_ptr<TJob>(p);
+            }
+        }
+        return std::make_unique<TJob>();
+    }
+
+    // rethrows the exception of an earlier job
+    void submit(std::unique_ptr<Job>&& job)
+    {
+        if (!_thread.joinable())
+        {
+            job->run();
+            _free.push_back(std::move(job));
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() {return _queue.size() < maxQueued; });
+            rethrowError();
+            _queue.push_back(std::move(job));
+        }
+        _cv.notify_all();
+    }
+
+    // blocks until all submitted jobs are finished, rethrows the exception of a job
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]() {return _queue.empty() && !_busy; });
+        rethrowError();
+    }
+
+    // wait() and stop the thread, later jobs are run on the calling thread
+    void join()
+    {
+        wait();
+        if (!_thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+};
 
 class OutputStreams
 {
     using TSeqStream = std::unique_ptr<seqan::SeqFileOut>;
+    // gzip compressed FASTQ is written as BGZF by the compression pool, everything else by SeqFileOut
+    struct OutputFile
+    {
+        TSeqStream seqFile;
+        std::unique_ptr<BgzfWriter> bgzfFile;
+    };
     struct StreamPair
     {
-        StreamPair() : numReads(0) {};
-        StreamPair& operator=(const StreamPair &rhs) = default;
-        TSeqStream first;
-        TSeqStream second;
+        OutputFile first;
+        OutputFile second;
         std::string firstFilename;
         std::string secondFilename;
-        unsigned int numReads;
     };
     //using TStreamPair = std::pair<TSeqStream, TSeqStream>;
     using TStreamPair = StreamPair;
 
-    std::map<int, TStreamPair> fileStreams;
+    // declared before fileStreams, so that all writers are closed before the pool is destroyed
+    std::unique_ptr<BgzfCompressionPool> compressionPool;
+    std::vector<TStreamPair> fileStreams;   // indexed by demuxResult, 0 = unidentified
     const std::string basePath;
     std::string extension;
+    ptc::ThreadPool& threadPool;
+    const unsigned int numThreads;
+    // stream i is written by shard i % shards.size()
+    std::vector<std::unique_ptr<WriterShard>> shards;
 
-    template < typename TStream, template<typename> class TRead, typename TSeq,
-        typename = std::enable_if_t < std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value  > >
-        inline void writeRecord(TStream& stream, TRead<TSeq>&& read, bool = false)
+    template <typename TSeq>
+    inline void writeRecord(OutputFile& file, std::string& recordBuffer, const std::string& id, const TSeq& seq)
     {
-        seqan::writeRecord(*(stream.first), std::move(read.id), std::move(read.seq));
+        if (!file.bgzfFile)
+        {
+            seqan::writeRecord(*file.seqFile, id, seq);
+            return;
+        }
+        const unsigned int len = length(seq);
+        recordBuffer.clear();
+        recordBuffer.reserve(id.size() + 2 * len + 6);
+        recordBuffer += '@';
+        recordBuffer += id;
+        recordBuffer += '\n';
+        const size_t seqBegin = recordBuffer.size();
+        recordBuffer.resize(seqBegin + len);
+        for (unsigned int i = 0; i < len; ++i)
+            recordBuffer[seqBegin + i] = seqan::convert<char>(seq[i]);
+        recordBuffer += "\n+\n";
+        const size_t qualBegin = recordBuffer.size();
+        recordBuffer.resize(qualBegin + len);
+        for (unsigned int i = 0; i < len; ++i)
+            recordBuffer[qualBegin + i] = static_cast<char>(seqan::getQualityValue(seq[i]) + '!');
+        recordBuffer += '\n';
+        file.bgzfFile->write(recordBuffer.data(), recordBuffer.size());
     }
 
     template < typename TStream, template<typename> class TRead, typename TSeq,
         typename = std::enable_if_t < std::is_same<TRead<TSeq>, Read<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplex<TSeq>>::value  > >
-        inline void writeRecord(TStream& stream, TRead<TSeq>& read, bool = false)
+        inline void writeRecord(TStream& stream, std::string& recordBuffer, const TRead<TSeq>& read, bool = false)
     {
-        seqan::writeRecord(*(stream.first), read.id, read.seq);
+        writeRecord(stream.first, recordBuffer, read.id, read.seq);
     }
 
     template <typename TStream, template<typename> class TRead, typename TSeq,
         typename = std::enable_if_t < std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value  > >
-        inline void writeRecord(TStream& stream, TRead<TSeq>&& read)
+        inline void writeRecord(TStream& stream, std::string& recordBuffer, const TRead<TSeq>& read)
     {
-        seqan::writeRecord(*(stream.first), std::move(read.id), std::move(read.seq));
-        seqan::writeRecord(*(stream.second), std::move(read.idRev), std::move(read.seqRev));
+        writeRecord(stream.first, recordBuffer, read.id, read.seq);
+        writeRecord(stream.second, recordBuffer, read.idRev, read.seqRev);
     }
 
-    template <typename TStream, template<typename> class TRead, typename TSeq,
-        typename = std::enable_if_t < std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value  > >
-        inline void writeRecord(TStream& stream, TRead<TSeq>& read)
+    // the reads of one batch that are written by one shard
+    template <typename TRead>
+    struct WriteJob : public WriterShard::Job
+    {
+        OutputStreams* outputStreams = nullptr;
+        unsigned int shardIndex = 0;
+        std::vector<TRead> reads;   // only the first numReads belong to the job, the others keep their buffers for later jobs
+        unsigned int numReads = 0;
+
+        void run() override
+        {
+            outputStreams->writeShard(shardIndex, reads, numReads);
+        }
+    };
+
+    // executed by the shard
+    template <typename TRead>
+    void writeShard(const unsigned int shardIndex, const std::vector<TRead>& reads, const unsigned int numReads)
+    {
+        auto& shard = *shards[shardIndex];
+        for (unsigned int i = 0; i < numReads; ++i)
+        {
+            const unsigned int streamIndex = static_cast<unsigned char>(reads[i].demuxResult);
+            ++shard.numReads[streamIndex];
+            writeRecord(fileStreams[streamIndex], shard.recordBuffer, reads[i]);
+        }
+    }
+
+    // the streams are known after the first updateStreams(), one shard per writer thread, at most one per stream
+    void createShards()
     {
-        seqan::writeRecord(*(stream.first), read.id, read.seq);
-        seqan::writeRecord(*(stream.second), read.idRev, read.seqRev);
+        const unsigned int numShards = std::max(1u, std::min<unsigned int>(numThreads, fileStreams.size()));
+        for (unsigned int i = 0; i < numShards; ++i)
+            shards.emplace_back(std::make_unique<WriterShard>(numThreads > 1));
+        for (auto& shard : shards)
+            shard->numReads.resize(fileStreams.size(), 0);
     }
 
     //Adds a new output streams to the collection of streams.
-    std::string createStream(TSeqStream& stream, const std::string fileName, bool useDefault)
+    std::string createStream(OutputFile& stream, const std::string fileName, bool useDefault)
     {
         std::string path = getBaseFilename();
         if (fileName != "")
@@ -66,7 +290,16 @@ class OutputStreams
             path += "_result";
 
         path += fileName + extension;
-        stream = std::make_unique<seqan::SeqFileOut>(path.c_str());
+        if (extension == ".fastq.gz" || extension == ".fq.gz")
+        {
+            if (!compressionPool)
+                compressionPool = std::make_unique<BgzfCompressionPool>(threadPool);
+            stream.bgzfFile = std::make_unique<BgzfWriter>(*compressionPool);
+            if (!stream.bgzfFile->open(path.c_str()))
+                throw std::runtime_error("Could not open output file " + path);
+        }
+        else
+            stream.seqFile = std::make_unique<seqan::SeqFileOut>(path.c_str());
         return path;
     }
 
@@ -74,13 +307,14 @@ class OutputStreams
 public:
     // The correct file extension is determined from the base path, according to the available
     // file extensions of the SeqFileOut and used for all stored files.
-    OutputStreams(const std::string& base, bool /*noQuality*/) : basePath(base)
+    // .fastq.gz output is compressed on threadPool, its size is the number of writer threads
+    OutputStreams(const std::string& base, bool /*noQuality*/, ptc::ThreadPool& threadPool) : basePath(base), threadPool(threadPool), numThreads(threadPool.size())
     {
         std::vector<std::string> tmpExtensions = seqan::SeqFileOut::getFileExtensions();
         tmpExtensions.push_back(".fasta");
         tmpExtensions.push_back(".fastq");
         tmpExtensions.push_back(".fastq.gz");
-        tmpExtensions.push_back(".fastq.gz");
+        tmpExtensions.push_back(".fq.gz");
         for(const auto& tmpExtension : tmpExtensions)
         {
             if (seqan::endsWith(basePath, tmpExtension))
@@ -98,18 +332,19 @@ public:
 
     inline std::string getFilename(const int streamIndex) const
     {
-        auto it = fileStreams.find(streamIndex);
-        if (it != fileStreams.end())
-            return it->second.firstFilename;
+        if (static_cast<unsigned int>(streamIndex) < fileStreams.size())
+            return fileStreams[streamIndex].firstFilename;
         return std::string();
     }
 
+    // merges the counters of all shards, complete after close()
     inline unsigned int getNumReads(const int streamIndex) const
     {
-        auto it = fileStreams.find(streamIndex);
-        if (it != fileStreams.end())
-            return it->second.numReads;
-        return 0;
+        unsigned int numReads = 0;
+        for (const auto& shard : shards)
+            if (static_cast<unsigned int>(streamIndex) < shard->numReads.size())
+                numReads += shard->numReads[streamIndex];
+        return numReads;
     }
 
     inline unsigned int getNumStreams() const
@@ -119,12 +354,16 @@ public:
 
     void addStream(const std::string fileName, const int streamIndex, const bool useDefault)
     {
+        if (fileStreams.size() <= static_cast<unsigned int>(streamIndex))
+            fileStreams.resize(streamIndex + 1);
         auto filename = createStream(fileStreams[streamIndex].first, fileName, useDefault);
         fileStreams[streamIndex].firstFilename = filename;
     }
     
     void addStreams(const std::string fileName1, const std::string fileName2, const int streamIndex, const bool useDefault)
     {
+        if (fileStreams.size() <= static_cast<unsigned int>(streamIndex))
+            fileStreams.resize(streamIndex + 1);
         auto filename = createStream(fileStreams[streamIndex].first, fileName1, useDefault);
         fileStreams[streamIndex].firstFilename = filename;
         filename = createStream(fileStreams[streamIndex].second, fileName2, useDefault);
@@ -152,7 +391,7 @@ public:
         {
             const unsigned streamIndex = i;
             // If no stream for this id exists, create one.
-            if (fileStreams.find(streamIndex) == fileStreams.end())
+            if (streamIndex >= fileStreams.size() || fileStreams[streamIndex].firstFilename.empty())
             {
                 // If the index is 0 (unidentified) create special stream.
                 // Otherwise use index to get appropriate name for output file.
@@ -177,28 +416,89 @@ public:
         }
     }
 
-    template <template<typename> class TRead, typename TSeq, typename TNames>
-    void writeSeqs(std::vector<TRead<TSeq>>& reads, const TNames& names)
+    /*
+    - every read is moved into the job of the shard that writes its stream, then the shards write asynchronously
+    - reads keeps its size, but the reads are cleared, so the batch can be refilled right away
+    - rethrows the write error of an earlier batch
+    */
+    template <template<typename> class TRead, typename TSeq, typename TAlloc, typename TNames>
+    void writeSeqs(std::vector<TRead<TSeq>, TAlloc>& reads, const TNames& names)
     {
-        updateStreams(names, std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value);
-        for(auto& read : reads)
+        using TJob = WriteJob<TRead<TSeq>>;
+        if (fileStreams.size() < length(names) + 1u)
         {
-            auto& fileStream = fileStreams[read.demuxResult];
-            ++fileStream.numReads;
-            writeRecord(fileStream, read);
+            // the shards write into fileStreams, so they have to be idle while it grows
+            for (auto& shard : shards)
+                shard->wait();
+            updateStreams(names, std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value);
+            for (auto& shard : shards)
+                shard->numReads.resize(fileStreams.size(), 0);
         }
+        if (shards.empty())
+            createShards();
+        const unsigned int numShards = shards.size();
+        std::vector<std::unique_ptr<TJob>> jobs(numShards);
+        for (unsigned int i = 0; i < numShards; ++i)
+        {
+            jobs[i] = shards[i]->template acquire<TJob>();
+            jobs[i]->outputStreams = this;
+            jobs[i]->shardIndex = i;
+            jobs[i]->numReads = 0;
+        }
+        for (auto& read : reads)
+        {
+            auto& job = *jobs[static_cast<unsigned char>(read.demuxResult) % numShards];
+            if (job.numReads == job.reads.size())
+                job.reads.emplace_back();
+            std::swap(job.reads[job.numReads++], read);
+            read.clear();
+        }
+        for (unsigned int i = 0; i < numShards; ++i)
+            shards[i]->submit(std::move(jobs[i]));
     }
 
-    template <template<typename> class TRead, typename TSeq, typename TNames>
-    void writeSeqs(std::vector<TRead<TSeq>>&& reads, const TNames& names)
+    template <template<typename> class TRead, typename TSeq, typename TAlloc, typename TNames>
+    void writeSeqs(std::vector<TRead<TSeq>, TAlloc>&& reads, const TNames& names)
     {
-        updateStreams(names, std::is_same<TRead<TSeq>, ReadPairedEnd<TSeq>>::value || std::is_same<TRead<TSeq>, ReadMultiplexPairedEnd<TSeq>>::value);
-        for (auto& read : reads)
+        writeSeqs(reads, names);
+    }
+
+    /*
+    - joins the writer shards and finishes the compressed output files
+    - returns false if one of the compressed files could not be written completely, rethrows the write error of a shard
+    */
+    bool close()
+    {
+        std::exception_ptr error;
+        for (auto& shard : shards)
+        {
+            try
+            {
+                shard->join();
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        bool success = true;
+        auto closeFile = [&success](OutputFile& file, const std::string& filename)
+        {
+            if (file.bgzfFile && !file.bgzfFile->close())
+            {
+                std::cerr << "Error while writing file " << filename << "!" << std::endl;
+                success = false;
+            }
+        };
+        for (auto& streamPair : fileStreams)
         {
-            auto& fileStream = fileStreams[read.demuxResult];
-            ++fileStream.numReads;
-            writeRecord(fileStream, std::move(read));
+            closeFile(streamPair.first, streamPair.firstFilename);
+            closeFile(streamPair.second, streamPair.secondFilename);
         }
+        if (error)
+            std::rethrow_exception(error);
+        return success;
     }
 
     ~OutputStreams(){}
@@ -226,7 +526,7 @@ public:
     operator()(TItem item)
     {
         const auto t1 = std::chrono::steady_clock::now();
-        _outputStreams.writeSeqs(*std::get<0>(*item), std::get<1>(*item));
+        _outputStreams.writeSeqs(*std::get<0>(*item), std::get<1>(*item).get());
         _stats += std::get<2>(*item);
 
         // terminal output
@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <cassert>
+#include <climits>
 
 
 #if defined(_WIN32)
@@ -227,6 +228,78 @@ public:
 };
 
 
+#if defined(__linux__)
+//---------------------------------------------------------
+// FutexEventCount (Linux)
+// waiters announce themselves with prepareWait(), check their condition and
+// then either cancelWait() or commitWait(), notify() only enters the kernel
+// if somebody is waiting
+//---------------------------------------------------------
+
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class FutexEventCount
+{
+private:
+    std::atomic<uint32_t> m_epoch;
+    std::atomic<uint32_t> m_waiters;
+
+    FutexEventCount(const FutexEventCount& other) = delete;
+    FutexEventCount& operator=(const FutexEventCount& other) = delete;
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32 bit integer");
+
+    void futexWait(const uint32_t key) noexcept
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+    }
+
+    void futexWake(const int count) noexcept
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+public:
+    FutexEventCount() : m_epoch(0), m_waiters(0) {}
+
+    uint32_t prepareWait() noexcept
+    {
+        m_waiters.fetch_add(1);     // seq_cst, pairs with the load in notify()
+        return m_epoch.load();
+    }
+
+    void cancelWait() noexcept
+    {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commitWait(const uint32_t key) noexcept
+    {
+        // futex returns immediately if the epoch already moved on, EINTR and spurious wake ups just loop
+        while (m_epoch.load(std::memory_order_acquire) == key)
+            futexWait(key);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify(const int count = 1) noexcept
+    {
+        m_epoch.fetch_add(1);       // seq_cst
+        if (m_waiters.load() != 0)
+            futexWake(count);
+    }
+
+    void notifyAll() noexcept
+    {
+        notify(INT_MAX);
+    }
+};
+
+#endif
+
+
 using DefaultSemaphoreType = LightweightSemaphore ;
 
 
@@ -38,6 +38,9 @@
 #define SEQAN_ENABLE_TESTING 1
 
 #include <limits>
+#include <random>
+#include <string>
+#include <vector>
 #include <seqan/basic.h>
 #include <seqan/sequence.h>
 #include <seqan/seq_io.h>
@@ -314,6 +317,311 @@ SEQAN_DEFINE_TEST(align_adapter_test)
     SEQAN_ASSERT_EQ(result.score, 0);
 }
 
+SEQAN_DEFINE_TEST(align_adapter_dna5q_test)
+{
+    // the kernel on packed Dna5Q bytes has to find the same alignment as the one on ascii characters, independent of the qualities
+    const std::string readString = "CATCATAAAAAATATATTANNAGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+    const std::string adapterString = "AGATCGGAAGAGCACANGTCTGAACTCCAGTCACNNNTT";
+    seqan::Dna5QString read = readString;
+    for (unsigned int i = 0; i < length(read); ++i)
+        seqan::assignQualityValue(read[i], i % 42);
+
+    AlignResult<unsigned char> asciiResult;
+    AlignResult<unsigned char> dna5qResult;
+    alignPair(asciiResult, readString, adapterString, 0, 10, AlignAlgorithm::Menkuec());
+    alignPair(dna5qResult, read, encodeAdapter(adapterString), 0, 10, AlignAlgorithm::Menkuec());
+    SEQAN_ASSERT_EQ(asciiResult.shiftPos, 21);
+    SEQAN_ASSERT_EQ(dna5qResult.shiftPos, asciiResult.shiftPos);
+    SEQAN_ASSERT_EQ(dna5qResult.overlap, asciiResult.overlap);
+    SEQAN_ASSERT_EQ(dna5qResult.matches, asciiResult.matches);
+    SEQAN_ASSERT_EQ(dna5qResult.ambiguous, asciiResult.ambiguous);
+    SEQAN_ASSERT_EQ(dna5qResult.score, asciiResult.score);
+}
+
+SEQAN_DEFINE_TEST(align_adapter_quality_test)
+{
+    // 2 mismatches with the adapter at read positions 21 and 29
+    seqan::Dna5QString read = "CATCATAAAAAATATATTAAGTTCGGAAGTGC";
+    const std::string adapter = encodeAdapter("AGATCGGAAGAGC");
+    std::vector<uint16_t> weights;
+    AlignResult<unsigned char> result;
+
+    // high quality mismatches count as mismatches
+    for (unsigned int i = 0; i < length(read); ++i)
+        seqan::assignQualityValue(read[i], 40);
+    getQualityErrorWeights(weights, read);
+    alignPair(result, read, weights, adapter, 0, 0, AlignAlgorithm::MenkuecQ());
+    SEQAN_ASSERT_EQ(result.shiftPos, 19);
+    SEQAN_ASSERT_EQ(result.overlap, 13u);
+    SEQAN_ASSERT_EQ(result.matches, 11u);
+    SEQAN_ASSERT_EQ(result.mismatches, 2u);
+    SEQAN_ASSERT_EQ(result.ambiguous, 0u);
+
+    // mismatches on bases with quality 0 are most likely sequencing errors and count as ambiguous
+    seqan::assignQualityValue(read[21], 0);
+    seqan::assignQualityValue(read[29], 0);
+    getQualityErrorWeights(weights, read);
+    alignPair(result, read, weights, adapter, 0, 0, AlignAlgorithm::MenkuecQ());
+    SEQAN_ASSERT_EQ(result.shiftPos, 19);
+    SEQAN_ASSERT_EQ(result.matches, 11u);
+    SEQAN_ASSERT_EQ(result.mismatches, 0u);
+    SEQAN_ASSERT_EQ(result.ambiguous, 2u);
+}
+
+SEQAN_DEFINE_TEST(align_adapter_bounded_test)
+{
+    const std::string adapter = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+    const std::vector<std::string> reads{ "CATCATAAAAAATATATTAAGATCGGAAGTGCACACGTCTGAACT", "AGATCGGAAGAGCACACGTCTGAACTCCAGTCACCATCAT",
+        "CATCATAAAAAATATATTACGTTAGCTACGATCGATTTAGC", "CATCATAAAAAATATATTACGTTAGCTACGATCGATTAGAT", "CATCATAAAAAATATATTANGATCGGAAGAGCAC" };
+    const AdapterMatchSettings settings(4, 0, 0.1, 0, 1);
+    const auto isMatchFunctor = [&settings](const unsigned int overlap, const unsigned int mismatches)
+    {
+        return isMatch(overlap, mismatches, settings, ErrorRateMode::linear());
+    };
+    AlignResult<unsigned char> expected;
+    AlignResult<unsigned char> result;
+
+    // the bounded search has to find the same alignment as the full sweep whenever it is a match
+    for (const auto& read : reads)
+    {
+        alignPair(expected, read, adapter, 0, length(adapter) - 4, AlignAlgorithm::Menkuec());
+        alignPair(result, read, adapter, 0, length(adapter) - 4, isMatchFunctor, AlignAlgorithm::MenkuecBounded());
+        const bool expectedMatch = expected.matches != 0 && isMatchFunctor(expected.overlap, expected.mismatches);
+        SEQAN_ASSERT_EQ(result.matches != 0 && isMatchFunctor(result.overlap, result.mismatches), expectedMatch);
+        if (!expectedMatch)
+            continue;
+        SEQAN_ASSERT_EQ(result.shiftPos, expected.shiftPos);
+        SEQAN_ASSERT_EQ(result.overlap, expected.overlap);
+        SEQAN_ASSERT_EQ(result.matches, expected.matches);
+        SEQAN_ASSERT_EQ(result.mismatches, expected.mismatches);
+        SEQAN_ASSERT_EQ(result.ambiguous, expected.ambiguous);
+    }
+}
+
+SEQAN_DEFINE_TEST(align_adapter_batch_test)
+{
+    const std::string adapter = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+    const std::vector<std::string> reads{ "CATCATAAAAAATATATTAAGATCGGAAGTGCACACGTCTG", "AGATCGGAAGAGCACACGTCTGAACTCCAGTCACCATCATA",
+        "CATCATAAAAAATATATTACGTTAGCTACGATCGATTTAGC", "CATCATAAAAAATATATTACGTTAGCTACGATCGATTAGAT", "CATCATAAAAAATATATTANGATCGGAAGAGCACCATCATA" };
+    TransposedReadBatch batch;
+    batch.clear(length(reads[0]));
+    for (const auto& read : reads)
+        batch.add(read);
+    SEQAN_ASSERT_EQ(batch.getNumReads(), length(reads));
+
+    // every lane has to give the same alignment as the single read kernel
+    std::vector<AlignResult<unsigned char>> results(batch.getNumReads());
+    alignPair(results.data(), batch, adapter, 0, length(adapter) - 4, AsciiEncoding(), AlignAlgorithm::MenkuecBatch());
+    AlignResult<unsigned char> expected;
+    for (unsigned int i = 0; i < length(reads); ++i)
+    {
+        alignPair(expected, reads[i], adapter, 0, length(adapter) - 4, AlignAlgorithm::Menkuec());
+        SEQAN_ASSERT_EQ(results[i].shiftPos, expected.shiftPos);
+        SEQAN_ASSERT_EQ(results[i].overlap, expected.overlap);
+        SEQAN_ASSERT_EQ(results[i].matches, expected.matches);
+        SEQAN_ASSERT_EQ(results[i].ambiguous, expected.ambiguous);
+        SEQAN_ASSERT_EQ(results[i].score, expected.score);
+    }
+}
+
+// random bases with a few N, a mutated prefix of adapter is appended to some reads
+std::string randomRead(std::mt19937& rng, const unsigned int len, const std::string& adapter)
+{
+    std::string read(len, 'A');
+    for (auto& base : read)
+        base = rng() % 50 == 0 ? 'N' : "ACGT"[rng() % 4];
+    if (len > 0 && rng() % 3 != 0)
+    {
+        const unsigned int adapterPos = rng() % len;
+        for (unsigned int k = 0; adapterPos + k < len && k < adapter.size(); ++k)
+            read[adapterPos + k] = rng() % 10 == 0 ? "ACGTN"[rng() % 5] : adapter[k];
+    }
+    return read;
+}
+
+typedef AlignResult<unsigned int> TSimdTestResult;
+
+// results of every kernel that alignPair() selects with getSimdLevel(), in a fixed order
+std::vector<TSimdTestResult> alignWithAllKernels(const std::vector<std::vector<std::string>>& readGroups, const std::vector<std::string>& adapters)
+{
+    std::vector<TSimdTestResult> results;
+    const auto next = [&results]() -> TSimdTestResult&
+    {
+        results.emplace_back();
+        return results.back();
+    };
+    const AdapterMatchSettings settings(4, 0, 0.1, 0, 1);
+    const auto isMatchFunctor = [&settings](const unsigned int overlap, const unsigned int mismatches)
+    {
+        return isMatch(overlap, mismatches, settings, ErrorRateMode::linear());
+    };
+    std::vector<uint16_t> weights;
+    std::vector<unsigned char> mateReverseComplement;
+    for (unsigned int g = 0; g < readGroups.size(); ++g)
+    {
+        const auto& reads = readGroups[g];
+        const std::string& adapter = adapters[g % adapters.size()];
+        const int rightOverhang = static_cast<int>(length(adapter)) - 4;
+        for (unsigned int i = 0; i < reads.size(); ++i)
+        {
+            seqan::Dna5QString read = reads[i];
+            for (unsigned int k = 0; k < length(read); ++k)
+                seqan::assignQualityValue(read[k], (i + k * 7) % 42);
+            alignPair(next(), reads[i], adapter, 0, rightOverhang, AlignAlgorithm::Menkuec());
+            alignPair(next(), reads[i], adapter, 0, rightOverhang, isMatchFunctor, AlignAlgorithm::MenkuecBounded());
+            alignPair(next(), read, encodeAdapter(adapter), 0, rightOverhang, AlignAlgorithm::Menkuec());
+            getQualityErrorWeights(weights, read);
+            alignPair(next(), read, weights, encodeAdapter(adapter), 0, rightOverhang, AlignAlgorithm::MenkuecQ());
+            alignPair(next(), reads[i], reads[(i + 1) % reads.size()], mateReverseComplement, AlignAlgorithm::MateOverlap());
+        }
+        // the batch size depends on the level, so the reads are split into different batches
+        TransposedReadBatch batch;
+        for (unsigned int i = 0; i < reads.size();)
+        {
+            batch.clear(length(reads[i]));
+            const unsigned int first = i;
+            while (i < reads.size() && !batch.full())
+                batch.add(reads[i++]);
+            results.resize(results.size() + i - first);
+            alignPair(&results[results.size() - (i - first)], batch, adapter, 0, rightOverhang, AsciiEncoding(), AlignAlgorithm::MenkuecBatch());
+        }
+    }
+    return results;
+}
+
+SEQAN_DEFINE_TEST(align_adapter_simd_levels_test)
+{
+    // reads and adapters shorter and longer than the registers of every level
+    std::mt19937 rng(42);
+    std::vector<std::string> adapters{ "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC", "CTGTCTCTTATACACATCT" };
+    for (unsigned int len : {5u, 16u, 17u, 32u, 33u, 63u, 64u, 65u, 70u})
+        adapters.push_back(randomRead(rng, len, ""));
+    std::vector<std::vector<std::string>> readGroups;
+    for (unsigned int len : {1u, 4u, 15u, 16u, 17u, 31u, 32u, 33u, 63u, 64u, 65u, 100u, 127u, 128u, 129u, 151u, 250u, 400u})
+    {
+        readGroups.emplace_back();
+        for (unsigned int i = 0; i < 150; ++i)
+            readGroups.back().push_back(randomRead(rng, len, adapters[(len + i) % adapters.size()]));
+    }
+
+    SEQAN_ASSERT(setSimdLevel(SimdLevel::sse42));
+    const std::vector<TSimdTestResult> expected = alignWithAllKernels(readGroups, adapters);
+    for (const SimdLevel simdLevel : {SimdLevel::avx2, SimdLevel::avx512bw})
+    {
+        if (!setSimdLevel(simdLevel))
+        {
+            std::cout << toString(simdLevel) << " is not supported by this CPU, its kernels are not tested" << std::endl;
+            continue;
+        }
+        SEQAN_ASSERT(getSimdLevel() == simdLevel);
+        const std::vector<TSimdTestResult> results = alignWithAllKernels(readGroups, adapters);
+        SEQAN_ASSERT_EQ(results.size(), expected.size());
+        for (unsigned int i = 0; i < results.size() && i < expected.size(); ++i)
+        {
+            SEQAN_ASSERT_EQ(results[i].shiftPos, expected[i].shiftPos);
+            SEQAN_ASSERT_EQ(results[i].score, expected[i].score);
+            SEQAN_ASSERT_EQ(results[i].overlap, expected[i].overlap);
+            SEQAN_ASSERT_EQ(results[i].matches, expected[i].matches);
+            SEQAN_ASSERT_EQ(results[i].mismatches, expected[i].mismatches);
+            SEQAN_ASSERT_EQ(results[i].ambiguous, expected[i].ambiguous);
+            SEQAN_ASSERT_EQ(results[i].errorRate, expected[i].errorRate);
+        }
+    }
+    SEQAN_ASSERT(setSimdLevel(getSupportedSimdLevel()));
+}
+
+SEQAN_DEFINE_TEST(align_adapter_gapped_test)
+{
+    const std::string adapter = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+    AlignResult<unsigned char> result;
+
+    // adapter with a deleted base inside the read
+    std::string deleted = adapter;
+    deleted.erase(11, 1);
+    const std::string readString = "CATCATAAAAAATATATTA" + deleted + "ATCTCGTATG";
+    alignPair(result, readString, adapter, 0, 10, AlignAlgorithm::Myers());
+    SEQAN_ASSERT_EQ(result.shiftPos, 19);
+    SEQAN_ASSERT_EQ(result.overlap, 34u);
+    SEQAN_ASSERT_EQ(result.matches, 33u);
+    SEQAN_ASSERT_EQ(result.mismatches, 1u);
+    SEQAN_ASSERT_EQ(result.indels, -1);
+
+    // the ungapped alignment can not bridge the deletion
+    AlignResult<unsigned char> ungappedResult;
+    alignPair(ungappedResult, readString, adapter, 0, 10, AlignAlgorithm::Menkuec());
+    SEQAN_ASSERT_GT(ungappedResult.errorRate, result.errorRate);
+
+    // packed Dna5Q bytes give the same alignment
+    seqan::Dna5QString read = readString;
+    AlignResult<unsigned char> dna5qResult;
+    alignPair(dna5qResult, read, encodeAdapter(adapter), 0, 10, AlignAlgorithm::Myers());
+    SEQAN_ASSERT_EQ(dna5qResult.shiftPos, result.shiftPos);
+    SEQAN_ASSERT_EQ(dna5qResult.overlap, result.overlap);
+    SEQAN_ASSERT_EQ(dna5qResult.mismatches, result.mismatches);
+    SEQAN_ASSERT_EQ(dna5qResult.indels, result.indels);
+
+    // adapter prefix with an inserted base at the read end
+    std::string inserted = adapter.substr(0, 14);
+    inserted.insert(5, "T");
+    alignPair(result, "CATCATAAAAAATATATTA" + inserted, adapter, 0, 30, AlignAlgorithm::Myers());
+    SEQAN_ASSERT_EQ(result.shiftPos, 19);
+    SEQAN_ASSERT_EQ(result.overlap, 14u);
+    SEQAN_ASSERT_EQ(result.mismatches, 1u);
+    SEQAN_ASSERT_EQ(result.indels, 1);
+}
+
+SEQAN_DEFINE_TEST(adapter_index_test)
+{
+    const AdapterSet adapters{ AdapterItem("AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC"), AdapterItem("CTGTCTCTTATACACATCT") };
+    AdapterIndex adapterIndex;
+    adapterIndex.build(adapters, AdapterMatchSettings(4, 0, 0.1, 0, 1), ErrorRateMode::linear());
+    SEQAN_ASSERT(adapterIndex.enabled());
+    AdapterIndex::ReadHits hits;
+
+    // no adapter in the read
+    seqan::Dna5QString read = "CATCATAAAAAATATATTACGTTAGCTACGATCGATTTAGC";
+    adapterIndex.scan(hits, read);
+    SEQAN_ASSERT(!adapterIndex.mayMatch(hits, read, 0, adapters[0], 0, 30));
+    SEQAN_ASSERT(!adapterIndex.mayMatch(hits, read, 1, adapters[1], 0, 15));
+
+    // first adapter with 2 mismatches, found by its k-mers
+    read = "CATCATAAAAAATATATTAAGATCGGAAGTGCACACGTCTGAACT";
+    adapterIndex.scan(hits, read);
+    SEQAN_ASSERT(adapterIndex.mayMatch(hits, read, 0, adapters[0], 0, 30));
+    SEQAN_ASSERT(!adapterIndex.mayMatch(hits, read, 1, adapters[1], 0, 15));
+
+    // short overlap of the second adapter at the read end, too short for k-mers
+    read = "CATCATAAAAAATATATTACGTTAGCTACGATCGATTCTGTC";
+    adapterIndex.scan(hits, read);
+    SEQAN_ASSERT(!adapterIndex.mayMatch(hits, read, 0, adapters[0], 0, 30));
+    SEQAN_ASSERT(adapterIndex.mayMatch(hits, read, 1, adapters[1], 0, 15));
+
+    // reads with N are not filtered
+    read = "CATCATAAAAAATATATTACGTTAGCTANGATCGATTTAGC";
+    adapterIndex.scan(hits, read);
+    SEQAN_ASSERT(adapterIndex.mayMatch(hits, read, 0, adapters[0], 0, 30));
+}
+
+SEQAN_DEFINE_TEST(oriented_adapters_test)
+{
+    SEQAN_ASSERT_EQ(ReverseComplement("AGATCGGAAGAGC"), "GCTCTTCCGATCT");
+    SEQAN_ASSERT_EQ(ReverseComplement("acgtX"), "NACGT");
+    const AdapterItem adapter("CTGTCTCTTATACACATCT", AdapterItem::end5, 2, 1, true, true);
+    const AdapterItem reverseComplement = adapter.getReverseComplement();
+    SEQAN_ASSERT_EQ(reverseComplement.getSeq(), "AGATGTGTATAAGAGACAG");
+    SEQAN_ASSERT_EQ(reverseComplement.getEncodedSeq(), encodeAdapter("AGATGTGTATAAGAGACAG"));
+    SEQAN_ASSERT_EQ(reverseComplement.adapterEnd, AdapterItem::end5);
+    SEQAN_ASSERT(reverseComplement.reverse);
+
+    // reverse adapters are only searched in the reverse read
+    const AdapterSet adapters{ AdapterItem("AGATCGGAAGAGC", AdapterItem::end3, 0, 0, false, false), adapter,
+        AdapterItem("TGGAATTCTCGG", AdapterItem::end3, 0, 2, false, false) };
+    OrientedAdapters orientedAdapters;
+    orientedAdapters.build(adapters);
+    SEQAN_ASSERT(orientedAdapters.get(adapterDirection::forward) == std::vector<unsigned int>({ 0, 2 }));
+    SEQAN_ASSERT(orientedAdapters.get(adapterDirection::reverse) == std::vector<unsigned int>({ 1 }));
+}
+
 SEQAN_DEFINE_TEST(strip_pair_test)
 {
 	typedef seqan::String<seqan::Dna5Q> TSeq;
@@ -327,6 +635,14 @@ SEQAN_DEFINE_TEST(strip_pair_test)
 
 	unsigned insert2 = stripPair(seq1,seq3);
 	SEQAN_ASSERT_EQ(insert2, 0u);
+
+    // insert shorter than the reads, both reads continue into their adapters
+    TSeq read1("CATCATAAAAAATATATTAGAGATCGGAAGAGCACACGTC");
+    TSeq read2("CTAATATATTTTTTATGATGAGATCGTCGGACTGTAGAAC");
+    unsigned insert3 = stripPair(read1, read2);
+    SEQAN_ASSERT_EQ(insert3, 20u);
+    SEQAN_ASSERT_EQ(read1, TSeq("CATCATAAAAAATATATTAG"));
+    SEQAN_ASSERT_EQ(read2, TSeq("CTAATATATTTTTTATGATG"));
 }
 
 SEQAN_BEGIN_TESTSUITE(test_my_app_funcs)
@@ -337,6 +653,14 @@ SEQAN_BEGIN_TESTSUITE(test_my_app_funcs)
 	SEQAN_CALL_TEST(match_test);
 	SEQAN_CALL_TEST(strip_adapter_test);
 	SEQAN_CALL_TEST(align_adapter_test);
+	SEQAN_CALL_TEST(align_adapter_dna5q_test);
+	SEQAN_CALL_TEST(align_adapter_quality_test);
+	SEQAN_CALL_TEST(align_adapter_bounded_test);
+	SEQAN_CALL_TEST(align_adapter_batch_test);
+	SEQAN_CALL_TEST(align_adapter_simd_levels_test);
+	SEQAN_CALL_TEST(align_adapter_gapped_test);
+	SEQAN_CALL_TEST(adapter_index_test);
+	SEQAN_CALL_TEST(oriented_adapters_test);
 	SEQAN_CALL_TEST(strip_pair_test);
 }
 SEQAN_END_TESTSUITE
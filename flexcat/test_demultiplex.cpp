@@ -306,6 +306,90 @@ SEQAN_DEFINE_TEST(findExactIndex_test)
 		SEQAN_ASSERT_EQ(exspected[i], res);
 	}
 }
+// Checks the hash based matcher in exact and approximate mode, including N and ambiguous variants.
+SEQAN_DEFINE_TEST(hashBarcodeMatcher_test)
+{
+    using TRead = Read<seqan::Dna5QString>;
+    std::vector<std::string> barcodes;
+    appendValue(barcodes, "AAAAAA");
+    appendValue(barcodes, "CCCCCC");
+    appendValue(barcodes, "ACGTAC");
+    appendValue(barcodes, "ACGTAG");
+
+    std::vector<TRead> reads(8);
+    reads[0].seq = "CCCCCCGATACA";
+    reads[1].seq = "AAAAAA";
+    reads[2].seq = "ACGTACGATACA";
+    reads[3].seq = "AAGAAAGATACA";
+    reads[4].seq = "CCCNCCGATACA";
+    reads[5].seq = "CCNNCCGATACA";
+    reads[6].seq = "ACGTATGATACA";
+    reads[7].seq = "GATACAGATACA";
+
+    HashBarcodeMatcher exactMatcher(barcodes, false);
+    HashBarcodeMatcher approximateMatcher(barcodes, true);
+
+    // ACGTAT is one substitution away from two barcodes
+    int exspectedExact[] = {1,0,2,-1,-1,-1,-1,-1};
+    int exspectedApproximate[] = {1,0,2,0,1,-1,AMBIGUOUS_BARCODE,-1};
+    for (unsigned i = 0; i < length(reads); ++i)
+    {
+        SEQAN_ASSERT_EQ(exspectedExact[i], exactMatcher.getMatchIndex(reads[i]));
+        SEQAN_ASSERT_EQ(exspectedApproximate[i], approximateMatcher.getMatchIndex(reads[i]));
+    }
+    SEQAN_ASSERT_EQ(0u, exactMatcher.getAmbiguousVariants());
+    // ACGTAA, ACGTAT and ACGTAN, the exact barcodes win over the variants of each other
+    SEQAN_ASSERT_EQ(3u, approximateMatcher.getAmbiguousVariants());
+}
+// Checks matching with two mismatches and the separate counting of ambiguous reads.
+SEQAN_DEFINE_TEST(hammingBarcodeMatcher_test)
+{
+    using TRead = Read<seqan::Dna5QString>;
+    std::vector<std::string> barcodes;
+    appendValue(barcodes, "AAAAAAAAAAAA");
+    appendValue(barcodes, "CCCCCCCCCCCC");
+    appendValue(barcodes, "ACGTACGTACGT");
+    appendValue(barcodes, "ACGTACGTAGGA");
+
+    std::vector<TRead> reads(6);
+    reads[0].seq = "CCCCCCCCCCCCGATACA";
+    reads[1].seq = "AAAAAGAAAAANGATACA";
+    reads[2].seq = "ACGTACGTACGTGATACA";
+    reads[3].seq = "TTAAAAAAAAATGATACA";
+    reads[4].seq = "ACGTACGTAGGTGATACA";
+    reads[5].seq = "ACGTACGTATGTGATACA";
+
+    HammingBarcodeMatcher matcher(barcodes, 2);
+
+    // ACGTACGTATGT has one mismatch to ACGTACGTACGT and two to ACGTACGTAGGA
+    int exspected[] = {1,0,2,-1,AMBIGUOUS_BARCODE,2};
+    for (unsigned i = 0; i < length(reads); ++i)
+        SEQAN_ASSERT_EQ(exspected[i], matcher.getMatchIndex(reads[i]));
+
+    // ambiguous reads stay unidentified, but are counted after the barcodes
+    GeneralStats stats(length(barcodes) + 2, 0);
+    demultiplex(reads, matcher, false, stats, true, false);
+    int exspectedResult[] = {2,1,3,0,0,3};
+    for (unsigned i = 0; i < length(reads); ++i)
+        SEQAN_ASSERT_EQ(exspectedResult[i], reads[i].demuxResult);
+    SEQAN_ASSERT_EQ(1u, stats.matchedBarcodeReads[0]);
+    SEQAN_ASSERT_EQ(2u, stats.matchedBarcodeReads[3]);
+    SEQAN_ASSERT_EQ(1u, stats.matchedBarcodeReads[5]);
+
+    // N in the read is a mismatch, also against N in a barcode
+    std::vector<std::string> barcodesN;
+    appendValue(barcodesN, "ACGTACGTACNA");
+    appendValue(barcodesN, "ACGTACGTACCA");
+    appendValue(barcodesN, "GGGGGGNGGGGG");
+    HammingBarcodeMatcher matcherN(barcodesN, 1);
+    std::vector<TRead> readsN(3);
+    readsN[0].seq = "ACGTACGTACNAGATACA";
+    readsN[1].seq = "GGGGGGNGGGGGGATACA";
+    readsN[2].seq = "GGGGGANGGGGGGATACA";
+    int exspectedN[] = {AMBIGUOUS_BARCODE,2,-1};
+    for (unsigned i = 0; i < length(readsN); ++i)
+        SEQAN_ASSERT_EQ(exspectedN[i], matcherN.getMatchIndex(readsN[i]));
+}
 // Checks the correctnes of the findAllExactIndex function which searches for many pieces of sequence in the barcodes. Implicitly checks the construction of the Index.
 SEQAN_DEFINE_TEST(matchBarcodes_test) 
 {
@@ -511,6 +595,8 @@ SEQAN_BEGIN_TESTSUITE(test_my_app_funcs)
 	SEQAN_CALL_TEST(buildVariations_test);
 	SEQAN_CALL_TEST(buildAllVariations_test);
 	SEQAN_CALL_TEST(findExactIndex_test); 
+	SEQAN_CALL_TEST(hashBarcodeMatcher_test);
+	SEQAN_CALL_TEST(hammingBarcodeMatcher_test);
 	SEQAN_CALL_TEST(matchBarcodes_test); 
 	SEQAN_CALL_TEST(clipBarcodes_test);
 	SEQAN_CALL_TEST(clipBarcodesStrict_test);
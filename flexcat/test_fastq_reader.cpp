@@ -0,0 +1,325 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Tests for the readers that bypass SeqFileIn: parseFastqRecord, MappedFastqReader,
+// GzipDecompressor, InflatingFastqReader and BgzfWriter.
+// ==========================================================================
+
+#undef SEQAN_ENABLE_TESTING
+#define SEQAN_ENABLE_TESTING 1
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <seqan/basic.h>
+#include <zlib.h>
+
+#include "fastq_reader.h"
+#include "gzip_reader.h"
+#include "bgzf_writer.h"
+
+using namespace seqan;
+
+// records of varying length, so record boundaries fall on arbitrary offsets of the chunks
+std::string makeFastq(const unsigned int numRecords)
+{
+    std::string fastq;
+    for (unsigned int i = 0; i < numRecords; ++i)
+    {
+        const unsigned int len = 50 + (i * 7) % 101;
+        std::string seq(len, 'A');
+        for (unsigned int j = 0; j < len; ++j)
+            seq[j] = "ACGTN"[(i + j * 3) % 5];
+        fastq += "@read" + std::to_string(i) + "\n" + seq + "\n+\n" + std::string(len, static_cast<char>('!' + i % 40)) + "\n";
+    }
+    return fastq;
+}
+
+void writeFile(const char* path, const std::string& data)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(data.data(), data.size());
+}
+
+std::string readFile(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// mode "wb" writes a new file, "ab" appends another gzip member
+void writeGzip(const char* path, const std::string& data, const char* mode)
+{
+    gzFile file = gzopen(path, mode);
+    gzwrite(file, data.data(), static_cast<unsigned int>(data.size()));
+    gzclose(file);
+}
+
+// a write error either throws from write() or makes close() return false
+bool writeBgzf(const char* path, const std::string& data)
+{
+    ptc::ThreadPool threadPool(2);
+    BgzfCompressionPool pool(threadPool);
+    BgzfWriter writer(pool);
+    if (!writer.open(path))
+        return false;
+    writer.write(data.data(), data.size());
+    return writer.close();
+}
+
+// concatenates all records of the reader back into FASTQ text
+std::string readAll(FastqBatchReader& reader, const unsigned int batchSize)
+{
+    std::string fastq;
+    while (true)
+    {
+        const auto& batch = reader.readBatch(batchSize);
+        if (batch.empty())
+            break;
+        for (const auto& record : batch)
+            fastq += "@" + std::string(record.id) + "\n" + std::string(record.seq) + "\n+\n" + std::string(record.qual) + "\n";
+    }
+    return fastq;
+}
+
+bool parseThrows(const std::string& data, const bool isLastBlock)
+{
+    const char* pos = data.data();
+    FastqRecordView record;
+    try
+    {
+        parseFastqRecord(pos, data.data() + data.size(), record, isLastBlock);
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+SEQAN_DEFINE_TEST(parseFastqRecord_test)
+{
+    FastqRecordView record;
+    {
+        const std::string data = "@r1\nACGT\n+\nIIII\n\n@r2\r\nGG\r\n+r2\r\n#!\r\n";
+        const char* pos = data.data();
+        const char* end = data.data() + data.size();
+        SEQAN_ASSERT(parseFastqRecord(pos, end, record));
+        SEQAN_ASSERT_EQ(std::string(record.id), "r1");
+        SEQAN_ASSERT_EQ(std::string(record.seq), "ACGT");
+        SEQAN_ASSERT_EQ(std::string(record.qual), "IIII");
+        SEQAN_ASSERT(parseFastqRecord(pos, end, record));
+        SEQAN_ASSERT_EQ(std::string(record.id), "r2");
+        SEQAN_ASSERT_EQ(std::string(record.seq), "GG");
+        SEQAN_ASSERT_EQ(std::string(record.qual), "#!");
+        SEQAN_ASSERT(!parseFastqRecord(pos, end, record));
+        SEQAN_ASSERT(pos == end);
+    }
+    // missing final newline, only valid in the last block
+    {
+        const std::string data = "@r1\nACGT\n+\nIIII";
+        const char* pos = data.data();
+        SEQAN_ASSERT(!parseFastqRecord(pos, data.data() + data.size(), record, false));
+        SEQAN_ASSERT(pos == data.data());
+        SEQAN_ASSERT(parseFastqRecord(pos, data.data() + data.size(), record, true));
+        SEQAN_ASSERT_EQ(std::string(record.qual), "IIII");
+        SEQAN_ASSERT(pos == data.data() + data.size());
+    }
+    // malformed records
+    SEQAN_ASSERT(parseThrows("r1\nACGT\n+\nIIII\n", true));
+    SEQAN_ASSERT(parseThrows("@r1\nACGT\n-\nIIII\n", true));
+    SEQAN_ASSERT(parseThrows("@r1\nACGT\n+\nIII\n", true));
+    // truncated record, incomplete in a block but an error at the end of the file
+    SEQAN_ASSERT(!parseThrows("@r1\nACGT\n+\n", false));
+    SEQAN_ASSERT(parseThrows("@r1\nACGT\n+\n", true));
+    SEQAN_ASSERT(parseThrows("@r1\nACGT\n", true));
+}
+
+SEQAN_DEFINE_TEST(mappedFastqReader_test)
+{
+    const char* path = SEQAN_TEMP_FILENAME();
+    std::string fastq = makeFastq(1000);
+    {
+        fastq.pop_back();    // missing final newline
+        writeFile(path, fastq);
+        MappedFastqReader reader;
+        SEQAN_ASSERT(reader.open(path));
+        SEQAN_ASSERT(!reader.atEnd());
+        SEQAN_ASSERT_EQ(readAll(reader, 33), fastq + "\n");
+        SEQAN_ASSERT(reader.atEnd());
+    }
+    {
+        writeFile(path, "");
+        MappedFastqReader reader;
+        SEQAN_ASSERT(reader.open(path));
+        SEQAN_ASSERT(reader.atEnd());
+        SEQAN_ASSERT(reader.readBatch(10).empty());
+    }
+    {
+        writeFile(path, "@r1\nACGT\n+\nIIII\n@r2\nACGT\n+\n");
+        MappedFastqReader reader;
+        SEQAN_ASSERT(reader.open(path));
+        FastqRecordView record;
+        SEQAN_ASSERT(reader.readRecord(record));
+        bool thrown = false;
+        try
+        {
+            reader.readRecord(record);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        SEQAN_ASSERT(thrown);
+    }
+    SEQAN_ASSERT(!MappedFastqReader().open("this_file_does_not_exist.fq"));
+}
+
+// more than 2 chunks of plain gzip input, records are split across the chunk boundaries
+SEQAN_DEFINE_TEST(inflatingFastqReader_chunkBoundary_test)
+{
+    const char* path = SEQAN_TEMP_FILENAME();
+    const std::string fastq = makeFastq(60000);
+    SEQAN_ASSERT_GT(fastq.size(), 2u * (1u << 21));
+    writeGzip(path, fastq, "wb");
+    {
+        ptc::ThreadPool threadPool(2);
+        InflatingFastqReader reader;
+        SEQAN_ASSERT(reader.open(path, threadPool));
+        SEQAN_ASSERT_EQ(readAll(reader, 1000), fastq);
+    }
+    SEQAN_ASSERT(writeBgzf(path, fastq));
+    for (unsigned int numThreads : {1u, 3u})
+    {
+        ptc::ThreadPool threadPool(numThreads);
+        GzipDecompressor decompressor;
+        SEQAN_ASSERT(decompressor.open(path, threadPool));
+        SEQAN_ASSERT(decompressor.isBgzf());
+        InflatingFastqReader reader;
+        SEQAN_ASSERT(reader.open(path, threadPool));
+        SEQAN_ASSERT_EQ(readAll(reader, 777), fastq);
+    }
+}
+
+SEQAN_DEFINE_TEST(inflatingFastqReader_concatenatedMembers_test)
+{
+    const char* path = SEQAN_TEMP_FILENAME();
+    const std::string first = makeFastq(100);
+    const std::string second = makeFastq(5000);
+    writeGzip(path, first, "wb");
+    writeGzip(path, second, "ab");
+    writeGzip(path, first, "ab");
+    ptc::ThreadPool threadPool(1);
+    {
+        GzipDecompressor decompressor;
+        SEQAN_ASSERT(decompressor.open(path, threadPool));
+        SEQAN_ASSERT(!decompressor.isBgzf());
+        std::string inflated;
+        GzipDecompressor::Chunk chunk;
+        while (decompressor.next(chunk))
+            inflated.append(chunk.begin(), chunk.end());
+        SEQAN_ASSERT_EQ(inflated, first + second + first);
+    }
+    InflatingFastqReader reader;
+    SEQAN_ASSERT(reader.open(path, threadPool));
+    SEQAN_ASSERT_EQ(readAll(reader, 64), first + second + first);
+}
+
+SEQAN_DEFINE_TEST(inflatingFastqReader_truncated_test)
+{
+    const char* path = SEQAN_TEMP_FILENAME();
+    const std::string fastq = makeFastq(20000);
+    std::vector<std::string> files;
+    writeGzip(path, fastq, "wb");
+    files.push_back(readFile(path));
+    SEQAN_ASSERT(writeBgzf(path, fastq));
+    files.push_back(readFile(path));
+    ptc::ThreadPool threadPool(2);
+    for (const auto& file : files)
+    {
+        writeFile(path, file.substr(0, file.size() / 2));
+        InflatingFastqReader reader;
+        SEQAN_ASSERT(reader.open(path, threadPool));
+        bool thrown = false;
+        try
+        {
+            readAll(reader, 100);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        SEQAN_ASSERT(thrown);
+    }
+}
+
+// the reader is destroyed long before the end of the file, the background threads have to stop without reading the rest
+SEQAN_DEFINE_TEST(inflatingFastqReader_earlyDestruction_test)
+{
+    const char* path = SEQAN_TEMP_FILENAME();
+    const std::string fastq = makeFastq(200000);
+    writeGzip(path, fastq, "wb");
+    ptc::ThreadPool threadPool(2);
+    {
+        InflatingFastqReader reader;
+        SEQAN_ASSERT(reader.open(path, threadPool));
+        SEQAN_ASSERT_EQ(reader.readBatch(10).size(), 10u);
+    }
+    SEQAN_ASSERT(writeBgzf(path, fastq));
+    {
+        InflatingFastqReader reader;
+        SEQAN_ASSERT(reader.open(path, threadPool));
+        SEQAN_ASSERT_EQ(reader.readBatch(10).size(), 10u);
+    }
+    {
+        GzipDecompressor decompressor;
+        SEQAN_ASSERT(decompressor.open(path, threadPool));
+    }
+}
+
+SEQAN_DEFINE_TEST(bgzfWriter_test)
+{
+    const char* path = SEQAN_TEMP_FILENAME();
+    const std::string fastq = makeFastq(20000);
+    SEQAN_ASSERT(writeBgzf(path, fastq));
+    const std::string file = readFile(path);
+    SEQAN_ASSERT_EQ(file.substr(file.size() - 28, 4), std::string("\x1f\x8b\x08\x04", 4));    // end-of-file marker
+    ptc::ThreadPool threadPool(2);
+    GzipDecompressor decompressor;
+    SEQAN_ASSERT(decompressor.open(path, threadPool));
+    std::string inflated;
+    GzipDecompressor::Chunk chunk;
+    while (decompressor.next(chunk))
+        inflated.append(chunk.begin(), chunk.end());
+    SEQAN_ASSERT_EQ(inflated, fastq);
+#ifdef __linux__
+    // every write to /dev/full fails, the error has to be reported
+    for (const std::string& data : { fastq, std::string("@r1\nACGT\n+\nIIII\n") })
+    {
+        bool failed = false;
+        try
+        {
+            failed = !writeBgzf("/dev/full", data);
+        }
+        catch (const std::runtime_error&)
+        {
+            failed = true;
+        }
+        SEQAN_ASSERT(failed);
+    }
+#endif
+}
+
+SEQAN_BEGIN_TESTSUITE(test_fastq_reader)
+{
+    SEQAN_CALL_TEST(parseFastqRecord_test);
+    SEQAN_CALL_TEST(mappedFastqReader_test);
+    SEQAN_CALL_TEST(inflatingFastqReader_chunkBoundary_test);
+    SEQAN_CALL_TEST(inflatingFastqReader_concatenatedMembers_test);
+    SEQAN_CALL_TEST(inflatingFastqReader_truncated_test);
+    SEQAN_CALL_TEST(inflatingFastqReader_earlyDestruction_test);
+    SEQAN_CALL_TEST(bgzfWriter_test);
+}
+SEQAN_END_TESTSUITE
@@ -0,0 +1,308 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Compares FusedStages with the stages run one after the other over the whole
+// batch, the way the transformer of flexlib.cpp ran them before.
+// ==========================================================================
+
+#undef SEQAN_ENABLE_TESTING
+#define SEQAN_ENABLE_TESTING 1
+
+#include <string>
+#include <vector>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/seq_io.h>
+
+#include "fused_stages.h"
+
+using namespace seqan;
+
+// the separate stages, every stage sweeps the batch and removes the reads it drops
+template <typename TReads, typename TFinder, typename TlsBlock, typename TStats>
+void runSeparateStages(TReads& reads, const ProcessingParams& processingParams, const DemultiplexingParams& demultiplexingParams,
+    const QualityTrimmingParams& qualityTrimmingParams, const TFinder& finder, TlsBlock& tlsBlock, TStats& stats)
+{
+    if (processingParams.runPre)
+    {
+        if (processingParams.trimLeft + processingParams.trimRight + processingParams.minLen != 0)
+            preTrim(reads, processingParams.trimLeft, processingParams.trimRight, processingParams.minLen, processingParams.tagTrimming, stats);
+        if (processingParams.runCheckUncalled)
+        {
+            if (processingParams.runSubstitute)
+                processN(reads, processingParams.uncalled, processingParams.substitute, stats);
+            else
+                processN(reads, processingParams.uncalled, NoSubstitute(), stats);
+        }
+    }
+    if (demultiplexingParams.run && check(reads, demultiplexingParams.barcodes, stats))
+        demultiplex(reads, finder, demultiplexingParams.hardClip, stats, demultiplexingParams.approximate, demultiplexingParams.exclude);
+    if (qualityTrimmingParams.run)
+    {
+        switch (qualityTrimmingParams.trim_mode)
+        {
+        case TrimmingMode::E_WINDOW:
+            trimBatch(reads, qualityTrimmingParams.cutoff, Mean(5), qualityTrimmingParams.tag);
+            break;
+        case TrimmingMode::E_BWA:
+            trimBatch(reads, qualityTrimmingParams.cutoff, BWA(), qualityTrimmingParams.tag);
+            break;
+        case TrimmingMode::E_TAIL:
+            trimBatch(reads, qualityTrimmingParams.cutoff, Tail(), qualityTrimmingParams.tag);
+            break;
+        }
+        stats.removedQuality += removeShortSeqs(reads, qualityTrimmingParams.min_length);
+    }
+    if (tlsBlock.params.run)
+    {
+        if (tlsBlock.params.tag)
+            if (tlsBlock.params.best)
+                stripAdapterBatch(reads, tlsBlock, TagAdapter<true>(), AdapterSelectionMethod::Best(), ErrorRateMode::linear());
+            else
+                stripAdapterBatch(reads, tlsBlock, TagAdapter<true>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::linear());
+        else
+            if (tlsBlock.params.best)
+                stripAdapterBatch(reads, tlsBlock, TagAdapter<false>(), AdapterSelectionMethod::Best(), ErrorRateMode::linear());
+            else
+                stripAdapterBatch(reads, tlsBlock, TagAdapter<false>(), AdapterSelectionMethod::TopDown(), ErrorRateMode::linear());
+    }
+    if (processingParams.runPost)
+    {
+        if ((processingParams.minLength != 0) && (processingParams.finalLength == 0))
+            stats.removedShort += removeShortSeqs(reads, processingParams.minLength);
+        else if (processingParams.finalLength != 0)
+            trimTo(reads, processingParams.finalLength, stats);
+    }
+}
+
+const char* const adapter1 = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+const char* const adapter2 = "CTGTCTCTTATACACATCT";
+
+// random bases with a few N, a part of an adapter at the end of every second read and a low quality tail on every third
+Dna5QString makeSequence(unsigned& state, const std::string& barcode, const unsigned int len)
+{
+    auto random = [&state]() {state = state * 1103515245 + 12345; return state >> 16; };
+    std::string bases = barcode;
+    for (unsigned int i = 0; i < len; ++i)
+        bases += random() % 40 == 0 ? 'N' : "ACGT"[random() % 4];
+    if (random() % 2 == 0)
+    {
+        const std::string adapter = random() % 2 == 0 ? adapter1 : adapter2;
+        const unsigned int pos = barcode.size() + random() % len;
+        for (unsigned int i = 0; pos + i < bases.size() && i < adapter.size(); ++i)
+            bases[pos + i] = adapter[i];
+    }
+    const bool badTail = random() % 3 == 0;
+    Dna5QString seq;
+    for (unsigned int i = 0; i < bases.size(); ++i)
+    {
+        Dna5Q c = bases[i];
+        assignQualityValue(c, badTail && i + 15 >= bases.size() ? 2 + random() % 10 : 30 + random() % 10);
+        appendValue(seq, c);
+    }
+    return seq;
+}
+
+// barcode of read i, one in five reads has no barcode and one in seven has a substitution in its barcode
+std::string makeBarcode(unsigned& state, const std::vector<std::string>& barcodes, const unsigned int i)
+{
+    std::string barcode = i % 5 == 0 ? std::string("TATATA") : barcodes[i % barcodes.size()];
+    if (i % 7 == 0)
+    {
+        state = state * 1103515245 + 12345;
+        barcode[(state >> 16) % barcode.size()] = 'T';
+    }
+    return barcode;
+}
+
+// the lengths repeat, so that --batch aligns reads of equal length together
+const unsigned int readLengths[] = { 24, 60, 60, 90, 120 };
+
+template <typename TSeq>
+void makeRead(Read<TSeq>& read, unsigned& state, const std::vector<std::string>& barcodes, const unsigned int i)
+{
+    read.id = "read" + std::to_string(i);
+    read.seq = makeSequence(state, makeBarcode(state, barcodes, i), readLengths[i % 5]);
+}
+
+template <typename TSeq>
+void makeRead(ReadMultiplex<TSeq>& read, unsigned& state, const std::vector<std::string>& barcodes, const unsigned int i)
+{
+    read.id = "read" + std::to_string(i);
+    read.demultiplex = makeBarcode(state, barcodes, i).c_str();
+    read.seq = makeSequence(state, std::string(), readLengths[i % 5]);
+}
+
+template <typename TSeq>
+void makeRead(ReadPairedEnd<TSeq>& read, unsigned& state, const std::vector<std::string>& barcodes, const unsigned int i)
+{
+    read.id = "read" + std::to_string(i) + "/1";
+    read.idRev = "read" + std::to_string(i) + "/2";
+    read.seq = makeSequence(state, makeBarcode(state, barcodes, i), readLengths[i % 5]);
+    read.seqRev = makeSequence(state, std::string(), readLengths[(i * 3) % 5]);
+}
+
+struct StageParams
+{
+    ProcessingParams processing;
+    DemultiplexingParams demultiplexing;
+    QualityTrimmingParams qualityTrimming;
+    AdapterTrimmingParams adapterTrimming;
+
+    StageParams()
+    {
+        processing.runPre = true;
+        processing.trimLeft = 1;
+        processing.trimRight = 2;
+        processing.minLen = 20;
+        processing.runCheckUncalled = true;
+        processing.uncalled = 2;
+        processing.runPost = true;
+        processing.minLength = 25;
+
+        demultiplexing.barcodes = { "ACGTAC", "CCAGGT", "GGTTCA", "TGCATG" };
+        demultiplexing.barcodeIds = { "s1", "s2", "s3", "s4" };
+        demultiplexing.approximate = true;
+        demultiplexing.run = true;
+
+        qualityTrimming.run = true;
+        qualityTrimming.trim_mode = TrimmingMode::E_TAIL;
+        qualityTrimming.cutoff = 20;
+        qualityTrimming.min_length = 20;
+
+        adapterTrimming.run = true;
+        adapterTrimming.adapters = AdapterSet{ AdapterItem(adapter1, AdapterItem::end3, 0, 0, false, false),
+            AdapterItem(adapter2, AdapterItem::end3, 0, 1, false, false), AdapterItem(adapter1, AdapterItem::end3, 0, 2, false, true) };
+        adapterTrimming.mode = AdapterMatchSettings(4, 0, 0.1, 0, 1);
+        adapterTrimming.best = true;
+        build();
+    }
+
+    // has to be called after the adapters or the match settings are changed
+    void build()
+    {
+        adapterTrimming.orientedAdapters.build(adapterTrimming.adapters);
+        adapterTrimming.adapterIndex.build(adapterTrimming.adapters, adapterTrimming.mode, ErrorRateMode::linear());
+    }
+};
+
+// runs FusedStages and the separate stages on copies of the same reads, the results have to be identical
+template <typename TRead>
+void compareStages(const StageParams& params)
+{
+    using TStats = GeneralStats;
+    using TlsBlock = TlsBlockAdapterTrimming<TStats::TAdapterTrimmingStats>;
+
+    std::vector<TRead> input(1000);
+    unsigned state = 1;
+    for (unsigned int i = 0; i < input.size(); ++i)
+        makeRead(input[i], state, params.demultiplexing.barcodes, i);
+    const HashBarcodeMatcher finder(params.demultiplexing.barcodes, params.demultiplexing.approximate);
+
+    TStats fusedStats(params.demultiplexing.barcodes.size() + 2, params.adapterTrimming.adapters.size());
+    TStats separateStats = fusedStats;
+    auto fusedReads = input;
+    auto separateReads = input;
+    {
+        TlsBlock tlsBlock(fusedStats.adapterTrimmingStats, params.adapterTrimming);
+        FusedStages<HashBarcodeMatcher, TlsBlock, TStats> stages(params.processing, params.demultiplexing, params.qualityTrimming,
+            finder, tlsBlock, fusedStats);
+        stages(fusedReads);
+    }
+    {
+        TlsBlock tlsBlock(separateStats.adapterTrimmingStats, params.adapterTrimming);
+        runSeparateStages(separateReads, params.processing, params.demultiplexing, params.qualityTrimming, finder, tlsBlock, separateStats);
+    }
+
+    // some reads are dropped and some are kept
+    SEQAN_ASSERT_GT(separateReads.size(), 0u);
+    SEQAN_ASSERT_LT(separateReads.size(), input.size());
+    SEQAN_ASSERT_EQ(fusedReads.size(), separateReads.size());
+    for (unsigned int i = 0; i < fusedReads.size(); ++i)
+    {
+        SEQAN_ASSERT(fusedReads[i] == separateReads[i]);
+        SEQAN_ASSERT_EQ(fusedReads[i].qTrimmed, separateReads[i].qTrimmed);
+    }
+
+    SEQAN_ASSERT_EQ(fusedStats.removedN, separateStats.removedN);
+    SEQAN_ASSERT_EQ(fusedStats.removedDemultiplex, separateStats.removedDemultiplex);
+    SEQAN_ASSERT_EQ(fusedStats.removedQuality, separateStats.removedQuality);
+    SEQAN_ASSERT_EQ(fusedStats.removedShort, separateStats.removedShort);
+    SEQAN_ASSERT_EQ(fusedStats.uncalledBases, separateStats.uncalledBases);
+    SEQAN_ASSERT(fusedStats.matchedBarcodeReads == separateStats.matchedBarcodeReads);
+    const auto& fusedAdapterStats = fusedStats.adapterTrimmingStats;
+    const auto& separateAdapterStats = separateStats.adapterTrimmingStats;
+    SEQAN_ASSERT(fusedAdapterStats.numRemoved == separateAdapterStats.numRemoved);
+    SEQAN_ASSERT(fusedAdapterStats.removedLength == separateAdapterStats.removedLength);
+    SEQAN_ASSERT_EQ(fusedAdapterStats.overlapSum, separateAdapterStats.overlapSum);
+    SEQAN_ASSERT_EQ(fusedAdapterStats.minOverlap, separateAdapterStats.minOverlap);
+    SEQAN_ASSERT_EQ(fusedAdapterStats.maxOverlap, separateAdapterStats.maxOverlap);
+}
+
+// the stage options are varied, so that every stage drops reads in at least one of the runs
+template <typename TRead>
+void compareStageVariants()
+{
+    StageParams params;
+    compareStages<TRead>(params);
+
+    params.processing.tagTrimming = true;
+    params.processing.runSubstitute = true;
+    params.demultiplexing.hardClip = true;
+    params.qualityTrimming.trim_mode = TrimmingMode::E_WINDOW;
+    params.qualityTrimming.tag = true;
+    params.adapterTrimming.tag = true;
+    params.adapterTrimming.best = false;
+    compareStages<TRead>(params);
+
+    params.processing.tagTrimming = false;
+    params.processing.finalLength = 50;
+    params.demultiplexing.exclude = true;
+    params.qualityTrimming.trim_mode = TrimmingMode::E_BWA;
+    params.qualityTrimming.tag = false;
+    params.adapterTrimming.tag = false;
+    params.adapterTrimming.best = true;
+    params.adapterTrimming.mode = AdapterMatchSettings(3, 0, 0.2, 0, 2);
+    params.build();
+    compareStages<TRead>(params);
+}
+
+SEQAN_DEFINE_TEST(fusedStages_single_test)
+{
+    compareStageVariants<Read<Dna5QString>>();
+}
+
+SEQAN_DEFINE_TEST(fusedStages_multiplex_test)
+{
+    compareStageVariants<ReadMultiplex<Dna5QString>>();
+}
+
+SEQAN_DEFINE_TEST(fusedStages_paired_test)
+{
+    compareStageVariants<ReadPairedEnd<Dna5QString>>();
+}
+
+// --batch aligns reads of equal length together, FusedStages then compacts the batch before the adapter stage
+SEQAN_DEFINE_TEST(fusedStages_batch_test)
+{
+    StageParams params;
+    params.adapterTrimming.batch = true;
+    GeneralStats stats;
+    const TlsBlockAdapterTrimming<GeneralStats::TAdapterTrimmingStats> tlsBlock(stats.adapterTrimmingStats, params.adapterTrimming);
+    SEQAN_ASSERT(isBatchAdapterTrimming<Read<Dna5QString>>(tlsBlock, AdapterSelectionMethod::Best()));
+    compareStages<Read<Dna5QString>>(params);
+    compareStages<ReadMultiplex<Dna5QString>>(params);
+    params.adapterTrimming.tag = true;
+    params.demultiplexing.exclude = true;
+    compareStages<Read<Dna5QString>>(params);
+}
+
+SEQAN_BEGIN_TESTSUITE(test_fused_stages)
+{
+    SEQAN_CALL_TEST(fusedStages_single_test);
+    SEQAN_CALL_TEST(fusedStages_multiplex_test);
+    SEQAN_CALL_TEST(fusedStages_paired_test);
+    SEQAN_CALL_TEST(fusedStages_batch_test);
+}
+SEQAN_END_TESTSUITE
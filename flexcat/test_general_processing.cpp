@@ -183,6 +183,23 @@ SEQAN_DEFINE_TEST(findN_test)
     }
 }
 
+// reads longer than one SIMD block, with N in the blocks and in the tail
+SEQAN_DEFINE_TEST(findN_long_test)
+{
+    std::vector<Read<seqan::Dna5QString>> reads(3);
+    reads[0].seq = "ATGACTGTACACGTGATCGTACGTAGCAGCATGACTGTAC";
+    reads[1].seq = "ATGACTGTACACGTGNNCGTACGTAGCAGCATGACTGTNC";
+    reads[2].seq = "NTGACTGTACACGTGNNCGTACGTAGCAGCATGACTGTNC";
+    unsigned allowed = 3;
+
+    SEQAN_ASSERT_EQ(0, findN(reads[0], allowed, NoSubstitute()));
+    SEQAN_ASSERT_EQ(3, findN(reads[1], allowed, NoSubstitute()));
+    SEQAN_ASSERT_EQ(-1, findN(reads[2], allowed, NoSubstitute()));
+
+    SEQAN_ASSERT_EQ(3, findN(reads[1], allowed, 'A'));
+    SEQAN_ASSERT_EQ(reads[1].seq, seqan::Dna5QString("ATGACTGTACACGTGAACGTACGTAGCAGCATGACTGTAC"));
+}
+
 SEQAN_DEFINE_TEST(processN_test)
 {
     GeneralStats stats;
@@ -609,6 +626,7 @@ SEQAN_BEGIN_TESTSUITE(test_my_app_funcs)
 {
     SEQAN_CALL_TEST(removeShortSeqs_test);
     SEQAN_CALL_TEST(findN_test);
+    SEQAN_CALL_TEST(findN_long_test);
     SEQAN_CALL_TEST(processN_test);
     SEQAN_CALL_TEST(processN_paired_test);
     SEQAN_CALL_TEST(processN_multiplex_test);
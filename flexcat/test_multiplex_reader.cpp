@@ -0,0 +1,160 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Tests for AsyncMultiplexReader of multiplex_reader.h, the barcodes of the
+// multiplex file are read ahead in batches that pair with the read batches.
+// ==========================================================================
+
+#undef SEQAN_ENABLE_TESTING
+#define SEQAN_ENABLE_TESTING 1
+
+#include <exception>
+#include <fstream>
+#include <string>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/seq_io.h>
+
+#include "fastq_reader.h"
+#include "multiplex_reader.h"
+
+using namespace seqan;
+
+std::string makeBarcode(const unsigned int i)
+{
+    std::string barcode(6, 'A');
+    for (unsigned int k = 0; k < barcode.size(); ++k)
+        barcode[k] = "ACGT"[(i >> (2 * k)) & 3];
+    return barcode;
+}
+
+// the sequence of read i is its barcode followed by a tail of varying length
+std::string makeFastq(const unsigned int numRecords, const bool barcodesOnly)
+{
+    std::string fastq;
+    for (unsigned int i = 0; i < numRecords; ++i)
+    {
+        std::string seq = makeBarcode(i);
+        if (!barcodesOnly)
+            seq += std::string(20 + i % 31, "ACGT"[i % 4]);
+        fastq += "@r" + std::to_string(i) + "\n" + seq + "\n+\n" + std::string(seq.size(), 'I') + "\n";
+    }
+    return fastq;
+}
+
+// the file extension selects the format of SeqFileIn
+std::string writeFastq(const std::string& data)
+{
+    const std::string path = std::string(SEQAN_TEMP_FILENAME()) + ".fastq";
+    std::ofstream file(path, std::ios::binary);
+    file.write(data.data(), data.size());
+    return path;
+}
+
+std::string toString(const Dna5QString& seq)
+{
+    std::string s;
+    for (unsigned int i = 0; i < length(seq); ++i)
+        s.push_back(convert<char>(seq[i]));
+    return s;
+}
+
+bool nextThrows(AsyncMultiplexReader& reader)
+{
+    try
+    {
+        reader.next();
+    }
+    catch (const std::exception&)
+    {
+        return true;
+    }
+    return false;
+}
+
+// the n-th barcode batch belongs to the n-th batch of reads, record by record
+SEQAN_DEFINE_TEST(asyncMultiplexReader_pairing_test)
+{
+    const unsigned int numRecords = 1000;
+    const unsigned int batchSize = 64;
+    const std::string readsPath = writeFastq(makeFastq(numRecords, false));
+    const std::string barcodesPath = writeFastq(makeFastq(numRecords, true));
+    MappedFastqReader reads;
+    SEQAN_ASSERT(reads.open(readsPath.c_str()));
+    AsyncMultiplexReader barcodes;
+    SEQAN_ASSERT(!barcodes.isOpen());
+    SEQAN_ASSERT(barcodes.open(barcodesPath.c_str(), batchSize));
+    SEQAN_ASSERT(barcodes.isOpen());
+    unsigned int numPaired = 0;
+    while (true)
+    {
+        const auto& readBatch = reads.readBatch(batchSize);
+        const auto& barcodeBatch = barcodes.next();
+        SEQAN_ASSERT_EQ(barcodeBatch.size(), readBatch.size());
+        if (readBatch.empty())
+            break;
+        for (unsigned int k = 0; k < readBatch.size(); ++k)
+        {
+            SEQAN_ASSERT_EQ(std::string(readBatch[k].id), "r" + std::to_string(numPaired));
+            SEQAN_ASSERT_EQ(toString(barcodeBatch[k]), std::string(readBatch[k].seq).substr(0, 6));
+            ++numPaired;
+        }
+    }
+    SEQAN_ASSERT_EQ(numPaired, numRecords);
+    SEQAN_ASSERT(barcodes.next().empty());
+}
+
+SEQAN_DEFINE_TEST(asyncMultiplexReader_earlyEof_test)
+{
+    // the multiplex file ends before the reads, the last batch is short and all later ones are empty
+    {
+        AsyncMultiplexReader barcodes;
+        SEQAN_ASSERT(barcodes.open(writeFastq(makeFastq(150, true)).c_str(), 64));
+        SEQAN_ASSERT_EQ(barcodes.next().size(), 64u);
+        SEQAN_ASSERT_EQ(barcodes.next().size(), 64u);
+        const auto& last = barcodes.next();
+        SEQAN_ASSERT_EQ(last.size(), 22u);
+        SEQAN_ASSERT_EQ(toString(last[21]), makeBarcode(149));
+        for (unsigned int i = 0; i < 10; ++i)
+            SEQAN_ASSERT(barcodes.next().empty());
+    }
+    // the end of the file is reached exactly at the end of a batch
+    {
+        AsyncMultiplexReader barcodes;
+        SEQAN_ASSERT(barcodes.open(writeFastq(makeFastq(128, true)).c_str(), 64));
+        SEQAN_ASSERT_EQ(barcodes.next().size(), 64u);
+        SEQAN_ASSERT_EQ(barcodes.next().size(), 64u);
+        SEQAN_ASSERT(barcodes.next().empty());
+    }
+    // the reader is destroyed long before the end of the file, the reader thread is waiting for space then
+    {
+        AsyncMultiplexReader barcodes;
+        SEQAN_ASSERT(barcodes.open(writeFastq(makeFastq(20000, true)).c_str(), 10));
+        SEQAN_ASSERT_EQ(barcodes.next().size(), 10u);
+    }
+    SEQAN_ASSERT(!AsyncMultiplexReader().open("this_file_does_not_exist.fastq", 10));
+}
+
+// the batches before a malformed record are handed out, then the parse error is rethrown by every call of next()
+SEQAN_DEFINE_TEST(asyncMultiplexReader_error_test)
+{
+    AsyncMultiplexReader barcodes;
+    SEQAN_ASSERT(barcodes.open(writeFastq(makeFastq(100, true) + "r100\nACGTAC\n+\nIIIIII\n").c_str(), 32));
+    for (unsigned int b = 0; b < 3; ++b)
+    {
+        const auto& batch = barcodes.next();
+        SEQAN_ASSERT_EQ(batch.size(), 32u);
+        SEQAN_ASSERT_EQ(toString(batch[0]), makeBarcode(b * 32));
+    }
+    SEQAN_ASSERT(nextThrows(barcodes));
+    SEQAN_ASSERT(nextThrows(barcodes));
+}
+
+SEQAN_BEGIN_TESTSUITE(test_multiplex_reader)
+{
+    SEQAN_CALL_TEST(asyncMultiplexReader_pairing_test);
+    SEQAN_CALL_TEST(asyncMultiplexReader_earlyEof_test);
+    SEQAN_CALL_TEST(asyncMultiplexReader_error_test);
+}
+SEQAN_END_TESTSUITE
@@ -0,0 +1,167 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Tests for the read types and the recycling ReadBatch of read.h.
+// ==========================================================================
+
+#undef SEQAN_ENABLE_TESTING
+#define SEQAN_ENABLE_TESTING 1
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+
+#include "read.h"
+
+using namespace seqan;
+
+// counts every heap allocation of the test program, used to check that a recycled batch allocates nothing
+static std::atomic<std::size_t> numAllocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++numAllocations;
+    if (void* p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+SEQAN_DEFINE_TEST(readMove_test)
+{
+    using TRead = ReadMultiplexPairedEnd<seqan::Dna5QString>;
+    TRead a;
+    a.id = a.idRev = "a";
+    a.seq = a.seqRev = a.demultiplex = "ACGT";
+    a.demuxResult = 3;
+    TRead b;
+    b.id = b.idRev = "b";
+    b.seq = b.seqRev = b.demultiplex = "GGGGGG";
+
+    // the source of a move assignment is empty afterwards, but keeps the buffers of the target
+    b = std::move(a);
+    SEQAN_ASSERT_EQ(b.id, "a");
+    SEQAN_ASSERT_EQ(b.idRev, "a");
+    SEQAN_ASSERT_EQ(b.seq, "ACGT");
+    SEQAN_ASSERT_EQ(b.seqRev, "ACGT");
+    SEQAN_ASSERT_EQ(b.demultiplex, "ACGT");
+    SEQAN_ASSERT_EQ(b.demuxResult, 3);
+    SEQAN_ASSERT(a.id.empty());
+    SEQAN_ASSERT(a.idRev.empty());
+    SEQAN_ASSERT_EQ(length(a.seq), 0u);
+    SEQAN_ASSERT_EQ(length(a.seqRev), 0u);
+    SEQAN_ASSERT_EQ(length(a.demultiplex), 0u);
+    SEQAN_ASSERT_EQ(a.demuxResult, 0);
+    SEQAN_ASSERT_GT(capacity(a.seq), 0u);
+
+    const TRead c(std::move(b));
+    SEQAN_ASSERT_EQ(c.seq, "ACGT");
+    SEQAN_ASSERT_EQ(length(b.seq), 0u);
+    SEQAN_ASSERT(b.id.empty());
+}
+
+SEQAN_DEFINE_TEST(readBatch_test)
+{
+    using TRead = ReadPairedEnd<seqan::Dna5QString>;
+    ReadBatch<TRead> reads(4);
+    const unsigned int numReads = reads.capacity() + 5;     // grow past the capacity, the reads are moved
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        reads[i].id = reads[i].idRev = std::to_string(i);
+        reads[i].seq = reads[i].seqRev = std::string(i + 1, 'A');
+        reads[i].demuxResult = i;
+    }
+    reads.resize(numReads);
+    for (unsigned int i = 4; i < numReads; ++i)
+    {
+        SEQAN_ASSERT(reads[i].id.empty());
+        reads[i].id = reads[i].idRev = std::to_string(i);
+        reads[i].seq = reads[i].seqRev = std::string(i + 1, 'A');
+        reads[i].demuxResult = i;
+    }
+
+    // keeps the reads with an odd index, the others are parked in the spare list
+    for (unsigned int i = 0; i < numReads; i += 2)
+        resize(reads[i].seq, 0);
+    reads.erase(std::remove_if(reads.begin(), reads.end(), [](const TRead& read) {return length(read.seq) == 0; }), reads.end());
+    SEQAN_ASSERT_EQ(length(reads), numReads / 2);
+    for (unsigned int i = 0; i < length(reads); ++i)
+    {
+        const unsigned int original = 2 * i + 1;
+        SEQAN_ASSERT_EQ(reads[i].id, std::to_string(original));
+        SEQAN_ASSERT_EQ(reads[i].idRev, std::to_string(original));
+        SEQAN_ASSERT_EQ(reads[i].seq, std::string(original + 1, 'A'));
+        SEQAN_ASSERT_EQ(reads[i].seqRev, std::string(original + 1, 'A'));
+        SEQAN_ASSERT_EQ(static_cast<unsigned int>(reads[i].demuxResult), original);
+    }
+
+    // refilling takes the parked reads, they come back empty but keep their buffers
+    const unsigned int numKept = length(reads);
+    reads.resize(numReads);
+    unsigned int numRecycled = 0;
+    for (unsigned int i = numKept; i < numReads; ++i)
+    {
+        SEQAN_ASSERT(reads[i].id.empty());
+        SEQAN_ASSERT(reads[i].idRev.empty());
+        SEQAN_ASSERT_EQ(length(reads[i].seq), 0u);
+        SEQAN_ASSERT_EQ(length(reads[i].seqRev), 0u);
+        SEQAN_ASSERT_EQ(reads[i].demuxResult, 0);
+        SEQAN_ASSERT_EQ(reads[i].qTrimmed, 0);
+        numRecycled += capacity(reads[i].seqRev) > 0;
+    }
+    SEQAN_ASSERT_EQ(numRecycled, numReads - numKept);
+    for (unsigned int i = 0; i < numKept; ++i)
+        SEQAN_ASSERT_EQ(reads[i].id, std::to_string(2 * i + 1));
+}
+
+// recycle, shrink and regrow a batch, after the first round no sequence or id is allocated anymore
+SEQAN_DEFINE_TEST(readBatch_steadyState_test)
+{
+    using TRead = ReadPairedEnd<seqan::Dna5QString>;
+    const std::string id(40, 'x');      // longer than the small string buffer of std::string
+    const seqan::Dna5QString seq = std::string(150, 'A');
+    ReadBatch<TRead> reads;
+    auto fill = [&reads, &id, &seq](const unsigned int numReads)
+    {
+        reads.resize(numReads);
+        for (auto& read : reads)
+        {
+            read.id = read.idRev = id;
+            read.seq = read.seqRev = seq;
+        }
+    };
+    auto cycle = [&reads, &fill]()
+    {
+        fill(1000);
+        for (unsigned int i = 0; i < 1000; i += 3)
+            resize(reads[i].seq, 0);
+        reads.erase(std::remove_if(reads.begin(), reads.end(), [](const TRead& read) {return length(read.seq) == 0; }), reads.end());
+        reads.resize(500);
+        fill(1000);
+    };
+    cycle();
+    const std::size_t allocationsBefore = numAllocations;
+    for (unsigned int i = 0; i < 3; ++i)
+        cycle();
+    SEQAN_ASSERT_EQ(numAllocations - allocationsBefore, 0u);
+}
+
+SEQAN_BEGIN_TESTSUITE(test_read)
+{
+    SEQAN_CALL_TEST(readMove_test);
+    SEQAN_CALL_TEST(readBatch_test);
+    SEQAN_CALL_TEST(readBatch_steadyState_test);
+}
+SEQAN_END_TESTSUITE
@@ -0,0 +1,104 @@
+// ==========================================================================
+// Author: Benjamin Menkuec <benjamin@menkuec.de>
+// ==========================================================================
+// Tests for OutputStreams of read_writer.h, the reads of several samples are
+// written by asynchronous writer shards into one BGZF file per sample.
+// ==========================================================================
+
+#undef SEQAN_ENABLE_TESTING
+#define SEQAN_ENABLE_TESTING 1
+
+#include <string>
+#include <vector>
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/seq_io.h>
+#include <zlib.h>
+
+#include "read.h"
+#include "read_writer.h"
+
+using namespace seqan;
+
+std::string gunzipFile(const std::string& path)
+{
+    std::string data;
+    gzFile file = gzopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return data;
+    char buffer[1 << 16];
+    int n;
+    while ((n = gzread(file, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, n);
+    gzclose(file);
+    return data;
+}
+
+// read i of batch b belongs to sample i % (numSamples + 1), 0 = unidentified
+void fillBatch(ReadBatch<ReadMultiplex<Dna5QString>>& reads, const unsigned int b, const unsigned int numReads,
+    const unsigned int numSamples, std::vector<std::string>& expected, std::vector<unsigned int>& expectedNumReads)
+{
+    reads.resize(numReads);
+    for (unsigned int i = 0; i < numReads; ++i)
+    {
+        const unsigned int len = 20 + (i * 7 + b) % 61;
+        std::string seq(len, 'A');
+        std::string qual(len, '!');
+        for (unsigned int k = 0; k < len; ++k)
+        {
+            seq[k] = "ACGTN"[(i + k * 3 + b) % 5];
+            qual[k] = static_cast<char>('!' + (i + k) % 41);
+        }
+        auto& read = reads[i];
+        read.id = "b" + std::to_string(b) + "_r" + std::to_string(i);
+        read.seq = seq;
+        for (unsigned int k = 0; k < len; ++k)
+            assignQualityValue(read.seq[k], qual[k] - '!');
+        read.demuxResult = i % (numSamples + 1);
+        expected[read.demuxResult] += "@" + read.id + "\n" + seq + "\n+\n" + qual + "\n";
+        ++expectedNumReads[read.demuxResult];
+    }
+}
+
+SEQAN_DEFINE_TEST(outputStreams_multiSample_test)
+{
+    const unsigned int numSamples = 5;
+    const std::vector<std::string> names = { "s1", "s2", "s3", "s4", "s5" };
+    for (unsigned int numThreads : {1u, 2u, 4u})
+    {
+        const std::string basePath = std::string(SEQAN_TEMP_FILENAME()) + ".fastq.gz";
+        std::vector<std::string> expected(numSamples + 1);
+        std::vector<unsigned int> expectedNumReads(numSamples + 1, 0);
+        {
+            ptc::ThreadPool threadPool(numThreads);
+            OutputStreams outputStreams(basePath, false, threadPool);
+            ReadBatch<ReadMultiplex<Dna5QString>> reads;
+            for (unsigned int b = 0; b < 20; ++b)
+            {
+                fillBatch(reads, b, 1000 + b * 13, numSamples, expected, expectedNumReads);
+                outputStreams.writeSeqs(reads, names);
+                // the reads are moved into the shards, the batch can be refilled right away
+                SEQAN_ASSERT_EQ(length(reads), 1000u + b * 13);
+                for (const auto& read : reads)
+                    SEQAN_ASSERT(read.id.empty() && length(read.seq) == 0);
+            }
+            SEQAN_ASSERT(outputStreams.close());
+            SEQAN_ASSERT_EQ(outputStreams.getNumStreams(), numSamples + 1);
+            unsigned int totalReads = 0;
+            for (unsigned int s = 0; s <= numSamples; ++s)
+            {
+                SEQAN_ASSERT_EQ(outputStreams.getNumReads(s), expectedNumReads[s]);
+                SEQAN_ASSERT_EQ(gunzipFile(outputStreams.getFilename(s)), expected[s]);
+                totalReads += outputStreams.getNumReads(s);
+            }
+            SEQAN_ASSERT_EQ(totalReads, 20u * 1000u + 13u * 190u);
+        }
+    }
+}
+
+SEQAN_BEGIN_TESTSUITE(test_read_writer)
+{
+    SEQAN_CALL_TEST(outputStreams_multiSample_test);
+}
+SEQAN_END_TESTSUITE
@@ -120,10 +120,41 @@ SEQAN_DEFINE_TEST(cut_bwa_test)
 	}
 }
 
+// long reads with a good head and a bad tail, compared with the generic per base implementations
+SEQAN_DEFINE_TEST(trim_long_read_test)
+{
+    const char bases[] = "ACGTN";
+    unsigned state = 1;
+    for (unsigned r = 0; r < 200; ++r)
+    {
+        seqan::String<seqan::Dna5Q> seq;
+        const unsigned len = 5 + r;
+        for (unsigned i = 0; i < len; ++i)
+        {
+            state = state * 1103515245 + 12345;
+            seqan::Dna5Q c = bases[(state >> 16) % 5];
+            assignQualityValue(c, i < len * 2 / 3 ? 25 + (state >> 8) % 15 : (state >> 8) % 30);
+            appendValue(seq, c);
+        }
+        for (unsigned cutoff = 0; cutoff < 45; cutoff += 11)
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(seqan::begin(seq, seqan::Standard()));
+            SEQAN_ASSERT_EQ(_trimRead(seq, cutoff, Tail()), _trimRead(bytes, len, cutoff, Tail()));
+            SEQAN_ASSERT_EQ(_trimRead(seq, cutoff, BWA()), _trimRead(bytes, len, cutoff, BWA()));
+            SEQAN_ASSERT_EQ(_trimRead(seq, cutoff, Mean(5)), _trimRead(bytes, len, cutoff, Mean(5)));
+        }
+        seqan::String<seqan::Dna5Q> trimmed = seq;
+        const unsigned res = trimRead(trimmed, 20, BWA());
+        SEQAN_ASSERT_EQ(len - res, length(trimmed));
+        SEQAN_ASSERT(prefix(seq, length(trimmed)) == trimmed);
+    }
+}
+
 SEQAN_BEGIN_TESTSUITE(test_my_app_funcs)
 {
     SEQAN_CALL_TEST(sliding_window_test);
     SEQAN_CALL_TEST(cut_tail_test);
     SEQAN_CALL_TEST(cut_bwa_test);
+    SEQAN_CALL_TEST(trim_long_read_test);
 }
 SEQAN_END_TESTSUITE